@@ -14,491 +14,6168 @@
  *     - Simple vector linear algebra (dot product, L2 norm)
  *     - Array utilities (print, reverse, fill, compare, unique, sort, clip, any, all)
  *     - Range and linspace
+ *     - Rolling-window statistics (moving sum, mean, variance, std, min, max)
+ *     - Cumulative operations (cumsum, cumprod, cummax, cummin) and diff
+ *     - Selection without sorting (nth_element, partition, median, percentiles)
+ *     - Ranking (stable radix argsort, top-k values and indices)
+ *     - Mergeable streaming quantile sketch (t-digest) with binary serialization
+ *     - Histograms (uniform or custom edges), bincount and digitize
+ *     - Bit-packed boolean masks (comparisons, where, masked arithmetic and reductions)
+ *     - Stream compaction by mask, gather (take) and scatter (put)
+ *     - Selectable summation accuracy (pairwise, Neumaier, exact) for sum, mean, variance, dot
+ *     - Random arrays (Philox / xoshiro256++; uniform, normal, exponential, integer)
+ *     - Optional huge-page and NUMA placement policy for large arrays (Linux)
+ *     - FFT of any length (mixed radix 2/3/4/5, Bluestein), real transforms, cached plans
+ *     - Convolution and correlation (full/same/valid), direct or FFT chosen by a cost model
+ *     - Polynomial evaluation (polyval) and piecewise-linear interpolation (interp)
+ *     - searchsorted with galloping, binary or reusable Eytzinger-layout search
+ *     - Benchmark harness (-DCNUMPY_BENCH): ns/element, GB/s, cycles, median/p99, JSON
+ *     - Optional instrumentation (-DCNUMPY_INSTRUMENT): per-op calls, elements, bytes, cycles
+ *     - Hardware counters (-DCNUMPY_PERF, Linux): IPC and cache/branch/TLB misses per element
+ *     - Memory tracking (-DCNUMPY_TRACK_MEMORY): live/peak bytes, allocation sites, leak report at exit
+ *     - Python bindings in cnumpy_python.c (zero-copy buffers, GIL released in kernels)
+ *     - Apache Arrow C Data Interface import/export (float64 zero-copy, validity as masks)
  *
  *   All variable and function names use clear, standard English.
- *   The code is written for clarity: no macro/function pointer dark magic, no unnecessary nesting.
+ *   The code is written for clarity: no unnecessary nesting, and kernels are plain functions.
+ *   Function pointers appear only as the kernel handed to a shared driver (apply_unary,
+ *   apply_rolling, apply_scan, the benchmark table) and as the release callbacks the Arrow C
+ *   Data Interface requires. Macros are reserved for the optional builds:
+ *   INSTRUMENT_BEGIN/END scopes that compile to nothing without -DCNUMPY_INSTRUMENT, and,
+ *   only under -DCNUMPY_TRACK_MEMORY, wrappers that give the array-creation functions
+ *   (create_array, allocate_array, copy_array, array_zeros/ones/full/range/linspace) the
+ *   caller's file and line before calling the function of the same name.
  *   All memory allocations are handled in a straightforward manner.
  *
  * Usage:
  *    1. Save this file as cnumpy_allinone.c
  *    2. Compile with:  gcc cnumpy_allinone.c -o cnumpy_allinone -lm
  *    3. Run: ./cnumpy_allinone
+ *    Benchmarks: gcc -O2 -DCNUMPY_BENCH cnumpy_allinone.c -o cnumpy_bench -lm && ./cnumpy_bench --help
+ *    Add -DCNUMPY_PERF to either build for perf_event_open hardware counters
+ *    As a library: #define CNUMPY_NO_MAIN, then #include "cnumpy_allinone.c" (see cnumpy_python.c)
  *
  * Author: ChatGPT (OpenAI), customized for open source students, 2024
  * License: MIT
  * ===========================================================================
  */
 
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE                     // madvise, syscall and posix_memalign under strict -std modes
+#endif
 #include <stdio.h>
 #include <stdlib.h>
 #include <math.h>
 #include <stdbool.h>
 #include <string.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+#if defined(__linux__)
+#include <sys/mman.h>                   // madvise, for the huge-page allocation policy
+#include <sys/syscall.h>                // mbind, for the NUMA allocation policy
+#include <unistd.h>
+#include <sched.h>                      // sched_setaffinity, for benchmark CPU pinning
+#endif
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <x86intrin.h>                  // __rdtsc, the cycle counter used for timing
+#endif
+#include <stdatomic.h>                  // ziggurat table setup, instrumentation counters, memory registry lock
+#if defined(CNUMPY_PERF)
+#if !defined(__linux__)
+#error "CNUMPY_PERF reads hardware counters through Linux perf_event_open"
+#endif
+#include <linux/perf_event.h>           // hardware counters for the benchmark and instrumentation builds
+#endif
+#if defined(__SSE2__)
+#include <emmintrin.h>                  // streaming stores for very large fills, FFT butterflies
+#endif
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846     // not provided by strict ISO C builds
+#endif
 
 // -------------------------- Struct Definition --------------------------
 
-typedef struct {
-    double *data;          // pointer to the array of doubles
-    size_t size;           // length of the array
-} CNumPyArray;
+typedef struct {
+    double *data;          // pointer to the array of doubles
+    size_t size;           // length of the array
+} CNumPyArray;
+
+// -------------------------- Timing --------------------------
+//
+// A monotonic clock and the CPU's cycle counter, shared by the convolution cost model and the
+// benchmark harness. The cycle counter is the x86 time-stamp counter (constant-rate reference
+// cycles on current CPUs); elsewhere it reads 0 and has_cycle_counter() is false.
+
+void current_time(struct timespec *now)
+{
+#if defined(CLOCK_MONOTONIC)
+    clock_gettime(CLOCK_MONOTONIC, now);
+#else
+    timespec_get(now, TIME_UTC);
+#endif
+}
+
+double elapsed_seconds(const struct timespec *since)
+{
+    struct timespec now;
+    current_time(&now);
+    return (double)(now.tv_sec - since->tv_sec) + 1e-9 * (double)(now.tv_nsec - since->tv_nsec);
+}
+
+bool has_cycle_counter(void)
+{
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    return true;
+#else
+    return false;
+#endif
+}
+
+uint64_t read_cycle_counter(void)
+{
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+// -------------------------- Hardware Counters --------------------------
+//
+// Compiled in with -DCNUMPY_PERF (Linux). Each thread opens one perf_event_open group counting
+// its own user-space cycles, instructions, L1 data-cache read misses, last-level cache misses,
+// branch misses and data-TLB read misses. Events the CPU or kernel does not offer are left out
+// of the group, and the whole group is unavailable when there is no PMU (common in virtual
+// machines) or kernel.perf_event_paranoid forbids it; missing readings are reported as
+// unavailable, never as zero. When the kernel multiplexes the group, counts are scaled by
+// enabled/running time. Used by the benchmark harness and by instrumentation builds.
+
+#if defined(CNUMPY_PERF)
+
+typedef enum {
+    PERF_CYCLES, PERF_INSTRUCTIONS, PERF_L1D_MISSES, PERF_LLC_MISSES, PERF_BRANCH_MISSES, PERF_DTLB_MISSES,
+    PERF_EVENT_COUNT
+} PerfEvent;
+
+const char *perf_event_names[PERF_EVENT_COUNT] = {
+    "cycles", "instructions", "l1d_misses", "llc_misses", "branch_misses", "dtlb_misses",
+};
+
+#define PERF_CACHE_READ_MISS(cache) ((cache) | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16))
+
+const struct { uint32_t type; uint64_t config; } perf_event_configs[PERF_EVENT_COUNT] = {
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    {PERF_TYPE_HW_CACHE, PERF_CACHE_READ_MISS(PERF_COUNT_HW_CACHE_L1D)},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+    {PERF_TYPE_HW_CACHE, PERF_CACHE_READ_MISS(PERF_COUNT_HW_CACHE_DTLB)},
+};
+
+typedef struct {
+    int descriptors[PERF_EVENT_COUNT];      // -1 for events that could not be opened
+    PerfEvent slots[PERF_EVENT_COUNT];      // event of each value in a group read, in opening order
+    int slot_count;                         // 0 when no counter is available
+} PerfCounters;
+
+typedef struct {
+    uint64_t time_enabled;
+    uint64_t time_running;
+    uint64_t values[PERF_EVENT_COUNT];      // raw counts by PerfEvent
+} PerfSample;
+
+typedef struct {
+    bool available[PERF_EVENT_COUNT];
+    double counts[PERF_EVENT_COUNT];        // scaled for multiplexing
+} PerfReading;
+
+int open_perf_event(PerfEvent event, int group)
+{
+    struct perf_event_attr attributes;
+    memset(&attributes, 0, sizeof(attributes));
+    attributes.size = sizeof(attributes);
+    attributes.type = perf_event_configs[event].type;
+    attributes.config = perf_event_configs[event].config;
+    attributes.exclude_kernel = 1;
+    attributes.exclude_hv = 1;
+    attributes.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    return (int)syscall(SYS_perf_event_open, &attributes, 0, -1, group, PERF_FLAG_FD_CLOEXEC);
+}
+
+// Counters for the calling thread; the first event that opens leads the group
+PerfCounters open_perf_counters(void)
+{
+    PerfCounters counters;
+    counters.slot_count = 0;
+    int leader = -1;
+    for (int event = 0; event < PERF_EVENT_COUNT; ++event)
+    {
+        counters.descriptors[event] = open_perf_event((PerfEvent)event, leader);
+        if (counters.descriptors[event] < 0)
+            continue;
+        if (leader < 0)
+            leader = counters.descriptors[event];
+        counters.slots[counters.slot_count++] = (PerfEvent)event;
+    }
+    return counters;
+}
+
+void close_perf_counters(PerfCounters *counters)
+{
+    for (int event = 0; event < PERF_EVENT_COUNT; ++event)
+    {
+        if (counters->descriptors[event] >= 0)
+            close(counters->descriptors[event]);
+        counters->descriptors[event] = -1;
+    }
+    counters->slot_count = 0;
+}
+
+// One read of the whole group; an unavailable group reads as all zeros
+PerfSample read_perf_counters(const PerfCounters *counters)
+{
+    PerfSample sample;
+    memset(&sample, 0, sizeof(sample));
+    if (counters->slot_count == 0)
+        return sample;
+    uint64_t buffer[3 + PERF_EVENT_COUNT];              // count, time enabled, time running, values
+    ssize_t expected = (ssize_t)((3 + counters->slot_count) * sizeof(uint64_t));
+    if (read(counters->descriptors[counters->slots[0]], buffer, sizeof(buffer)) != expected)
+        return sample;
+    sample.time_enabled = buffer[1];
+    sample.time_running = buffer[2];
+    for (int slot = 0; slot < counters->slot_count; ++slot)
+        sample.values[counters->slots[slot]] = buffer[3 + slot];
+    return sample;
+}
+
+// Scaled counts between two samples; nothing is available if the group never got on the PMU
+PerfReading perf_difference(const PerfCounters *counters, const PerfSample *before, const PerfSample *after)
+{
+    PerfReading reading;
+    memset(&reading, 0, sizeof(reading));
+    uint64_t running = after->time_running - before->time_running;
+    if (running == 0)
+        return reading;
+    double scale = (double)(after->time_enabled - before->time_enabled) / (double)running;
+    for (int slot = 0; slot < counters->slot_count; ++slot)
+    {
+        PerfEvent event = counters->slots[slot];
+        reading.available[event] = true;
+        reading.counts[event] = scale * (double)(after->values[event] - before->values[event]);
+    }
+    return reading;
+}
+
+void add_perf_reading(PerfReading *total, const PerfReading *reading)
+{
+    for (int event = 0; event < PERF_EVENT_COUNT; ++event)
+    {
+        total->available[event] = total->available[event] || reading->available[event];
+        total->counts[event] += reading->counts[event];
+    }
+}
+
+// Instructions per cycle, then misses per element; "-" (text) or null (JSON) where unavailable
+void print_perf_header(FILE *stream)
+{
+    fprintf(stream, " %6s %12s %12s %12s %12s", "IPC", "L1D miss/el", "LLC miss/el", "br miss/el", "dTLB miss/el");
+}
+
+void print_perf_reading(FILE *stream, const PerfReading *reading, double elements, bool json)
+{
+    bool has_ipc = reading->available[PERF_CYCLES] && reading->available[PERF_INSTRUCTIONS] && reading->counts[PERF_CYCLES] > 0.0;
+    double ipc = has_ipc ? reading->counts[PERF_INSTRUCTIONS] / reading->counts[PERF_CYCLES] : 0.0;
+    if (json && has_ipc)
+        fprintf(stream, ", \"ipc\": %.4g", ipc);
+    else if (json)
+        fprintf(stream, ", \"ipc\": null");
+    else if (has_ipc)
+        fprintf(stream, " %6.2f", ipc);
+    else
+        fprintf(stream, " %6s", "-");
+    for (int event = PERF_L1D_MISSES; event < PERF_EVENT_COUNT; ++event)
+    {
+        bool available = reading->available[event] && elements > 0.0;
+        double per_element = available ? reading->counts[event] / elements : 0.0;
+        if (json && available)
+            fprintf(stream, ", \"%s_per_element\": %.4g", perf_event_names[event], per_element);
+        else if (json)
+            fprintf(stream, ", \"%s_per_element\": null", perf_event_names[event]);
+        else if (available)
+            fprintf(stream, " %12.4f", per_element);
+        else
+            fprintf(stream, " %12s", "-");
+    }
+}
+
+#endif // CNUMPY_PERF
+
+// -------------------------- Instrumentation --------------------------
+//
+// Compiled out unless built with -DCNUMPY_INSTRUMENT. When enabled, every public kernel (array
+// creation, arithmetic, reductions, and the rolling, scan, selection, sketch, histogram, mask,
+// compaction, random, FFT, convolution, polynomial, search and Arrow families) counts
+// calls, elements processed, and, inclusive of the operations they call, bytes allocated and
+// time in cycle-counter ticks (monotonic nanoseconds where there is no cycle counter). Each
+// thread adds into its own counter block, registered once in a lock-free list, so the hot path
+// is a few plain loads and stores. instrument_snapshot sums all blocks;
+// instrument_reset records the current totals as the new zero, so threads are never written
+// to from outside. Output: instrument_print(stream, snapshot, json) as a table or as JSON.
+// Adding -DCNUMPY_PERF also accumulates each thread's hardware counters per operation
+// (inclusive, like time) at the price of two read() system calls per operation.
+
+typedef enum {
+    OP_CREATE_ARRAY, OP_ALLOCATE_ARRAY, OP_COPY_ARRAY,
+    OP_ADD_ARRAY, OP_SUBTRACT_ARRAY, OP_MULTIPLY_ARRAY, OP_DIVIDE_ARRAY, OP_MODULO_ARRAY,
+    OP_ADD_SCALAR, OP_SUBTRACT_SCALAR, OP_MULTIPLY_SCALAR, OP_DIVIDE_SCALAR, OP_MODULO_SCALAR,
+    OP_APPLY_UNARY, OP_POW_ARRAY, OP_CLIP_ARRAY,
+    OP_SUM_ARRAY, OP_PRODUCT_ARRAY, OP_MEAN_ARRAY, OP_MIN_ARRAY, OP_MAX_ARRAY,
+    OP_ARGMIN_ARRAY, OP_ARGMAX_ARRAY, OP_VARIANCE_ARRAY,
+    OP_SORT_ARRAY, OP_UNIQUE_ARRAY, OP_DOT_ARRAY, OP_L2_NORM,
+    OP_ROLLING_SUM, OP_ROLLING_MEAN, OP_ROLLING_VARIANCE, OP_ROLLING_STD, OP_ROLLING_MIN, OP_ROLLING_MAX,
+    OP_CUMSUM, OP_CUMPROD, OP_CUMMAX, OP_CUMMIN, OP_DIFF,
+    OP_PARTITION, OP_NTH_ELEMENT, OP_PERCENTILE, OP_ARGSORT, OP_TOPK,
+    OP_SKETCH_ADD, OP_SKETCH_MERGE, OP_SKETCH_PERCENTILES,
+    OP_HISTOGRAM, OP_HISTOGRAM_EDGES, OP_BINCOUNT, OP_DIGITIZE,
+    OP_MASK_COMPARE, OP_MASK_LOGIC, OP_COUNT_MASK, OP_WHERE,
+    OP_MASKED_ARITHMETIC, OP_MASKED_SUM, OP_MASKED_EXTREME,
+    OP_COMPRESS, OP_TAKE, OP_PUT, OP_SUMMATION_MODE, OP_RANDOM_FILL,
+    OP_FFT, OP_IFFT, OP_RFFT, OP_IRFFT, OP_CONVOLVE, OP_CORRELATE,
+    OP_POLYVAL, OP_INTERP, OP_SEARCH_INDEX, OP_SEARCHSORTED, OP_SEARCHSORTED_INDEX,
+    OP_ARROW_EXPORT, OP_ARROW_IMPORT,
+    OP_COUNT
+} InstrumentOp;
+
+#if defined(CNUMPY_INSTRUMENT)
+
+const char *instrument_op_names[OP_COUNT] = {
+    "create_array", "allocate_array", "copy_array",
+    "add_array", "subtract_array", "multiply_array", "divide_array", "modulo_array",
+    "add_scalar", "subtract_scalar", "multiply_scalar", "divide_scalar", "modulo_scalar",
+    "apply_unary", "pow_array", "clip_array",
+    "sum_array", "product_array", "mean_array", "min_array", "max_array",
+    "argmin_array", "argmax_array", "variance_array",
+    "sort_array", "unique_array", "dot_array", "l2_norm",
+    "rolling_sum", "rolling_mean", "rolling_variance", "rolling_std", "rolling_min", "rolling_max",
+    "cumsum", "cumprod", "cummax", "cummin", "diff",
+    "partition", "nth_element", "percentile", "argsort", "topk",
+    "sketch_add", "sketch_merge", "sketch_percentiles",
+    "histogram", "histogram_edges", "bincount", "digitize",
+    "mask_compare", "mask_logic", "count_mask", "where",
+    "masked_arithmetic", "masked_sum", "masked_extreme",
+    "compress", "take", "put", "summation_mode", "random_fill",
+    "fft", "ifft", "rfft", "irfft", "convolve", "correlate",
+    "polyval", "interp", "search_index", "searchsorted", "searchsorted_index",
+    "arrow_export", "arrow_import",
+};
+
+typedef enum {
+    COUNT_CALLS, COUNT_ELEMENTS, COUNT_BYTES, COUNT_TICKS,
+#if defined(CNUMPY_PERF)
+    COUNT_PERF,                                         // first of PERF_EVENT_COUNT hardware counts
+    COUNT_KINDS = COUNT_PERF + PERF_EVENT_COUNT
+#else
+    COUNT_KINDS
+#endif
+} CounterKind;
+
+typedef struct {
+    uint64_t counts[OP_COUNT][COUNT_KINDS];
+} InstrumentSnapshot;
+
+typedef struct InstrumentThread {
+    _Atomic uint64_t counts[OP_COUNT][COUNT_KINDS];     // written only by the owning thread
+#if defined(CNUMPY_PERF)
+    PerfCounters perf;
+#endif
+    struct InstrumentThread *next;
+} InstrumentThread;
+
+_Atomic(InstrumentThread *) instrument_threads = NULL;  // every thread's block, newest first
+#if defined(CNUMPY_PERF)
+_Atomic unsigned instrument_perf_events = 0;            // bit per PerfEvent any thread could count
+#endif
+_Atomic uint64_t instrument_baseline[OP_COUNT][COUNT_KINDS];
+_Thread_local InstrumentThread *instrument_thread = NULL;
+
+// One running operation; scopes of nested calls are chained through outer
+typedef struct InstrumentScope {
+    InstrumentOp op;
+    struct InstrumentScope *outer;
+    uint64_t start;
+#if defined(CNUMPY_PERF)
+    PerfSample perf_start;
+#endif
+} InstrumentScope;
+
+_Thread_local InstrumentScope *instrument_current_scope = NULL;
+
+uint64_t instrument_ticks(void)
+{
+    if (has_cycle_counter())
+        return read_cycle_counter();
+    struct timespec now;
+    current_time(&now);
+    return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+}
+
+InstrumentThread *instrument_thread_block(void)
+{
+    if (instrument_thread == NULL)
+    {
+        InstrumentThread *block = calloc(1, sizeof(InstrumentThread));
+        if (block == NULL)
+        {
+            fprintf(stderr, "Memory allocation failed.\n");
+            exit(1);
+        }
+#if defined(CNUMPY_PERF)
+        block->perf = open_perf_counters();
+        for (int slot = 0; slot < block->perf.slot_count; ++slot)
+            atomic_fetch_or(&instrument_perf_events, 1u << block->perf.slots[slot]);
+#endif
+        block->next = atomic_load(&instrument_threads);
+        while (!atomic_compare_exchange_weak(&instrument_threads, &block->next, block))
+            ;
+        instrument_thread = block;
+    }
+    return instrument_thread;
+}
+
+// Owner-only increment: a relaxed load and store, no locked read-modify-write
+void instrument_add(int op, CounterKind kind, uint64_t amount)
+{
+    _Atomic uint64_t *counter = &instrument_thread_block()->counts[op][kind];
+    atomic_store_explicit(counter, atomic_load_explicit(counter, memory_order_relaxed) + amount, memory_order_relaxed);
+}
+
+void instrument_begin(InstrumentScope *scope, InstrumentOp op, size_t elements)
+{
+    instrument_add(op, COUNT_CALLS, 1);
+    instrument_add(op, COUNT_ELEMENTS, elements);
+    scope->op = op;
+    scope->outer = instrument_current_scope;
+    instrument_current_scope = scope;
+#if defined(CNUMPY_PERF)
+    scope->perf_start = read_perf_counters(&instrument_thread->perf);
+#endif
+    scope->start = instrument_ticks();
+}
+
+void instrument_end(const InstrumentScope *scope)
+{
+    instrument_add(scope->op, COUNT_TICKS, instrument_ticks() - scope->start);
+#if defined(CNUMPY_PERF)
+    PerfSample perf_end = read_perf_counters(&instrument_thread->perf);
+    PerfReading reading = perf_difference(&instrument_thread->perf, &scope->perf_start, &perf_end);
+    for (int event = 0; event < PERF_EVENT_COUNT; ++event)
+        instrument_add(scope->op, COUNT_PERF + event, (uint64_t)llround(reading.counts[event]));
+#endif
+    instrument_current_scope = scope->outer;
+}
+
+// Charge an allocation to every running operation, so add_array owns its result's bytes
+void instrument_allocation(size_t byte_count)
+{
+    for (InstrumentScope *scope = instrument_current_scope; scope != NULL; scope = scope->outer)
+        instrument_add(scope->op, COUNT_BYTES, byte_count);
+}
+
+InstrumentSnapshot instrument_totals(void)
+{
+    InstrumentSnapshot totals;
+    memset(&totals, 0, sizeof(totals));
+    for (InstrumentThread *block = atomic_load(&instrument_threads); block != NULL; block = block->next)
+        for (int op = 0; op < OP_COUNT; ++op)
+            for (int kind = 0; kind < COUNT_KINDS; ++kind)
+                totals.counts[op][kind] += atomic_load_explicit(&block->counts[op][kind], memory_order_relaxed);
+    return totals;
+}
+
+// Counts since the last instrument_reset, summed over all threads
+InstrumentSnapshot instrument_snapshot(void)
+{
+    InstrumentSnapshot snapshot = instrument_totals();
+    for (int op = 0; op < OP_COUNT; ++op)
+        for (int kind = 0; kind < COUNT_KINDS; ++kind)
+            snapshot.counts[op][kind] -= atomic_load_explicit(&instrument_baseline[op][kind], memory_order_relaxed);
+    return snapshot;
+}
+
+void instrument_reset(void)
+{
+    InstrumentSnapshot totals = instrument_totals();
+    for (int op = 0; op < OP_COUNT; ++op)
+        for (int kind = 0; kind < COUNT_KINDS; ++kind)
+            atomic_store_explicit(&instrument_baseline[op][kind], totals.counts[op][kind], memory_order_relaxed);
+}
+
+// Operations that were called, as a table or as one JSON document
+void instrument_print(FILE *stream, const InstrumentSnapshot *snapshot, bool json)
+{
+    const char *unit = has_cycle_counter() ? "cycles" : "ns";
+    if (json)
+        fprintf(stream, "{\"time_unit\": \"%s\", \"operations\": [", unit);
+    else
+    {
+        fprintf(stream, "%-18s %10s %14s %14s %16s %12s", "operation", "calls", "elements", "bytes alloc",
+                unit, "per element");
+#if defined(CNUMPY_PERF)
+        print_perf_header(stream);
+#endif
+        fprintf(stream, "\n");
+    }
+    bool first = true;
+    for (int op = 0; op < OP_COUNT; ++op)
+    {
+        const uint64_t *counts = snapshot->counts[op];
+        if (counts[COUNT_CALLS] == 0)
+            continue;
+        double per_element = counts[COUNT_ELEMENTS] > 0 ? (double)counts[COUNT_TICKS] / (double)counts[COUNT_ELEMENTS] : 0.0;
+        if (json)
+            fprintf(stream, "%s\n  {\"name\": \"%s\", \"calls\": %llu, \"elements\": %llu, \"bytes\": %llu, \"time\": %llu",
+                    first ? "" : ",", instrument_op_names[op], (unsigned long long)counts[COUNT_CALLS],
+                    (unsigned long long)counts[COUNT_ELEMENTS], (unsigned long long)counts[COUNT_BYTES],
+                    (unsigned long long)counts[COUNT_TICKS]);
+        else
+            fprintf(stream, "%-18s %10llu %14llu %14llu %16llu %12.2f", instrument_op_names[op],
+                    (unsigned long long)counts[COUNT_CALLS], (unsigned long long)counts[COUNT_ELEMENTS],
+                    (unsigned long long)counts[COUNT_BYTES], (unsigned long long)counts[COUNT_TICKS], per_element);
+#if defined(CNUMPY_PERF)
+        PerfReading reading;
+        unsigned available = atomic_load(&instrument_perf_events);
+        for (int event = 0; event < PERF_EVENT_COUNT; ++event)
+        {
+            reading.available[event] = (available >> event) & 1u;
+            reading.counts[event] = (double)counts[COUNT_PERF + event];
+        }
+        print_perf_reading(stream, &reading, (double)counts[COUNT_ELEMENTS], json);
+#endif
+        fprintf(stream, json ? "}" : "\n");
+        first = false;
+    }
+    if (json)
+        fprintf(stream, "\n]}\n");
+}
+
+#define INSTRUMENT_BEGIN(op, elements) InstrumentScope instrument_scope; instrument_begin(&instrument_scope, op, elements)
+#define INSTRUMENT_END() instrument_end(&instrument_scope)
+#define INSTRUMENT_ALLOCATION(byte_count) instrument_allocation(byte_count)
+
+#else
+
+#define INSTRUMENT_BEGIN(op, elements) ((void)(op))          // op may be a driver parameter
+#define INSTRUMENT_END() ((void)0)
+#define INSTRUMENT_ALLOCATION(byte_count) ((void)0)
+
+#endif // CNUMPY_INSTRUMENT
+
+// -------------------------- Memory Tracking --------------------------
+//
+// Compiled out unless built with -DCNUMPY_TRACK_MEMORY. When enabled, a registry records
+// every array made by create_array or allocate_array, keyed by its data pointer, until
+// free_array releases it. Each record keeps its size and allocation site. The creation
+// functions become macros that note the file, line and function of the call. The outermost
+// noted call wins, so array_ones(5) in user code reports the user's line. An array made
+// inside a library operation reports the line in that operation, e.g. "add_array
+// cnumpy_allinone.c:873" for the result of add_array. The registry keeps:
+//   - live and peak array counts and bytes
+//   - per-site totals
+//   - a histogram of how long freed arrays lived
+// memory_report prints these and every array still alive; it also runs automatically at
+// exit. A spinlock guards the registry, so tracked builds are thread-safe but slower.
+
+#define TRACK_LIFETIME_BUCKETS 10       // < 1 us, < 10 us, ..., < 100 s, and longer
+#define TRACK_REPORT_ROWS 20            // live arrays and sites listed by memory_report
+
+typedef struct {
+    size_t live_arrays;
+    size_t live_bytes;
+    size_t peak_arrays;
+    size_t peak_bytes;
+    size_t total_allocations;
+    size_t total_bytes;
+    size_t untracked_frees;             // free_array on data the registry never saw, e.g. user buffers
+    size_t lifetimes[TRACK_LIFETIME_BUCKETS];   // freed arrays by lifetime, in decades from 1 us
+} MemoryStats;
+
+#if defined(CNUMPY_TRACK_MEMORY)
+
+typedef struct {
+    const char *file;
+    int line;
+    const char *function;
+    size_t allocations;
+    size_t total_bytes;
+    size_t largest_bytes;
+    size_t live_arrays;
+    size_t live_bytes;
+} AllocationSite;
+
+typedef struct {
+    const double *data;                 // NULL marks an empty slot
+    size_t bytes;
+    size_t site;                        // index into allocation_sites
+    struct timespec born;
+} TrackedArray;
+
+atomic_flag memory_registry_lock = ATOMIC_FLAG_INIT;
+TrackedArray *tracked_arrays = NULL;    // open addressing, linear probing, power-of-two capacity
+size_t tracked_capacity = 0;
+AllocationSite *allocation_sites = NULL;
+size_t site_count = 0, site_capacity = 0;
+size_t *site_slots = NULL;              // site index + 1 by hash of file and line; 0 = empty
+size_t site_slot_capacity = 0;
+MemoryStats memory_totals;
+bool memory_report_registered = false;
+
+_Thread_local const char *pending_site_file = NULL;
+_Thread_local int pending_site_line = 0;
+_Thread_local const char *pending_site_function = NULL;
+
+void lock_memory_registry(void)
+{
+    while (atomic_flag_test_and_set_explicit(&memory_registry_lock, memory_order_acquire))
+        ;
+}
+
+void unlock_memory_registry(void)
+{
+    atomic_flag_clear_explicit(&memory_registry_lock, memory_order_release);
+}
+
+void *registry_calloc(size_t count, size_t size)
+{
+    void *memory = calloc(count, size);
+    if (memory == NULL)
+    {
+        fprintf(stderr, "Memory allocation failed.\n");
+        exit(1);
+    }
+    return memory;
+}
+
+size_t hash_bits(uint64_t key, size_t capacity)
+{
+    return (size_t)((key * 0x9E3779B97F4A7C15ULL) >> 32) & (capacity - 1);
+}
+
+size_t tracked_slot(const double *data)
+{
+    return hash_bits((uint64_t)(uintptr_t)data >> 4, tracked_capacity);
+}
+
+void grow_tracked_arrays(void)
+{
+    TrackedArray *old_arrays = tracked_arrays;
+    size_t old_capacity = tracked_capacity;
+    tracked_capacity = old_capacity == 0 ? 1024 : 2 * old_capacity;
+    tracked_arrays = registry_calloc(tracked_capacity, sizeof(TrackedArray));
+    for (size_t index = 0; index < old_capacity; ++index)
+    {
+        if (old_arrays[index].data == NULL)
+            continue;
+        size_t slot = tracked_slot(old_arrays[index].data);
+        while (tracked_arrays[slot].data != NULL)
+            slot = (slot + 1) & (tracked_capacity - 1);
+        tracked_arrays[slot] = old_arrays[index];
+    }
+    free(old_arrays);
+}
+
+// Index of the site for file:line, added on first use
+size_t find_allocation_site(const char *file, int line, const char *function)
+{
+    if (2 * (site_count + 1) > site_slot_capacity)
+    {
+        free(site_slots);
+        site_slot_capacity = site_slot_capacity == 0 ? 256 : 2 * site_slot_capacity;
+        site_slots = registry_calloc(site_slot_capacity, sizeof(size_t));
+        for (size_t site = 0; site < site_count; ++site)
+        {
+            size_t slot = hash_bits((uint64_t)(uintptr_t)allocation_sites[site].file ^ (uint64_t)allocation_sites[site].line, site_slot_capacity);
+            while (site_slots[slot] != 0)
+                slot = (slot + 1) & (site_slot_capacity - 1);
+            site_slots[slot] = site + 1;
+        }
+    }
+    size_t slot = hash_bits((uint64_t)(uintptr_t)file ^ (uint64_t)line, site_slot_capacity);
+    for (; site_slots[slot] != 0; slot = (slot + 1) & (site_slot_capacity - 1))
+    {
+        AllocationSite *site = &allocation_sites[site_slots[slot] - 1];
+        if (site->file == file && site->line == line)
+            return site_slots[slot] - 1;
+    }
+    if (site_count == site_capacity)
+    {
+        site_capacity = site_capacity == 0 ? 128 : 2 * site_capacity;
+        AllocationSite *grown = realloc(allocation_sites, site_capacity * sizeof(AllocationSite));
+        if (grown == NULL)
+        {
+            fprintf(stderr, "Memory allocation failed.\n");
+            exit(1);
+        }
+        allocation_sites = grown;
+    }
+    AllocationSite fresh = {file, line, function, 0, 0, 0, 0, 0};
+    allocation_sites[site_count] = fresh;
+    site_slots[slot] = site_count + 1;
+    return site_count++;
+}
+
+void memory_report_at_exit(void);
+
+// Called by the creation macros; an outer call's site is kept until its array is recorded
+void memory_track_site(const char *file, int line, const char *function)
+{
+    if (pending_site_file != NULL)
+        return;
+    pending_site_file = file;
+    pending_site_line = line;
+    pending_site_function = function;
+}
+
+void track_array(const CNumPyArray *array)
+{
+    const char *file = pending_site_file != NULL ? pending_site_file : "unknown";
+    const char *function = pending_site_function != NULL ? pending_site_function : "?";
+    int line = pending_site_line;
+    pending_site_file = NULL;
+    size_t bytes = array->size * sizeof(double);
+    struct timespec born;
+    current_time(&born);
+
+    lock_memory_registry();
+    if (!memory_report_registered)
+    {
+        atexit(memory_report_at_exit);
+        memory_report_registered = true;
+    }
+    if (2 * (memory_totals.live_arrays + 1) > tracked_capacity)
+        grow_tracked_arrays();
+    size_t site_index = find_allocation_site(file, line, function);
+    AllocationSite *site = &allocation_sites[site_index];
+    site->allocations++;
+    site->total_bytes += bytes;
+    site->largest_bytes = bytes > site->largest_bytes ? bytes : site->largest_bytes;
+    site->live_arrays++;
+    site->live_bytes += bytes;
+    size_t slot = tracked_slot(array->data);
+    while (tracked_arrays[slot].data != NULL)
+        slot = (slot + 1) & (tracked_capacity - 1);
+    TrackedArray record = {array->data, bytes, site_index, born};
+    tracked_arrays[slot] = record;
+    memory_totals.live_arrays++;
+    memory_totals.live_bytes += bytes;
+    memory_totals.total_allocations++;
+    memory_totals.total_bytes += bytes;
+    if (memory_totals.live_bytes > memory_totals.peak_bytes)
+        memory_totals.peak_bytes = memory_totals.live_bytes;
+    if (memory_totals.live_arrays > memory_totals.peak_arrays)
+        memory_totals.peak_arrays = memory_totals.live_arrays;
+    unlock_memory_registry();
+}
+
+void untrack_array(const double *data)
+{
+    lock_memory_registry();
+    size_t slot = tracked_capacity > 0 ? tracked_slot(data) : 0;
+    while (tracked_capacity > 0 && tracked_arrays[slot].data != NULL && tracked_arrays[slot].data != data)
+        slot = (slot + 1) & (tracked_capacity - 1);
+    if (tracked_capacity == 0 || tracked_arrays[slot].data == NULL)
+    {
+        memory_totals.untracked_frees++;
+        unlock_memory_registry();
+        return;
+    }
+    TrackedArray *record = &tracked_arrays[slot];
+    double lifetime = elapsed_seconds(&record->born);
+    int bucket = 0;
+    for (double limit = 1e-6; bucket < TRACK_LIFETIME_BUCKETS - 1 && lifetime >= limit; limit *= 10.0)
+        bucket++;
+    memory_totals.lifetimes[bucket]++;
+    AllocationSite *site = &allocation_sites[record->site];
+    site->live_arrays--;
+    site->live_bytes -= record->bytes;
+    memory_totals.live_arrays--;
+    memory_totals.live_bytes -= record->bytes;
+
+    // backward-shift deletion keeps every probe chain unbroken without tombstones
+    size_t hole = slot;
+    for (size_t next = (hole + 1) & (tracked_capacity - 1); tracked_arrays[next].data != NULL;
+         next = (next + 1) & (tracked_capacity - 1))
+    {
+        size_t home = tracked_slot(tracked_arrays[next].data);
+        bool movable = hole <= next ? (home <= hole || home > next) : (home <= hole && home > next);
+        if (movable)
+        {
+            tracked_arrays[hole] = tracked_arrays[next];
+            hole = next;
+        }
+    }
+    tracked_arrays[hole].data = NULL;
+    unlock_memory_registry();
+}
+
+MemoryStats memory_stats(void)
+{
+    lock_memory_registry();
+    MemoryStats stats = memory_totals;
+    unlock_memory_registry();
+    return stats;
+}
+
+// Start a new peak measurement from the current live totals, e.g. before one phase of a program
+void reset_memory_peak(void)
+{
+    lock_memory_registry();
+    memory_totals.peak_arrays = memory_totals.live_arrays;
+    memory_totals.peak_bytes = memory_totals.live_bytes;
+    unlock_memory_registry();
+}
+
+int compare_sites_by_bytes(const void *first, const void *second)
+{
+    size_t a = ((const AllocationSite *)first)->total_bytes, b = ((const AllocationSite *)second)->total_bytes;
+    return (a < b) - (a > b);
+}
+
+// Summary, live arrays (leaks when called at exit), the biggest sites and the lifetime histogram
+void memory_report(FILE *stream)
+{
+    static const char *lifetime_labels[TRACK_LIFETIME_BUCKETS] = {
+        "<1us", "<10us", "<100us", "<1ms", "<10ms", "<100ms", "<1s", "<10s", "<100s", ">=100s",
+    };
+    lock_memory_registry();
+    const MemoryStats *stats = &memory_totals;
+    fprintf(stream, "CNumPy memory: %zu live arrays (%zu bytes), peak %zu bytes in %zu arrays, "
+            "%zu allocations (%zu bytes) in total, %zu untracked frees\n", stats->live_arrays, stats->live_bytes,
+            stats->peak_bytes, stats->peak_arrays, stats->total_allocations, stats->total_bytes, stats->untracked_frees);
+
+    size_t listed = 0;
+    for (size_t slot = 0; slot < tracked_capacity; ++slot)
+    {
+        const TrackedArray *record = &tracked_arrays[slot];
+        if (record->data == NULL)
+            continue;
+        if (listed == 0)
+            fprintf(stream, "Live arrays:\n");
+        if (listed++ >= TRACK_REPORT_ROWS)
+            continue;
+        const AllocationSite *site = &allocation_sites[record->site];
+        fprintf(stream, "  %12zu bytes  %s  %s:%d  (alive %.3f s)\n", record->bytes, site->function, site->file,
+                site->line, elapsed_seconds(&record->born));
+    }
+    if (listed > TRACK_REPORT_ROWS)
+        fprintf(stream, "  ... and %zu more\n", listed - TRACK_REPORT_ROWS);
+
+    if (site_count > 0)
+    {
+        AllocationSite *sorted = registry_calloc(site_count, sizeof(AllocationSite));
+        memcpy(sorted, allocation_sites, site_count * sizeof(AllocationSite));
+        qsort(sorted, site_count, sizeof(AllocationSite), compare_sites_by_bytes);
+        fprintf(stream, "Allocation sites by bytes allocated:\n  %10s %14s %12s %6s  %s\n", "arrays", "total bytes",
+                "largest", "live", "site");
+        for (size_t index = 0; index < site_count && index < TRACK_REPORT_ROWS; ++index)
+            fprintf(stream, "  %10zu %14zu %12zu %6zu  %s  %s:%d\n", sorted[index].allocations, sorted[index].total_bytes,
+                    sorted[index].largest_bytes, sorted[index].live_arrays, sorted[index].function,
+                    sorted[index].file, sorted[index].line);
+        free(sorted);
+    }
+
+    fprintf(stream, "Lifetimes of freed arrays:");
+    for (int bucket = 0; bucket < TRACK_LIFETIME_BUCKETS; ++bucket)
+        fprintf(stream, " %s %zu", lifetime_labels[bucket], stats->lifetimes[bucket]);
+    fprintf(stream, "\n");
+    unlock_memory_registry();
+}
+
+void memory_report_at_exit(void)
+{
+    memory_report(stderr);
+}
+
+#define TRACK_ARRAY(array) track_array(array)
+#define UNTRACK_ARRAY(data) untrack_array(data)
+
+#else
+
+#define TRACK_ARRAY(array) ((void)0)
+#define UNTRACK_ARRAY(data) ((void)0)
+
+#endif // CNUMPY_TRACK_MEMORY
+
+// -------------------------- Array Creation & Deletion --------------------------
+//
+// Arrays are zeroed with calloc, which gets large blocks straight from the operating system
+// as lazily zeroed pages: a huge array_zeros costs almost nothing until it is written.
+// Filled arrays are allocated without zeroing and written exactly once. Arrays larger than
+// NONTEMPORAL_BYTES are written with streaming stores that bypass the cache, since such
+// an array would only evict useful data on its way to memory.
+
+#define NONTEMPORAL_BYTES ((size_t)1 << 24)   // 16 MiB, about the size of a last-level cache
+
+// Large-array placement policy (Linux). Arrays of at least threshold_bytes are allocated on a
+// 2 MiB boundary and then, before any page is touched:
+//   huge_pages:  madvise(MADV_HUGEPAGE) asks for transparent 2 MiB pages, cutting TLB misses
+//   placement:   mbind() keeps pages on the node of the thread that touches them first
+//                (PLACEMENT_LOCAL) or spreads them round-robin over all online nodes
+//                (PLACEMENT_INTERLEAVE), so one array can use the bandwidth of every socket.
+// Both are requests the kernel may ignore (e.g. THP disabled, single-node machine); the
+// allocation still succeeds. Memory is released with free() like every other array, which is
+// why explicit hugetlbfs mappings (which need munmap) are not used. Zeroed arrays under a
+// policy are cleared right after the pages are configured, so the first touch already
+// follows the policy.
+
+typedef enum { PLACEMENT_DEFAULT, PLACEMENT_LOCAL, PLACEMENT_INTERLEAVE } MemoryPlacement;
+
+typedef struct {
+    bool huge_pages;
+    MemoryPlacement placement;
+    size_t threshold_bytes;     // smaller arrays use plain malloc/calloc
+} AllocationPolicy;
+
+#define HUGE_PAGE_BYTES ((size_t)2 << 20)
+
+AllocationPolicy allocation_policy = {false, PLACEMENT_DEFAULT, HUGE_PAGE_BYTES};
+
+void set_allocation_policy(AllocationPolicy policy)
+{
+    allocation_policy = policy;
+}
+
+AllocationPolicy get_allocation_policy(void)
+{
+    return allocation_policy;
+}
+
+#if defined(__linux__)
+// Bit mask of online NUMA nodes, read from sysfs (e.g. "0-1" or "0,2-3"); 0 if unknown
+unsigned long online_node_mask(void)
+{
+    unsigned long mask = 0;
+    FILE *file = fopen("/sys/devices/system/node/online", "r");
+    if (file == NULL)
+        return 0;
+    unsigned int first, last;
+    while (fscanf(file, "%u", &first) == 1)
+    {
+        last = first;
+        int separator = fgetc(file);
+        if (separator == '-')
+        {
+            if (fscanf(file, "%u", &last) != 1)
+                break;
+            separator = fgetc(file);
+        }
+        for (unsigned int node = first; node <= last && node < 8 * sizeof(unsigned long); ++node)
+            mask |= 1UL << node;
+        if (separator != ',')
+            break;
+    }
+    fclose(file);
+    return mask;
+}
+#endif
+
+// Apply the huge-page and NUMA requests to fresh, untouched memory (best effort)
+void apply_allocation_policy(void *memory, size_t byte_count)
+{
+#if defined(__linux__)
+#if defined(MADV_HUGEPAGE)
+    if (allocation_policy.huge_pages)
+        madvise(memory, byte_count, MADV_HUGEPAGE);
+#endif
+#if defined(SYS_mbind)
+    if (allocation_policy.placement == PLACEMENT_LOCAL)
+    {
+        syscall(SYS_mbind, memory, byte_count, 4 /* MPOL_LOCAL */, NULL, 0UL, 0U);
+    }
+    else if (allocation_policy.placement == PLACEMENT_INTERLEAVE)
+    {
+        unsigned long nodes = online_node_mask();
+        if (nodes != 0)
+            syscall(SYS_mbind, memory, byte_count, 3 /* MPOL_INTERLEAVE */, &nodes, 8 * sizeof(nodes) + 1, 0U);
+    }
+#endif
+#else
+    (void)memory;
+    (void)byte_count;
+#endif
+}
+
+bool policy_applies(size_t byte_count)
+{
+    return (allocation_policy.huge_pages || allocation_policy.placement != PLACEMENT_DEFAULT)
+        && byte_count >= allocation_policy.threshold_bytes;
+}
+
+void *allocate_or_exit(size_t byte_count, bool zeroed)
+{
+    void *memory = NULL;
+    if (policy_applies(byte_count))
+    {
+        // round up to whole huge pages so madvise/mbind cover the entire block
+        size_t rounded = (byte_count + HUGE_PAGE_BYTES - 1) / HUGE_PAGE_BYTES * HUGE_PAGE_BYTES;
+        if (posix_memalign(&memory, HUGE_PAGE_BYTES, rounded) != 0)
+            memory = NULL;
+        if (memory != NULL)
+        {
+            apply_allocation_policy(memory, rounded);
+            if (zeroed)
+                memset(memory, 0, byte_count);         // first touch, placed per the policy
+        }
+    }
+    else
+    {
+        memory = zeroed ? calloc(byte_count > 0 ? byte_count : 1, 1) : malloc(byte_count > 0 ? byte_count : 1);
+    }
+    if (memory == NULL)
+    {
+        fprintf(stderr, "Memory allocation failed.\n");
+        exit(1);
+    }
+    INSTRUMENT_ALLOCATION(byte_count);
+    return memory;
+}
+
+CNumPyArray create_array(const double *initial_values, size_t array_size)
+{
+    INSTRUMENT_BEGIN(OP_CREATE_ARRAY, array_size);
+    CNumPyArray array;
+    array.size = array_size;                           // set array length
+    if (initial_values != NULL)
+    {
+        array.data = (double *)allocate_or_exit(array_size * sizeof(double), false);
+        memcpy(array.data, initial_values, array_size * sizeof(double)); // copy values if provided
+    }
+    else
+    {
+        array.data = (double *)allocate_or_exit(array_size * sizeof(double), true);  // default fill to 0
+    }
+    TRACK_ARRAY(&array);
+    INSTRUMENT_END();
+    return array;
+}
+
+// Array whose contents are left uninitialized, for functions that write every element anyway
+CNumPyArray allocate_array(size_t array_size)
+{
+    INSTRUMENT_BEGIN(OP_ALLOCATE_ARRAY, array_size);
+    CNumPyArray array;
+    array.size = array_size;
+    array.data = (double *)allocate_or_exit(array_size * sizeof(double), false);
+    TRACK_ARRAY(&array);
+    INSTRUMENT_END();
+    return array;
+}
+
+// data[i] = start + step * i. Every lane is independent, so the loop vectorizes;
+// huge outputs use streaming stores.
+void store_sequence(double *data, size_t count, double start, double step)
+{
+    size_t index = 0;
+#if defined(__SSE2__)
+    if (count * sizeof(double) >= NONTEMPORAL_BYTES)
+    {
+        if ((uintptr_t)data % 16 != 0)
+        {
+            data[0] = start;                           // align the rest to 16 bytes
+            index = 1;
+        }
+        for (; index + 2 <= count; index += 2)
+            _mm_stream_pd(data + index, _mm_set_pd(start + step * (double)(index + 1), start + step * (double)index));
+        _mm_sfence();                                  // make the streamed data visible
+    }
+#endif
+    for (; index < count; ++index)
+        data[index] = start + step * (double)index;
+}
+
+// data[i] = value, with the same streaming rule as store_sequence
+void store_value(double *data, size_t count, double value)
+{
+    size_t index = 0;
+#if defined(__SSE2__)
+    if (count * sizeof(double) >= NONTEMPORAL_BYTES)
+    {
+        if ((uintptr_t)data % 16 != 0)
+            data[index++] = value;
+        __m128d pair = _mm_set1_pd(value);
+        for (; index + 2 <= count; index += 2)
+            _mm_stream_pd(data + index, pair);
+        _mm_sfence();
+    }
+#endif
+    for (; index < count; ++index)
+        data[index] = value;
+}
+
+CNumPyArray array_zeros(size_t array_size)
+{
+    return create_array(NULL, array_size); // all zeros
+}
+
+CNumPyArray array_ones(size_t array_size)
+{
+    CNumPyArray array = allocate_array(array_size);
+    store_value(array.data, array_size, 1.0);          // set each element to one
+    return array;
+}
+
+CNumPyArray array_full(size_t array_size, double fill_value)
+{
+    CNumPyArray array = allocate_array(array_size);
+    store_value(array.data, array_size, fill_value);   // fill with user-specified value
+    return array;
+}
+
+CNumPyArray array_range(double start_value, double end_value, double step_value)
+{
+    // computes how many elements (none if the step points away from the end)
+    double steps = ceil((end_value - start_value) / step_value);
+    size_t count = steps > 0.0 ? (size_t)steps : 0;
+    CNumPyArray array = allocate_array(count);
+    store_sequence(array.data, count, start_value, step_value);
+    return array;
+}
+
+CNumPyArray array_linspace(double start_value, double end_value, size_t number_values)
+{
+    // evenly spaced from start to end (inclusive): one division for the step, like NumPy
+    CNumPyArray array = allocate_array(number_values);
+    if (number_values == 1)
+    {
+        array.data[0] = start_value;
+    }
+    else if (number_values > 1)
+    {
+        double step = (end_value - start_value) / (double)(number_values - 1);
+        store_sequence(array.data, number_values, start_value, step);
+        array.data[number_values - 1] = end_value;     // exact end point despite rounding
+    }
+    return array;
+}
+
+void free_array(CNumPyArray *array)
+{
+    if (array->data)
+    {
+        UNTRACK_ARRAY(array->data);
+        free(array->data);            // release memory
+        array->data = NULL;
+    }
+    array->size = 0;                  // mark as empty
+}
+
+CNumPyArray copy_array(const CNumPyArray *array)
+{
+    INSTRUMENT_BEGIN(OP_COPY_ARRAY, array->size);
+    CNumPyArray copy = create_array(array->data, array->size);  // shallow copy
+    INSTRUMENT_END();
+    return copy;
+}
+
+#if defined(CNUMPY_TRACK_MEMORY)
+// From here on, creation calls note their site for the memory registry. Each macro shares its
+// function's name; C does not re-expand a macro inside its own expansion, so the inner call
+// reaches the real function. Callers are unchanged and the default build has no macros here.
+#define TRACKED_AT(call) (memory_track_site(__FILE__, __LINE__, __func__), call)
+#define create_array(initial_values, array_size) TRACKED_AT(create_array(initial_values, array_size))
+#define allocate_array(array_size) TRACKED_AT(allocate_array(array_size))
+#define copy_array(array) TRACKED_AT(copy_array(array))
+#define array_zeros(array_size) TRACKED_AT(array_zeros(array_size))
+#define array_ones(array_size) TRACKED_AT(array_ones(array_size))
+#define array_full(array_size, fill_value) TRACKED_AT(array_full(array_size, fill_value))
+#define array_range(start_value, end_value, step_value) TRACKED_AT(array_range(start_value, end_value, step_value))
+#define array_linspace(start_value, end_value, number_values) TRACKED_AT(array_linspace(start_value, end_value, number_values))
+#endif
+
+// -------------------------- Array Utilities --------------------------
+
+void require_same_size(const CNumPyArray *array1, const CNumPyArray *array2, const char *message)
+{
+    if (array1->size != array2->size)
+    {
+        fprintf(stderr, "%s: arrays sizes not equal (%zu, %zu)\n", message, array1->size, array2->size);
+        exit(1);
+    }
+}
+
+void print_array(const CNumPyArray *array, int print_precision)
+{
+    printf("[");
+    for (size_t index = 0; index < array->size; ++index)
+    {
+        printf("%.*f", print_precision, array->data[index]);           // print with specified digits
+        if (index + 1 != array->size)
+        {
+            printf(", ");
+        }
+    }
+    printf("]\n");
+}
+
+void fill_array(CNumPyArray *array, double fill_value)
+{
+    store_value(array->data, array->size, fill_value); // fill each element
+}
+
+void reverse_array(CNumPyArray *array)
+{
+    size_t last_index = array->size - 1;
+    for (size_t index = 0; index < array->size / 2; ++index)
+    {
+        double temp = array->data[index];
+        array->data[index] = array->data[last_index - index];
+        array->data[last_index - index] = temp;        // swap pairs from each end
+    }
+}
+
+// The checks below test a whole cache line (8 doubles) with branch-free compares, which the
+// compiler vectorizes, and only then decide whether to stop early. Comparisons are done on
+// values, not bits, so -0.0 counts as zero and equals 0.0.
+
+#define CACHE_LINE_DOUBLES 8            // doubles per 64-byte cache line
+
+// Compare two arrays for elementwise equality. With nan_equal, NaN matches NaN (NumPy's
+// equal_nan); without it, any NaN makes the arrays unequal.
+bool equal_array_with_nan(const CNumPyArray *array1, const CNumPyArray *array2, bool nan_equal)
+{
+    if (array1->size != array2->size)
+        return false;
+    size_t size = array1->size;
+    const double *data1 = array1->data, *data2 = array2->data;
+    if (nan_equal && (data1 == data2 || size == 0 || memcmp(data1, data2, size * sizeof(double)) == 0))
+        return true;                                   // bitwise-identical buffers are always equal
+    if (data1 == data2)
+    {
+        // same buffer: only a NaN can make it unequal, so scan one stream instead of two
+        for (size_t index = 0; index < size; ++index)
+            if (isnan(data1[index]))
+                return false;
+        return true;
+    }
+    size_t index = 0;
+    for (; index + CACHE_LINE_DOUBLES <= size; index += CACHE_LINE_DOUBLES)
+    {
+        bool mismatch = false;
+        for (size_t lane = 0; lane < CACHE_LINE_DOUBLES; ++lane)
+        {
+            double value1 = data1[index + lane], value2 = data2[index + lane];
+            mismatch |= value1 != value2 && !(nan_equal && value1 != value1 && value2 != value2);
+        }
+        if (mismatch)
+            return false;
+    }
+    for (; index < size; ++index)
+    {
+        double value1 = data1[index], value2 = data2[index];
+        if (value1 != value2 && !(nan_equal && isnan(value1) && isnan(value2)))
+            return false;
+    }
+    return true;
+}
+
+// Compare two arrays for elementwise equality (NaN never equals anything)
+bool equal_array(const CNumPyArray *array1, const CNumPyArray *array2)
+{
+    return equal_array_with_nan(array1, array2, false);
+}
+
+// Return true if any element is nonzero
+bool any_array(const CNumPyArray *array)
+{
+    size_t index = 0;
+    for (; index + CACHE_LINE_DOUBLES <= array->size; index += CACHE_LINE_DOUBLES)
+    {
+        bool found = false;
+        for (size_t lane = 0; lane < CACHE_LINE_DOUBLES; ++lane)
+            found |= array->data[index + lane] != 0;
+        if (found)
+            return true;
+    }
+    for (; index < array->size; ++index)
+        if (array->data[index] != 0)
+            return true;
+    return false;
+}
+
+// Return true if all elements are nonzero
+bool all_array(const CNumPyArray *array)
+{
+    size_t index = 0;
+    for (; index + CACHE_LINE_DOUBLES <= array->size; index += CACHE_LINE_DOUBLES)
+    {
+        bool found_zero = false;
+        for (size_t lane = 0; lane < CACHE_LINE_DOUBLES; ++lane)
+            found_zero |= array->data[index + lane] == 0;
+        if (found_zero)
+            return false;
+    }
+    for (; index < array->size; ++index)
+        if (array->data[index] == 0)
+            return false;
+    return true;
+}
+
+// Clamp one value with two selects that compile to min/max instructions (NaN stays NaN)
+double clip_value(double value, double min_value, double max_value)
+{
+    value = value < min_value ? min_value : value;
+    return value > max_value ? max_value : value;
+}
+
+// Clip every value of array into out, which must have the same size (out may be array itself)
+void clip_array_into(const CNumPyArray *array, double min_value, double max_value, CNumPyArray *out)
+{
+    require_same_size(array, out, "clip");
+    const double *input = array->data;
+    double *output = out->data;
+    for (size_t index = 0; index < array->size; ++index)
+        output[index] = clip_value(input[index], min_value, max_value);
+}
+
+// Clip every value in place
+void clip_array_inplace(CNumPyArray *array, double min_value, double max_value)
+{
+    clip_array_into(array, min_value, max_value, array);
+}
+
+// Clip every value into range [min_value, max_value]
+CNumPyArray clip_array(const CNumPyArray *array, double min_value, double max_value)
+{
+    INSTRUMENT_BEGIN(OP_CLIP_ARRAY, array->size);
+    CNumPyArray out = create_array(NULL, array->size);
+    clip_array_into(array, min_value, max_value, &out);
+    INSTRUMENT_END();
+    return out;
+}
+
+// Fused clip(array * scale + shift) in one pass, into out (out may be array itself)
+void affine_clip_array_into(const CNumPyArray *array, double scale, double shift, double min_value, double max_value, CNumPyArray *out)
+{
+    require_same_size(array, out, "affine_clip");
+    const double *input = array->data;
+    double *output = out->data;
+    for (size_t index = 0; index < array->size; ++index)
+        output[index] = clip_value(input[index] * scale + shift, min_value, max_value);
+}
+
+CNumPyArray affine_clip_array(const CNumPyArray *array, double scale, double shift, double min_value, double max_value)
+{
+    CNumPyArray out = create_array(NULL, array->size);
+    affine_clip_array_into(array, scale, shift, min_value, max_value, &out);
+    return out;
+}
+
+// Unique: return sorted unique values (slow method for demonstration)
+CNumPyArray unique_array(const CNumPyArray *array)
+{
+    INSTRUMENT_BEGIN(OP_UNIQUE_ARRAY, array->size);
+    if (array->size == 0)
+    {
+        INSTRUMENT_END();
+        return array_zeros(0);                      // empty remains empty
+    }
+    CNumPyArray temp = copy_array(array);
+
+    // simple selection sort
+    for (size_t i = 0; i < temp.size; ++i)
+    {
+        size_t min_index = i;
+        for (size_t j = i + 1; j < temp.size; ++j)
+        {
+            if (temp.data[j] < temp.data[min_index])
+                min_index = j;
+        }
+        double t = temp.data[i];
+        temp.data[i] = temp.data[min_index];
+        temp.data[min_index] = t;
+    }
+    // unique extraction in place, always keeping the first element
+    size_t unique_size = 1;
+    for (size_t index = 1; index < temp.size; ++index)
+    {
+        if (temp.data[index] != temp.data[unique_size - 1])
+        {
+            temp.data[unique_size++] = temp.data[index];
+        }
+    }
+    CNumPyArray res = create_array(temp.data, unique_size); // exact-size result
+    free_array(&temp);
+    INSTRUMENT_END();
+    return res;
+}
+
+// Sort array in-place
+void sort_array(CNumPyArray *array)
+{
+    INSTRUMENT_BEGIN(OP_SORT_ARRAY, array->size);
+    // simple selection sort for clarity
+    for (size_t i = 0; i + 1 < array->size; ++i)
+    {
+        size_t min_index = i;
+        for (size_t j = i + 1; j < array->size; ++j)
+            if (array->data[j] < array->data[min_index])
+                min_index = j;
+        double t = array->data[i];
+        array->data[i] = array->data[min_index];
+        array->data[min_index] = t;
+    }
+    INSTRUMENT_END();
+}
+
+// -------------------------- Element-wise Operations (Array-Array) --------------------------
+
+CNumPyArray add_array(const CNumPyArray *array1, const CNumPyArray *array2)
+{
+    INSTRUMENT_BEGIN(OP_ADD_ARRAY, array1->size);
+    require_same_size(array1, array2, "add");
+    CNumPyArray result = create_array(NULL, array1->size);     // allocate result
+    for (size_t index = 0; index < array1->size; ++index)
+        result.data[index] = array1->data[index] + array2->data[index];
+    INSTRUMENT_END();
+    return result;
+}
+
+CNumPyArray subtract_array(const CNumPyArray *array1, const CNumPyArray *array2)
+{
+    INSTRUMENT_BEGIN(OP_SUBTRACT_ARRAY, array1->size);
+    require_same_size(array1, array2, "subtract");
+    CNumPyArray result = create_array(NULL, array1->size);
+    for (size_t index = 0; index < array1->size; ++index)
+        result.data[index] = array1->data[index] - array2->data[index];
+    INSTRUMENT_END();
+    return result;
+}
+
+CNumPyArray multiply_array(const CNumPyArray *array1, const CNumPyArray *array2)
+{
+    INSTRUMENT_BEGIN(OP_MULTIPLY_ARRAY, array1->size);
+    require_same_size(array1, array2, "multiply");
+    CNumPyArray result = create_array(NULL, array1->size);
+    for (size_t index = 0; index < array1->size; ++index)
+        result.data[index] = array1->data[index] * array2->data[index];
+    INSTRUMENT_END();
+    return result;
+}
+
+CNumPyArray divide_array(const CNumPyArray *array1, const CNumPyArray *array2)
+{
+    INSTRUMENT_BEGIN(OP_DIVIDE_ARRAY, array1->size);
+    require_same_size(array1, array2, "divide");
+    CNumPyArray result = create_array(NULL, array1->size);
+    for (size_t index = 0; index < array1->size; ++index)
+    {
+        if (array2->data[index] == 0.0)
+            result.data[index] = 0.0;                 // safe zero on division by zero
+        else
+            result.data[index] = array1->data[index] / array2->data[index];
+    }
+    INSTRUMENT_END();
+    return result;
+}
+
+CNumPyArray modulo_array(const CNumPyArray *array1, const CNumPyArray *array2)
+{
+    INSTRUMENT_BEGIN(OP_MODULO_ARRAY, array1->size);
+    require_same_size(array1, array2, "modulo");
+    CNumPyArray result = create_array(NULL, array1->size);
+    for (size_t index = 0; index < array1->size; ++index)
+        result.data[index] = fmod(array1->data[index], array2->data[index]);
+    INSTRUMENT_END();
+    return result;
+}
+
+// -------------------------- Element-wise Operations (Array-Scalar) --------------------------
+
+CNumPyArray add_scalar(const CNumPyArray *array, double value)
+{
+    INSTRUMENT_BEGIN(OP_ADD_SCALAR, array->size);
+    CNumPyArray result = create_array(NULL, array->size);
+    for (size_t index = 0; index < array->size; ++index)
+        result.data[index] = array->data[index] + value;
+    INSTRUMENT_END();
+    return result;
+}
+CNumPyArray subtract_scalar(const CNumPyArray *array, double value)
+{
+    INSTRUMENT_BEGIN(OP_SUBTRACT_SCALAR, array->size);
+    CNumPyArray result = create_array(NULL, array->size);
+    for (size_t index = 0; index < array->size; ++index)
+        result.data[index] = array->data[index] - value;
+    INSTRUMENT_END();
+    return result;
+}
+CNumPyArray multiply_scalar(const CNumPyArray *array, double value)
+{
+    INSTRUMENT_BEGIN(OP_MULTIPLY_SCALAR, array->size);
+    CNumPyArray result = create_array(NULL, array->size);
+    for (size_t index = 0; index < array->size; ++index)
+        result.data[index] = array->data[index] * value;
+    INSTRUMENT_END();
+    return result;
+}
+CNumPyArray divide_scalar(const CNumPyArray *array, double value)
+{
+    INSTRUMENT_BEGIN(OP_DIVIDE_SCALAR, array->size);
+    CNumPyArray result = create_array(NULL, array->size);
+    for (size_t index = 0; index < array->size; ++index)
+        result.data[index] = value == 0.0 ? 0.0 : array->data[index] / value;
+    INSTRUMENT_END();
+    return result;
+}
+CNumPyArray modulo_scalar(const CNumPyArray *array, double value)
+{
+    INSTRUMENT_BEGIN(OP_MODULO_SCALAR, array->size);
+    CNumPyArray result = create_array(NULL, array->size);
+    for (size_t index = 0; index < array->size; ++index)
+        result.data[index] = fmod(array->data[index], value);
+    INSTRUMENT_END();
+    return result;
+}
+
+// -------------------------- Element-wise Math Functions --------------------------
+
+typedef double (*UnaryFunction)(double);
+
+CNumPyArray apply_unary(const CNumPyArray *array, UnaryFunction f)
+{
+    INSTRUMENT_BEGIN(OP_APPLY_UNARY, array->size);
+    CNumPyArray result = create_array(NULL, array->size);
+    for (size_t index = 0; index < array->size; ++index)
+        result.data[index] = f(array->data[index]);
+    INSTRUMENT_END();
+    return result;
+}
+
+CNumPyArray absolute_array(const CNumPyArray *array)   { return apply_unary(array, fabs); }
+CNumPyArray sin_array(const CNumPyArray *array)        { return apply_unary(array, sin); }
+CNumPyArray cos_array(const CNumPyArray *array)        { return apply_unary(array, cos); }
+CNumPyArray tan_array(const CNumPyArray *array)        { return apply_unary(array, tan); }
+CNumPyArray asin_array(const CNumPyArray *array)       { return apply_unary(array, asin); }
+CNumPyArray acos_array(const CNumPyArray *array)       { return apply_unary(array, acos); }
+CNumPyArray atan_array(const CNumPyArray *array)       { return apply_unary(array, atan); }
+CNumPyArray exp_array(const CNumPyArray *array)        { return apply_unary(array, exp); }
+CNumPyArray log_array(const CNumPyArray *array)        { return apply_unary(array, log); }
+CNumPyArray log10_array(const CNumPyArray *array)      { return apply_unary(array, log10); }
+CNumPyArray sqrt_array(const CNumPyArray *array)       { return apply_unary(array, sqrt); }
+CNumPyArray floor_array(const CNumPyArray *array)      { return apply_unary(array, floor); }
+CNumPyArray ceil_array(const CNumPyArray *array)       { return apply_unary(array, ceil); }
+CNumPyArray round_array(const CNumPyArray *array)      { return apply_unary(array, round); }
+
+// pow_array looks at the exponent once and picks a loop for it: multiplications for small
+// integer exponents, sqrt for +-0.5 and a division for -1. Only other exponents call pow().
+// Each fast path returns what pow() would, including for zeros, infinities and NaN.
+
+#define POW_MAX_INTEGER_EXPONENT 16     // larger integers go to pow() to keep rounding error low
+
+typedef enum {
+    POWER_ZERO,             // x^0 = 1 (even for NaN)
+    POWER_ONE,              // x^1 = x
+    POWER_SQUARE,           // x * x
+    POWER_CUBE,             // x * x * x
+    POWER_INTEGER,          // other small integers: exponentiation by squaring
+    POWER_SQRT,             // x^0.5
+    POWER_RSQRT,            // x^-0.5
+    POWER_RECIPROCAL,       // x^-1
+    POWER_GENERAL           // anything else: pow()
+} PowerKind;
+
+PowerKind classify_exponent(double exponent)
+{
+    if (exponent == 0.0) return POWER_ZERO;
+    if (exponent == 1.0) return POWER_ONE;
+    if (exponent == 2.0) return POWER_SQUARE;
+    if (exponent == 3.0) return POWER_CUBE;
+    if (exponent == -1.0) return POWER_RECIPROCAL;
+    if (exponent == 0.5) return POWER_SQRT;
+    if (exponent == -0.5) return POWER_RSQRT;
+    if (exponent == floor(exponent) && fabs(exponent) <= POW_MAX_INTEGER_EXPONENT)
+        return POWER_INTEGER;
+    return POWER_GENERAL;
+}
+
+// x^n for 0 < n <= POW_MAX_INTEGER_EXPONENT by repeated squaring
+double integer_power(double value, unsigned int exponent)
+{
+    double result = 1.0;
+    while (exponent > 0)
+    {
+        if (exponent & 1)
+            result *= value;
+        value *= value;
+        exponent >>= 1;
+    }
+    return result;
+}
+
+// pow(x, 0.5): like sqrt, except that pow gives +0 for -0 and +inf for -inf
+double power_half(double value)
+{
+    return value == -INFINITY ? INFINITY : fabs(sqrt(value));
+}
+
+CNumPyArray pow_array(const CNumPyArray *array, double value)
+{
+    INSTRUMENT_BEGIN(OP_POW_ARRAY, array->size);
+    CNumPyArray result = create_array(NULL, array->size);
+    const double *input = array->data;
+    double *output = result.data;
+    size_t size = array->size;
+    switch (classify_exponent(value))
+    {
+    case POWER_ZERO:
+        for (size_t index = 0; index < size; ++index)
+            output[index] = 1.0;
+        break;
+    case POWER_ONE:
+        memcpy(output, input, size * sizeof(double));
+        break;
+    case POWER_SQUARE:
+        for (size_t index = 0; index < size; ++index)
+            output[index] = input[index] * input[index];
+        break;
+    case POWER_CUBE:
+        for (size_t index = 0; index < size; ++index)
+            output[index] = input[index] * input[index] * input[index];
+        break;
+    case POWER_INTEGER:
+    {
+        unsigned int magnitude = (unsigned int)fabs(value);
+        for (size_t index = 0; index < size; ++index)
+            output[index] = integer_power(input[index], magnitude);
+        // x^-n = 1 / x^n, unless x^n overflowed or underflowed: then the reciprocal would
+        // flush to 0 (or blow up) where pow() still returns a subnormal (or finite) result
+        if (value < 0.0)
+            for (size_t index = 0; index < size; ++index)
+                output[index] = !isnormal(output[index]) && isfinite(input[index]) && input[index] != 0.0
+                              ? pow(input[index], value) : 1.0 / output[index];
+        break;
+    }
+    case POWER_SQRT:
+        for (size_t index = 0; index < size; ++index)
+            output[index] = power_half(input[index]);
+        break;
+    case POWER_RSQRT:
+        for (size_t index = 0; index < size; ++index)
+            output[index] = 1.0 / power_half(input[index]);
+        break;
+    case POWER_RECIPROCAL:
+        for (size_t index = 0; index < size; ++index)
+            output[index] = 1.0 / input[index];
+        break;
+    case POWER_GENERAL:
+        for (size_t index = 0; index < size; ++index)
+            output[index] = pow(input[index], value);
+        break;
+    }
+    INSTRUMENT_END();
+    return result;
+}
+
+// -------------------------- Aggregation & Statistics --------------------------
+
+double sum_array(const CNumPyArray *array)
+{
+    INSTRUMENT_BEGIN(OP_SUM_ARRAY, array->size);
+    double s = 0.0;
+    for (size_t index = 0; index < array->size; ++index)
+        s += array->data[index];                          // accumulate
+    INSTRUMENT_END();
+    return s;
+}
+
+double product_array(const CNumPyArray *array)
+{
+    INSTRUMENT_BEGIN(OP_PRODUCT_ARRAY, array->size);
+    double p = 1.0;
+    for (size_t index = 0; index < array->size; ++index)
+        p *= array->data[index];                          // multiply over all
+    INSTRUMENT_END();
+    return p;
+}
+
+double mean_array(const CNumPyArray *array)
+{
+    INSTRUMENT_BEGIN(OP_MEAN_ARRAY, array->size);
+    double mean = sum_array(array) / array->size;         // arithmetic mean
+    INSTRUMENT_END();
+    return mean;
+}
+
+double max_array(const CNumPyArray *array)
+{
+    INSTRUMENT_BEGIN(OP_MAX_ARRAY, array->size);
+    double max_value = array->data[0];
+    for (size_t index = 1; index < array->size; ++index)
+        if (array->data[index] > max_value)
+            max_value = array->data[index];               // update if larger
+    INSTRUMENT_END();
+    return max_value;
+}
+
+double min_array(const CNumPyArray *array)
+{
+    INSTRUMENT_BEGIN(OP_MIN_ARRAY, array->size);
+    double min_value = array->data[0];
+    for (size_t index = 1; index < array->size; ++index)
+        if (array->data[index] < min_value)
+            min_value = array->data[index];
+    INSTRUMENT_END();
+    return min_value;
+}
+
+size_t argmax_array(const CNumPyArray *array)
+{
+    INSTRUMENT_BEGIN(OP_ARGMAX_ARRAY, array->size);
+    size_t argmax_index = 0;
+    double max_value = array->data[0];
+    for (size_t index = 1; index < array->size; ++index)
+        if (array->data[index] > max_value)
+        {
+            argmax_index = index;
+            max_value = array->data[index];
+        }
+    INSTRUMENT_END();
+    return argmax_index;
+}
+
+size_t argmin_array(const CNumPyArray *array)
+{
+    INSTRUMENT_BEGIN(OP_ARGMIN_ARRAY, array->size);
+    size_t argmin_index = 0;
+    double min_value = array->data[0];
+    for (size_t index = 1; index < array->size; ++index)
+        if (array->data[index] < min_value)
+        {
+            argmin_index = index;
+            min_value = array->data[index];
+        }
+    INSTRUMENT_END();
+    return argmin_index;
+}
+
+double variance_array(const CNumPyArray *array)
+{
+    INSTRUMENT_BEGIN(OP_VARIANCE_ARRAY, array->size);
+    double mu = mean_array(array);
+    double s2 = 0.0;
+    for (size_t index = 0; index < array->size; ++index)
+        s2 += (array->data[index] - mu) * (array->data[index] - mu);
+    INSTRUMENT_END();
+    return s2 / array->size;
+}
+double std_array(const CNumPyArray *array)
+{
+    return sqrt(variance_array(array));    // stddev
+}
+
+// -------------------------- Rolling-Window Statistics --------------------------
+//
+// A rolling function returns one value per full window: result[i] summarizes
+// array[i .. i + window_size - 1], so the result has size - window_size + 1 values
+// (or none if the window is longer than the array). Each value costs O(1) on average.
+//
+// The output is processed in independent blocks. Every block rebuilds its running
+// state from the window_size - 1 input values before it (its "halo"), so blocks could
+// be handed to different threads, and rounding drift in running sums is reset per block.
+
+#define ROLLING_BLOCK_SIZE 4096     // output positions per independent block
+
+// Kernel computing rolling outputs [first, last) of one block. scratch holds window_size indices
+// for the kernels that need them (min and max) and is NULL for the others.
+typedef void (*RollingBlockFunction)(const double *data, size_t window_size, double *out, size_t first, size_t last,
+                                     size_t *scratch);
+
+// Neumaier's improved Kahan step: add value to sum, keeping the lost low-order bits
+void compensated_add(double *sum, double *compensation, double value)
+{
+    double total = *sum + value;
+    if (fabs(*sum) >= fabs(value))
+        *compensation += (*sum - total) + value;   // low bits of value were lost
+    else
+        *compensation += (value - total) + *sum;   // low bits of sum were lost
+    *sum = total;
+}
+
+void rolling_sum_block(const double *data, size_t window_size, double *out, size_t first, size_t last, size_t *scratch)
+{
+    (void)scratch;
+    double sum = 0.0, compensation = 0.0;
+    for (size_t index = first; index < first + window_size; ++index)
+        compensated_add(&sum, &compensation, data[index]);      // first window of the block
+    out[first] = sum + compensation;
+    for (size_t position = first + 1; position < last; ++position)
+    {
+        compensated_add(&sum, &compensation, data[position + window_size - 1]);  // value entering
+        compensated_add(&sum, &compensation, -data[position - 1]);              // value leaving
+        out[position] = sum + compensation;
+    }
+}
+
+void rolling_mean_block(const double *data, size_t window_size, double *out, size_t first, size_t last, size_t *scratch)
+{
+    (void)scratch;
+    rolling_sum_block(data, window_size, out, first, last, NULL);
+    for (size_t position = first; position < last; ++position)
+        out[position] /= (double)window_size;
+}
+
+// Welford's update, with one value added and one removed per step (population variance)
+void rolling_variance_block(const double *data, size_t window_size, double *out, size_t first, size_t last, size_t *scratch)
+{
+    (void)scratch;
+    double mean = 0.0, squared_deviations = 0.0;
+    for (size_t index = first; index < first + window_size; ++index)
+    {
+        double delta = data[index] - mean;
+        mean += delta / (double)(index - first + 1);
+        squared_deviations += delta * (data[index] - mean);
+    }
+    out[first] = squared_deviations / window_size;
+    for (size_t position = first + 1; position < last; ++position)
+    {
+        double incoming = data[position + window_size - 1];
+        double outgoing = data[position - 1];
+        double old_mean = mean;
+        mean += (incoming - outgoing) / (double)window_size;
+        squared_deviations += (incoming - outgoing) * (incoming - mean + outgoing - old_mean);
+        if (squared_deviations < 0.0)
+            squared_deviations = 0.0;                  // rounding can push it slightly negative
+        out[position] = squared_deviations / window_size;
+    }
+}
+
+void rolling_std_block(const double *data, size_t window_size, double *out, size_t first, size_t last, size_t *scratch)
+{
+    (void)scratch;
+    rolling_variance_block(data, window_size, out, first, last, NULL);
+    for (size_t position = first; position < last; ++position)
+        out[position] = sqrt(out[position]);
+}
+
+// Monotonic deque: keeps indices of the current window whose values could still become
+// the extreme value. Each index is pushed and popped at most once, so the cost is O(1) amortized.
+// The deque never holds more than window_size indices, so it lives in a ring buffer (deque).
+// A NaN makes every window containing it NaN, as in cummax: it empties the deque, since values
+// before it leave the window first, and its index is remembered until it leaves too.
+void rolling_extreme_block(const double *data, size_t window_size, double *out, size_t first, size_t last, bool find_max,
+                           size_t *deque)
+{
+    size_t head = 0, count = 0;
+    bool seen_nan = false;
+    size_t last_nan = 0;
+    for (size_t index = first; index < last + window_size - 1; ++index)
+    {
+        double value = data[index];
+        if (isnan(value))
+        {
+            seen_nan = true;
+            last_nan = index;
+            count = 0;
+            if (index + 1 >= first + window_size)
+                out[index + 1 - window_size] = value;
+            continue;
+        }
+        if (count > 0 && deque[head] + window_size <= index)   // front fell out of the window
+        {
+            head = (head + 1) % window_size;
+            count--;
+        }
+        while (count > 0)
+        {
+            double back = data[deque[(head + count - 1) % window_size]];
+            if (find_max ? back > value : back < value)
+                break;
+            count--;                                   // back can never be the extreme again
+        }
+        deque[(head + count) % window_size] = index;
+        count++;
+        if (index + 1 >= first + window_size)
+        {
+            bool nan_in_window = seen_nan && last_nan + window_size > index;
+            out[index + 1 - window_size] = nan_in_window ? data[last_nan] : data[deque[head]];
+        }
+    }
+}
+
+void rolling_max_block(const double *data, size_t window_size, double *out, size_t first, size_t last, size_t *scratch)
+{
+    rolling_extreme_block(data, window_size, out, first, last, true, scratch);
+}
+
+void rolling_min_block(const double *data, size_t window_size, double *out, size_t first, size_t last, size_t *scratch)
+{
+    rolling_extreme_block(data, window_size, out, first, last, false, scratch);
+}
+
+CNumPyArray apply_rolling(const CNumPyArray *array, size_t window_size, RollingBlockFunction f, bool needs_scratch,
+                          InstrumentOp op, const char *message)
+{
+    INSTRUMENT_BEGIN(op, array->size);
+    if (window_size == 0)
+    {
+        fprintf(stderr, "%s: window size must be positive\n", message);
+        exit(1);
+    }
+    size_t output_size = window_size > array->size ? 0 : array->size - window_size + 1;
+    CNumPyArray result = create_array(NULL, output_size);
+    // a block at least as long as the window keeps the halo cost below the block cost
+    size_t block_size = window_size > ROLLING_BLOCK_SIZE ? window_size : ROLLING_BLOCK_SIZE;
+    // one scratch buffer reused by every block (threaded blocks would each need their own)
+    size_t *scratch = needs_scratch && output_size > 0 ? allocate_or_exit(window_size * sizeof(size_t), false) : NULL;
+    for (size_t first = 0; first < output_size; first += block_size)
+    {
+        size_t last = first + block_size < output_size ? first + block_size : output_size;
+        f(array->data, window_size, result.data, first, last, scratch);
+    }
+    free(scratch);
+    INSTRUMENT_END();
+    return result;
+}
+
+CNumPyArray rolling_sum_array(const CNumPyArray *array, size_t window_size)      { return apply_rolling(array, window_size, rolling_sum_block, false, OP_ROLLING_SUM, "rolling_sum"); }
+CNumPyArray rolling_mean_array(const CNumPyArray *array, size_t window_size)     { return apply_rolling(array, window_size, rolling_mean_block, false, OP_ROLLING_MEAN, "rolling_mean"); }
+CNumPyArray rolling_variance_array(const CNumPyArray *array, size_t window_size) { return apply_rolling(array, window_size, rolling_variance_block, false, OP_ROLLING_VARIANCE, "rolling_variance"); }
+CNumPyArray rolling_std_array(const CNumPyArray *array, size_t window_size)      { return apply_rolling(array, window_size, rolling_std_block, false, OP_ROLLING_STD, "rolling_std"); }
+CNumPyArray rolling_min_array(const CNumPyArray *array, size_t window_size)      { return apply_rolling(array, window_size, rolling_min_block, true, OP_ROLLING_MIN, "rolling_min"); }
+CNumPyArray rolling_max_array(const CNumPyArray *array, size_t window_size)      { return apply_rolling(array, window_size, rolling_max_block, true, OP_ROLLING_MAX, "rolling_max"); }
+
+// -------------------------- Cumulative Operations --------------------------
+//
+// result[i] combines array[0 .. i]. The scans walk the array in blocks, passing the
+// last value of each block into the next one as its starting "carry". That is one sequential
+// dependency chain, the same as a single loop: the blocks are not independent, and splitting
+// a scan across threads would need a local pass per block plus a per-operation offset pass.
+
+#define SCAN_BLOCK_SIZE 8192        // elements per scan block
+
+void cumsum_block(const double *data, double *out, size_t first, size_t last, double carry)
+{
+    for (size_t index = first; index < last; ++index)
+    {
+        carry += data[index];
+        out[index] = carry;
+    }
+}
+
+void cumprod_block(const double *data, double *out, size_t first, size_t last, double carry)
+{
+    for (size_t index = first; index < last; ++index)
+    {
+        carry *= data[index];
+        out[index] = carry;
+    }
+}
+
+// Running max/min. A NaN is kept once seen, like NumPy's maximum.accumulate.
+void cummax_block(const double *data, double *out, size_t first, size_t last, double carry)
+{
+    for (size_t index = first; index < last; ++index)
+    {
+        double value = data[index];
+        if (value > carry || isnan(value))
+            carry = value;
+        out[index] = carry;
+    }
+}
+
+void cummin_block(const double *data, double *out, size_t first, size_t last, double carry)
+{
+    for (size_t index = first; index < last; ++index)
+    {
+        double value = data[index];
+        if (value < carry || isnan(value))
+            carry = value;
+        out[index] = carry;
+    }
+}
+
+typedef void (*ScanBlockFunction)(const double *data, double *out, size_t first, size_t last, double carry);
+
+CNumPyArray apply_scan(const CNumPyArray *array, ScanBlockFunction f, double initial_value, InstrumentOp op)
+{
+    INSTRUMENT_BEGIN(op, array->size);
+    CNumPyArray result = create_array(NULL, array->size);
+    double carry = initial_value;
+    for (size_t first = 0; first < array->size; first += SCAN_BLOCK_SIZE)
+    {
+        size_t last = first + SCAN_BLOCK_SIZE < array->size ? first + SCAN_BLOCK_SIZE : array->size;
+        f(array->data, result.data, first, last, carry);
+        carry = result.data[last - 1];                 // carry into the next block
+    }
+    INSTRUMENT_END();
+    return result;
+}
+
+CNumPyArray cumsum_array(const CNumPyArray *array)  { return apply_scan(array, cumsum_block, 0.0, OP_CUMSUM); }
+CNumPyArray cumprod_array(const CNumPyArray *array) { return apply_scan(array, cumprod_block, 1.0, OP_CUMPROD); }
+CNumPyArray cummax_array(const CNumPyArray *array)  { return apply_scan(array, cummax_block, -INFINITY, OP_CUMMAX); }
+CNumPyArray cummin_array(const CNumPyArray *array)  { return apply_scan(array, cummin_block, INFINITY, OP_CUMMIN); }
+
+// Differences of neighbours: result[i] = array[i + 1] - array[i] (one element shorter)
+CNumPyArray diff_array(const CNumPyArray *array)
+{
+    INSTRUMENT_BEGIN(OP_DIFF, array->size);
+    size_t output_size = array->size > 0 ? array->size - 1 : 0;
+    CNumPyArray result = create_array(NULL, output_size);
+    for (size_t index = 0; index < output_size; ++index)
+        result.data[index] = array->data[index + 1] - array->data[index];
+    INSTRUMENT_END();
+    return result;
+}
+
+// -------------------------- Selection, Median & Percentiles --------------------------
+//
+// Selection puts the k-th smallest value at index k, with smaller-or-equal values before it
+// and larger-or-equal values after it, without sorting the rest. It runs in expected O(n)
+// time using Floyd-Rivest selection. Like introsort, it gives up after too many rounds
+// and heap-sorts the remaining range, so the worst case stays O(n log n).
+//
+// The non-destructive functions copy the input into a scratch array. Pass the same scratch
+// array across calls to reuse its buffer (it grows when needed and is freed with free_array),
+// or pass NULL to use a temporary buffer.
+
+#define FLOYD_RIVEST_CUTOFF 600     // ranges larger than this are narrowed by sampling first
+
+void swap_values(double *data, ptrdiff_t first, ptrdiff_t second)
+{
+    double temp = data[first];
+    data[first] = data[second];
+    data[second] = temp;
+}
+
+// Move data[node] down until the max-heap data[0 .. count - 1] is valid again
+void sift_down(double *data, size_t node, size_t count)
+{
+    while (2 * node + 1 < count)
+    {
+        size_t child = 2 * node + 1;
+        if (child + 1 < count && data[child + 1] > data[child])
+            child++;                                   // pick the larger child
+        if (!(data[child] > data[node]))
+            return;
+        swap_values(data, node, child);
+        node = child;
+    }
+}
+
+// Heap sort of data[0 .. count - 1], the worst-case fallback of selection
+void heap_sort_values(double *data, size_t count)
+{
+    for (size_t node = count / 2; node-- > 0; )
+        sift_down(data, node, count);                  // build the heap
+    for (size_t end = count; end > 1; --end)
+    {
+        swap_values(data, 0, end - 1);                 // move the maximum behind the heap
+        sift_down(data, 0, end - 1);
+    }
+}
+
+// Floyd-Rivest selection of rank k inside data[left .. right]
+void select_in_range(double *data, ptrdiff_t left, ptrdiff_t right, ptrdiff_t k)
+{
+    // allow about 4 log2(n) rounds before falling back to heap sort
+    int rounds_left = 4 * (int)log2((double)(right - left + 2)) + 8;
+    while (right > left)
+    {
+        if (rounds_left-- == 0)
+        {
+            heap_sort_values(data + left, (size_t)(right - left + 1));
+            return;
+        }
+        if (right - left > FLOYD_RIVEST_CUTOFF)
+        {
+            // select inside a small sample range that very likely contains rank k
+            double n = (double)(right - left + 1);
+            double i = (double)(k - left + 1);
+            double z = log(n);
+            double s = 0.5 * exp(2.0 * z / 3.0);
+            double sd = 0.5 * sqrt(z * s * (n - s) / n) * (i < n / 2 ? -1.0 : 1.0);
+            ptrdiff_t new_left = (ptrdiff_t)fmax((double)left, floor((double)k - i * s / n + sd));
+            ptrdiff_t new_right = (ptrdiff_t)fmin((double)right, floor((double)k + (n - i) * s / n + sd));
+            select_in_range(data, new_left, new_right, k);
+        }
+        // partition around t = data[k], with data[left] and data[right] as sentinels
+        double t = data[k];
+        ptrdiff_t i = left, j = right;
+        swap_values(data, left, k);
+        if (data[right] > t)
+            swap_values(data, right, left);
+        while (i < j)
+        {
+            swap_values(data, i, j);
+            i++;
+            j--;
+            while (data[i] < t) i++;
+            while (data[j] > t) j--;
+        }
+        if (data[left] == t)
+            swap_values(data, left, j);
+        else
+        {
+            j++;
+            swap_values(data, j, right);
+        }
+        // continue only in the side that holds rank k
+        if (j <= k) left = j + 1;
+        if (k <= j) right = j - 1;
+    }
+}
+
+// Select every rank in the sorted list ranks[0 .. rank_count - 1], all inside data[left .. right].
+// The middle rank splits the range, so each half is only searched for its own ranks.
+void multi_select_in_range(double *data, ptrdiff_t left, ptrdiff_t right, const size_t *ranks, size_t rank_count)
+{
+    if (rank_count == 0 || left > right)
+        return;
+    size_t middle = rank_count / 2;
+    ptrdiff_t k = (ptrdiff_t)ranks[middle];
+    select_in_range(data, left, right, k);
+    size_t left_count = middle;
+    while (left_count > 0 && (ptrdiff_t)ranks[left_count - 1] == k)
+        left_count--;                                  // duplicates of k are already in place
+    size_t right_start = middle + 1;
+    while (right_start < rank_count && (ptrdiff_t)ranks[right_start] == k)
+        right_start++;
+    multi_select_in_range(data, left, k - 1, ranks, left_count);
+    multi_select_in_range(data, k + 1, right, ranks + right_start, rank_count - right_start);
+}
+
+// Copy array into the scratch buffer (or a fresh one if scratch is NULL) and report NaNs
+double *selection_buffer(const CNumPyArray *array, CNumPyArray *scratch, bool *has_nan)
+{
+    double *buffer;
+    if (scratch == NULL)
+        buffer = malloc(array->size * sizeof(double) + 1);
+    else
+    {
+        if (scratch->data == NULL || scratch->size < array->size)
+        {
+            free_array(scratch);
+            *scratch = allocate_array(array->size);
+        }
+        buffer = scratch->data;
+    }
+    if (buffer == NULL)
+    {
+        fprintf(stderr, "Memory allocation failed.\n");
+        exit(1);
+    }
+    *has_nan = false;
+    for (size_t index = 0; index < array->size; ++index)
+    {
+        buffer[index] = array->data[index];
+        if (isnan(array->data[index]))
+            *has_nan = true;
+    }
+    return buffer;
+}
+
+// Rearrange array in place so that array[kth] holds the value it would have after sorting
+void partition_array(CNumPyArray *array, size_t kth)
+{
+    INSTRUMENT_BEGIN(OP_PARTITION, array->size);
+    if (kth >= array->size)
+    {
+        fprintf(stderr, "partition: index %zu out of range (size %zu)\n", kth, array->size);
+        exit(1);
+    }
+    select_in_range(array->data, 0, (ptrdiff_t)array->size - 1, (ptrdiff_t)kth);
+    INSTRUMENT_END();
+}
+
+// Return the k-th smallest value (counting from 0) without modifying array
+double nth_element(const CNumPyArray *array, size_t kth, CNumPyArray *scratch)
+{
+    INSTRUMENT_BEGIN(OP_NTH_ELEMENT, array->size);
+    if (kth >= array->size)
+    {
+        fprintf(stderr, "nth_element: index %zu out of range (size %zu)\n", kth, array->size);
+        exit(1);
+    }
+    bool has_nan;
+    double *buffer = selection_buffer(array, scratch, &has_nan);
+    select_in_range(buffer, 0, (ptrdiff_t)array->size - 1, (ptrdiff_t)kth);
+    double value = buffer[kth];
+    if (scratch == NULL)
+        free(buffer);
+    INSTRUMENT_END();
+    return has_nan ? NAN : value;
+}
+
+int compare_sizes(const void *first, const void *second)
+{
+    size_t a = *(const size_t *)first, b = *(const size_t *)second;
+    return (a > b) - (a < b);
+}
+
+// Percentiles in [0, 100] with linear interpolation between ranks (NumPy's default method).
+// All requested percentiles share one multi-selection pass over the scratch buffer.
+// An empty array or one containing NaN gives NaN for every percentile.
+CNumPyArray percentile_array(const CNumPyArray *array, const CNumPyArray *percentiles, CNumPyArray *scratch)
+{
+    INSTRUMENT_BEGIN(OP_PERCENTILE, array->size);
+    CNumPyArray result = create_array(NULL, percentiles->size);
+    for (size_t index = 0; index < percentiles->size; ++index)
+    {
+        if (!(percentiles->data[index] >= 0.0 && percentiles->data[index] <= 100.0))
+        {
+            fprintf(stderr, "percentile: %f is outside [0, 100]\n", percentiles->data[index]);
+            exit(1);
+        }
+    }
+    if (array->size == 0)
+    {
+        fill_array(&result, NAN);
+        INSTRUMENT_END();
+        return result;
+    }
+    bool has_nan;
+    double *buffer = selection_buffer(array, scratch, &has_nan);
+    if (has_nan)
+    {
+        fill_array(&result, NAN);
+    }
+    else
+    {
+        // each percentile needs the two ranks around its position
+        size_t *ranks = malloc(2 * percentiles->size * sizeof(size_t) + 1);
+        if (ranks == NULL)
+        {
+            fprintf(stderr, "Memory allocation failed.\n");
+            exit(1);
+        }
+        size_t last_rank = array->size - 1;
+        for (size_t index = 0; index < percentiles->size; ++index)
+        {
+            double position = percentiles->data[index] / 100.0 * (double)last_rank;
+            size_t lower = (size_t)position;
+            ranks[2 * index] = lower;
+            ranks[2 * index + 1] = lower < last_rank ? lower + 1 : lower;
+        }
+        qsort(ranks, 2 * percentiles->size, sizeof(size_t), compare_sizes);
+        multi_select_in_range(buffer, 0, (ptrdiff_t)last_rank, ranks, 2 * percentiles->size);
+        free(ranks);
+        for (size_t index = 0; index < percentiles->size; ++index)
+        {
+            double position = percentiles->data[index] / 100.0 * (double)last_rank;
+            size_t lower = (size_t)position;
+            size_t upper = lower < last_rank ? lower + 1 : lower;
+            double fraction = position - (double)lower;
+            result.data[index] = buffer[lower] + (buffer[upper] - buffer[lower]) * fraction;
+        }
+    }
+    if (scratch == NULL)
+        free(buffer);
+    INSTRUMENT_END();
+    return result;
+}
+
+// Median (mean of the two middle values for even sizes); NaN for empty arrays or NaN input
+double median_array(const CNumPyArray *array, CNumPyArray *scratch)
+{
+    double fifty[] = {50.0};
+    CNumPyArray percentiles = {fifty, 1};
+    CNumPyArray result = percentile_array(array, &percentiles, scratch);
+    double median = result.data[0];
+    free_array(&result);
+    return median;
+}
+
+// -------------------------- Argsort & Top-k --------------------------
+//
+// argsort_array writes the indices that would sort the array in ascending order. It is stable
+// (equal values keep their original order) and places NaN values last, like NumPy.
+// Large arrays use an LSD radix sort over 64-bit keys that order like the doubles they
+// come from, so the cost is a few linear passes instead of O(n log n) comparisons.
+
+#define RADIX_SORT_MIN_SIZE 64      // below this, insertion sort is faster
+#define TOPK_HEAP_LIMIT 512         // larger k switches from a heap to selection
+
+// Map a double to an unsigned key with the same ordering (NaN last, -0.0 equal to 0.0)
+uint64_t sortable_key(double value)
+{
+    uint64_t bits;
+    if (isnan(value))
+        return UINT64_MAX;
+    if (value == 0.0)
+        value = 0.0;                                   // drop the sign of -0.0
+    memcpy(&bits, &value, sizeof(bits));
+    // negative numbers: flip all bits; positive numbers: set the sign bit
+    return (bits >> 63) ? ~bits : bits | 0x8000000000000000ULL;
+}
+
+void argsort_values(const double *values, size_t count, size_t *out_indices)
+{
+    uint64_t *keys = malloc(2 * count * sizeof(uint64_t) + 1);
+    size_t *indices_buffer = malloc(count * sizeof(size_t) + 1);
+    if (keys == NULL || indices_buffer == NULL)
+    {
+        fprintf(stderr, "Memory allocation failed.\n");
+        exit(1);
+    }
+    uint64_t *keys_buffer = keys + count;
+    for (size_t index = 0; index < count; ++index)
+    {
+        keys[index] = sortable_key(values[index]);
+        out_indices[index] = index;
+    }
+    if (count < RADIX_SORT_MIN_SIZE)
+    {
+        // stable insertion sort on (key, index)
+        for (size_t i = 1; i < count; ++i)
+        {
+            uint64_t key = keys[i];
+            size_t original = out_indices[i];
+            size_t j = i;
+            for (; j > 0 && keys[j - 1] > key; --j)
+            {
+                keys[j] = keys[j - 1];
+                out_indices[j] = out_indices[j - 1];
+            }
+            keys[j] = key;
+            out_indices[j] = original;
+        }
+    }
+    else
+    {
+        // count all eight byte digits in one pass
+        size_t histogram[8][256] = {{0}};
+        for (size_t index = 0; index < count; ++index)
+            for (int digit = 0; digit < 8; ++digit)
+                histogram[digit][(keys[index] >> (8 * digit)) & 0xFF]++;
+        uint64_t *source_keys = keys, *target_keys = keys_buffer;
+        size_t *source_indices = out_indices, *target_indices = indices_buffer;
+        for (int digit = 0; digit < 8; ++digit)
+        {
+            size_t first_byte = (source_keys[0] >> (8 * digit)) & 0xFF;
+            if (histogram[digit][first_byte] == count)
+                continue;                              // every key has the same byte here
+            size_t offsets[256];
+            size_t running = 0;
+            for (int bucket = 0; bucket < 256; ++bucket)
+            {
+                offsets[bucket] = running;
+                running += histogram[digit][bucket];
+            }
+            for (size_t index = 0; index < count; ++index)
+            {
+                size_t position = offsets[(source_keys[index] >> (8 * digit)) & 0xFF]++;
+                target_keys[position] = source_keys[index];
+                target_indices[position] = source_indices[index];
+            }
+            uint64_t *swap_keys = source_keys; source_keys = target_keys; target_keys = swap_keys;
+            size_t *swap_indices = source_indices; source_indices = target_indices; target_indices = swap_indices;
+        }
+        if (source_indices != out_indices)
+            memcpy(out_indices, source_indices, count * sizeof(size_t));
+    }
+    free(keys);
+    free(indices_buffer);
+}
+
+// Stable ascending argsort; out_indices must hold array->size entries
+void argsort_array(const CNumPyArray *array, size_t *out_indices)
+{
+    INSTRUMENT_BEGIN(OP_ARGSORT, array->size);
+    argsort_values(array->data, array->size, out_indices);
+    INSTRUMENT_END();
+}
+
+// Top-k ranking order: larger values first, ties by lower index, NaN after every number
+bool ranks_before(double value_a, size_t index_a, double value_b, size_t index_b)
+{
+    if (isnan(value_a) || isnan(value_b))
+    {
+        if (isnan(value_a) && isnan(value_b))
+            return index_a < index_b;
+        return isnan(value_b);
+    }
+    if (value_a != value_b)
+        return value_a > value_b;
+    return index_a < index_b;
+}
+
+// Restore the heap after its root changed. The root holds the worst of the kept candidates.
+void topk_sift_down(double *values, size_t *indices, size_t node, size_t count)
+{
+    while (2 * node + 1 < count)
+    {
+        size_t child = 2 * node + 1;
+        if (child + 1 < count && ranks_before(values[child], indices[child], values[child + 1], indices[child + 1]))
+            child++;                                   // pick the worse child
+        if (!ranks_before(values[node], indices[node], values[child], indices[child]))
+            return;
+        double value = values[node]; values[node] = values[child]; values[child] = value;
+        size_t index = indices[node]; indices[node] = indices[child]; indices[child] = index;
+        node = child;
+    }
+}
+
+// Small k: keep the k best candidates in a heap. Once the heap is full, its root is a threshold,
+// and blocks of 8 values are first tested with one branch-free comparison pass; only blocks
+// holding a value above the threshold are inspected one by one.
+void topk_with_heap(const CNumPyArray *array, size_t k, double *values, size_t *indices)
+{
+    size_t heap_size = 0;
+    size_t index = 0;
+    for (; index < array->size && heap_size < k; ++index)
+    {
+        values[heap_size] = array->data[index];
+        indices[heap_size] = index;
+        heap_size++;
+    }
+    for (size_t node = k / 2; node-- > 0; )
+        topk_sift_down(values, indices, node, k);
+    while (index < array->size)
+    {
+        double threshold = values[0];
+        if (index + 8 <= array->size && !isnan(threshold))
+        {
+            bool any_above = false;
+            for (size_t lane = 0; lane < 8; ++lane)
+                any_above |= array->data[index + lane] > threshold;
+            if (!any_above)
+            {
+                index += 8;                            // nothing in this block can enter
+                continue;
+            }
+        }
+        size_t block_end = index + 8 < array->size ? index + 8 : array->size;
+        for (; index < block_end; ++index)
+        {
+            if (ranks_before(array->data[index], index, values[0], indices[0]))
+            {
+                values[0] = array->data[index];
+                indices[0] = index;
+                topk_sift_down(values, indices, 0, k);
+            }
+        }
+    }
+    // pop the worst candidate to the back until the heap is empty
+    for (size_t end = k; end > 1; --end)
+    {
+        double value = values[0]; values[0] = values[end - 1]; values[end - 1] = value;
+        size_t position = indices[0]; indices[0] = indices[end - 1]; indices[end - 1] = position;
+        topk_sift_down(values, indices, 0, end - 1);
+    }
+}
+
+// Large k: select the k-th largest number as a cut-off, collect everything at or above it in
+// index order, then sort the k survivors
+void topk_with_selection(const CNumPyArray *array, size_t k, double *values, size_t *indices)
+{
+    double *numbers = malloc(array->size * sizeof(double) + 1);
+    if (numbers == NULL)
+    {
+        fprintf(stderr, "Memory allocation failed.\n");
+        exit(1);
+    }
+    size_t number_count = 0;
+    for (size_t index = 0; index < array->size; ++index)
+        if (!isnan(array->data[index]))
+            numbers[number_count++] = array->data[index];
+    double cutoff = -INFINITY;
+    if (number_count >= k)
+    {
+        size_t rank = number_count - k;
+        select_in_range(numbers, 0, (ptrdiff_t)number_count - 1, (ptrdiff_t)rank);
+        cutoff = numbers[rank];
+    }
+    free(numbers);
+    size_t above_count = 0;
+    for (size_t index = 0; index < array->size; ++index)
+        if (array->data[index] > cutoff)
+            above_count++;
+    size_t taken = 0, equal_left = k - above_count;
+    for (size_t index = 0; index < array->size && taken < k; ++index)
+    {
+        double value = array->data[index];
+        if (value > cutoff || (value == cutoff && equal_left > 0))
+        {
+            if (value == cutoff)
+                equal_left--;
+            values[taken] = value;
+            indices[taken] = index;
+            taken++;
+        }
+    }
+    for (size_t index = 0; index < array->size && taken < k; ++index)
+    {
+        if (isnan(array->data[index]))                 // only when there are fewer than k numbers
+        {
+            values[taken] = array->data[index];
+            indices[taken] = index;
+            taken++;
+        }
+    }
+    // stable descending order: argsort the negated values
+    double *negated = malloc(k * sizeof(double) + 1);
+    size_t *order = malloc(k * sizeof(size_t) + 1);
+    size_t *picked = malloc(k * sizeof(size_t) + 1);
+    if (negated == NULL || order == NULL || picked == NULL)
+    {
+        fprintf(stderr, "Memory allocation failed.\n");
+        exit(1);
+    }
+    for (size_t index = 0; index < k; ++index)
+    {
+        negated[index] = -values[index];
+        picked[index] = indices[index];
+    }
+    argsort_values(negated, k, order);
+    for (size_t index = 0; index < k; ++index)
+    {
+        values[index] = -negated[order[index]];
+        indices[index] = picked[order[index]];
+    }
+    free(negated);
+    free(order);
+    free(picked);
+}
+
+// Return the k largest values in descending order (ties keep the lower index first, NaN ranks
+// below every number). If out_indices is not NULL it receives their k positions in array.
+CNumPyArray topk_array(const CNumPyArray *array, size_t k, size_t *out_indices)
+{
+    INSTRUMENT_BEGIN(OP_TOPK, array->size);
+    if (k > array->size)
+    {
+        fprintf(stderr, "topk: k = %zu is larger than the array size %zu\n", k, array->size);
+        exit(1);
+    }
+    CNumPyArray result = create_array(NULL, k);
+    size_t *indices = out_indices != NULL ? out_indices : malloc(k * sizeof(size_t) + 1);
+    if (indices == NULL)
+    {
+        fprintf(stderr, "Memory allocation failed.\n");
+        exit(1);
+    }
+    if (k > TOPK_HEAP_LIMIT)
+        topk_with_selection(array, k, result.data, indices);
+    else if (k > 0)
+        topk_with_heap(array, k, result.data, indices);
+    if (out_indices == NULL)
+        free(indices);
+    INSTRUMENT_END();
+    return result;
+}
+
+// -------------------------- Streaming Quantile Sketch --------------------------
+//
+// QuantileSketch is a merging t-digest: it summarizes a stream of values as a sorted list of
+// centroids (mean, weight) and answers approximate percentile queries in O(compression) time.
+// Centroids are small near the minimum and maximum and large in the middle, so tail
+// percentiles such as p99 and p999 stay accurate.
+//
+// Memory: at most compression + 1 centroids after each merge, plus an input buffer of
+// 5 * compression values, i.e. about 7 * compression doubles (roughly 5.6 KB for the
+// default compression of 100), no matter how many values were added.
+//
+// Accuracy: t-digest has no worst-case guarantee. On uniform, exponential and log-normal
+// streams with compression 100, the rank error stays below about 0.2% in the middle and
+// about 0.04% at p99 and p999. The minimum and maximum are exact. Higher compression
+// trades memory for accuracy roughly linearly.
+//
+// Sketches built on different threads or machines can be merged, and serialized to a
+// compact byte blob (native byte order). Deserializing checks the blob's centroids (finite,
+// sorted means; positive weights adding up to the total) before any query trusts them.
+
+#define QUANTILE_SKETCH_DEFAULT_COMPRESSION 100.0
+#define QUANTILE_SKETCH_MAX_COMPRESSION 1e6           // about 56 MB of buffers and centroids
+#define QUANTILE_SKETCH_MAGIC 0x53514E43u             // "CNQS" in little-endian byte order
+
+typedef struct {
+    double compression;         // accuracy parameter (number of k-scale units)
+    size_t centroid_count;      // number of merged centroids
+    double *means;              // centroid means, sorted ascending
+    double *weights;            // centroid weights (number of values each one represents)
+    size_t buffer_capacity;     // raw values collected before the next merge
+    size_t buffer_count;
+    double *buffer;             // raw values not yet merged into centroids
+    double total_weight;        // number of values added, including the buffer
+    double min_value;           // exact minimum of all values added
+    double max_value;           // exact maximum of all values added
+} QuantileSketch;
+
+QuantileSketch create_quantile_sketch(double compression)
+{
+    if (!(compression >= 10.0 && compression <= QUANTILE_SKETCH_MAX_COMPRESSION))
+    {
+        fprintf(stderr, "quantile sketch: compression must be between 10 and %g (got %g)\n",
+                QUANTILE_SKETCH_MAX_COMPRESSION, compression);
+        exit(1);
+    }
+    QuantileSketch sketch;
+    sketch.compression = compression;
+    sketch.centroid_count = 0;
+    sketch.means = NULL;
+    sketch.weights = NULL;
+    sketch.buffer_capacity = 5 * (size_t)ceil(compression);
+    sketch.buffer_count = 0;
+    sketch.buffer = malloc(sketch.buffer_capacity * sizeof(double));
+    if (sketch.buffer == NULL)
+    {
+        fprintf(stderr, "Memory allocation failed.\n");
+        exit(1);
+    }
+    sketch.total_weight = 0.0;
+    sketch.min_value = INFINITY;
+    sketch.max_value = -INFINITY;
+    return sketch;
+}
+
+void free_quantile_sketch(QuantileSketch *sketch)
+{
+    free(sketch->means);
+    free(sketch->weights);
+    free(sketch->buffer);
+    sketch->means = NULL;
+    sketch->weights = NULL;
+    sketch->buffer = NULL;
+    sketch->centroid_count = 0;
+    sketch->buffer_count = 0;
+    sketch->total_weight = 0.0;
+}
+
+// Scale function k1: maps a quantile to k-units, stretched near 0 and 1 so tail centroids stay small
+double sketch_scale(double compression, double quantile)
+{
+    return compression / (2.0 * M_PI) * asin(2.0 * quantile - 1.0);
+}
+
+// Merge the sketch's centroids, its raw buffer and (optionally) another sketch's contents
+// into a fresh, compressed list of centroids
+void compress_quantile_sketch(QuantileSketch *sketch, const QuantileSketch *other)
+{
+    size_t input_count = sketch->centroid_count + sketch->buffer_count;
+    if (other != NULL)
+        input_count += other->centroid_count + other->buffer_count;
+    double *means = malloc(input_count * sizeof(double) + 1);
+    double *weights = malloc(input_count * sizeof(double) + 1);
+    size_t *order = malloc(input_count * sizeof(size_t) + 1);
+    if (means == NULL || weights == NULL || order == NULL)
+    {
+        fprintf(stderr, "Memory allocation failed.\n");
+        exit(1);
+    }
+    // gather every (mean, weight) pair; raw values have weight one
+    size_t count = 0;
+    const QuantileSketch *sources[2] = {sketch, other};
+    for (int source = 0; source < 2 && sources[source] != NULL; ++source)
+    {
+        const QuantileSketch *from = sources[source];
+        if (from->centroid_count > 0)                  // means is NULL before the first merge
+        {
+            memcpy(means + count, from->means, from->centroid_count * sizeof(double));
+            memcpy(weights + count, from->weights, from->centroid_count * sizeof(double));
+            count += from->centroid_count;
+        }
+        memcpy(means + count, from->buffer, from->buffer_count * sizeof(double));
+        for (size_t index = 0; index < from->buffer_count; ++index)
+            weights[count + index] = 1.0;
+        count += from->buffer_count;
+    }
+    argsort_values(means, count, order);
+
+    // greedy merge: grow the current centroid while it spans at most one k-unit
+    double *merged_means = malloc(count * sizeof(double) + 1);
+    double *merged_weights = malloc(count * sizeof(double) + 1);
+    if (merged_means == NULL || merged_weights == NULL)
+    {
+        fprintf(stderr, "Memory allocation failed.\n");
+        exit(1);
+    }
+    double total = 0.0;
+    for (size_t index = 0; index < count; ++index)
+        total += weights[index];
+    size_t merged_count = 0;
+    double weight_before = 0.0;                        // weight of all finished centroids
+    double k_lower = sketch_scale(sketch->compression, 0.0);
+    for (size_t position = 0; position < count; ++position)
+    {
+        double mean = means[order[position]];
+        double weight = weights[order[position]];
+        if (merged_count > 0)
+        {
+            double current_weight = merged_weights[merged_count - 1];
+            double quantile_right = (weight_before + current_weight + weight) / total;
+            if (quantile_right > 1.0)
+                quantile_right = 1.0;
+            if (sketch_scale(sketch->compression, quantile_right) - k_lower <= 1.0)
+            {
+                // absorb into the current centroid (weighted running mean)
+                merged_weights[merged_count - 1] = current_weight + weight;
+                merged_means[merged_count - 1] += (mean - merged_means[merged_count - 1]) * weight / (current_weight + weight);
+                continue;
+            }
+            weight_before += current_weight;            // close the current centroid
+            k_lower = sketch_scale(sketch->compression, weight_before / total);
+        }
+        merged_means[merged_count] = mean;
+        merged_weights[merged_count] = weight;
+        merged_count++;
+    }
+    free(means);
+    free(weights);
+    free(order);
+    free(sketch->means);
+    free(sketch->weights);
+    // shrink to fit; if the allocator cannot, the larger merged buffers are still valid
+    double *shrunk_means = realloc(merged_means, merged_count * sizeof(double) + 1);
+    double *shrunk_weights = realloc(merged_weights, merged_count * sizeof(double) + 1);
+    sketch->means = shrunk_means != NULL ? shrunk_means : merged_means;
+    sketch->weights = shrunk_weights != NULL ? shrunk_weights : merged_weights;
+    sketch->centroid_count = merged_count;
+    sketch->buffer_count = 0;
+}
+
+// Add every value of batch to the sketch. NaN values are ignored.
+// Values are copied into the raw buffer in bulk; full buffers are merged into the centroids.
+void quantile_sketch_add(QuantileSketch *sketch, const CNumPyArray *batch)
+{
+    INSTRUMENT_BEGIN(OP_SKETCH_ADD, batch->size);
+    size_t index = 0;
+    while (index < batch->size)
+    {
+        size_t room = sketch->buffer_capacity - sketch->buffer_count;
+        size_t chunk = batch->size - index < room ? batch->size - index : room;
+        const double *values = batch->data + index;
+        double chunk_min = INFINITY, chunk_max = -INFINITY;
+        bool has_nan = false;
+        for (size_t offset = 0; offset < chunk; ++offset)
+        {
+            chunk_min = fmin(chunk_min, values[offset]);
+            chunk_max = fmax(chunk_max, values[offset]);
+            has_nan |= values[offset] != values[offset];
+        }
+        double *target = sketch->buffer + sketch->buffer_count;
+        size_t added = chunk;
+        if (!has_nan)
+            memcpy(target, values, chunk * sizeof(double));   // common case: one bulk copy
+        else
+        {
+            added = 0;
+            for (size_t offset = 0; offset < chunk; ++offset)
+                if (!isnan(values[offset]))
+                    target[added++] = values[offset];
+        }
+        sketch->buffer_count += added;
+        sketch->total_weight += (double)added;
+        if (added > 0)
+        {
+            sketch->min_value = fmin(sketch->min_value, chunk_min);
+            sketch->max_value = fmax(sketch->max_value, chunk_max);
+        }
+        if (sketch->buffer_count == sketch->buffer_capacity)
+            compress_quantile_sketch(sketch, NULL);
+        index += chunk;
+    }
+    INSTRUMENT_END();
+}
+
+// Fold source into target; both may have been filled independently (e.g. one per thread)
+void quantile_sketch_merge(QuantileSketch *target, const QuantileSketch *source)
+{
+    INSTRUMENT_BEGIN(OP_SKETCH_MERGE, source->centroid_count + source->buffer_count);
+    compress_quantile_sketch(target, source);
+    target->total_weight += source->total_weight;
+    target->min_value = fmin(target->min_value, source->min_value);
+    target->max_value = fmax(target->max_value, source->max_value);
+    INSTRUMENT_END();
+}
+
+// Approximate percentiles (each in [0, 100]); NaN for every percentile of an empty sketch
+CNumPyArray quantile_sketch_percentiles(QuantileSketch *sketch, const CNumPyArray *percentiles)
+{
+    INSTRUMENT_BEGIN(OP_SKETCH_PERCENTILES, percentiles->size);
+    if (sketch->buffer_count > 0)
+        compress_quantile_sketch(sketch, NULL);
+    CNumPyArray result = create_array(NULL, percentiles->size);
+    for (size_t index = 0; index < percentiles->size; ++index)
+    {
+        double percentile = percentiles->data[index];
+        if (!(percentile >= 0.0 && percentile <= 100.0))
+        {
+            fprintf(stderr, "quantile sketch: percentile %f is outside [0, 100]\n", percentile);
+            exit(1);
+        }
+        if (sketch->centroid_count == 0)
+        {
+            result.data[index] = NAN;
+            continue;
+        }
+        // each centroid sits at the middle of the weight it covers; interpolate between
+        // neighbouring centres, and between the outer centres and the exact min/max
+        size_t last = sketch->centroid_count - 1;
+        double target = percentile / 100.0 * sketch->total_weight;
+        double first_center = sketch->weights[0] / 2.0;
+        double last_center = sketch->total_weight - sketch->weights[last] / 2.0;
+        double value;
+        if (target <= first_center)
+            value = sketch->min_value + (sketch->means[0] - sketch->min_value) * (target / first_center);
+        else if (target >= last_center)
+            value = sketch->means[last] + (sketch->max_value - sketch->means[last])
+                    * ((target - last_center) / (sketch->total_weight - last_center));
+        else
+        {
+            double center = first_center;
+            size_t position = 0;
+            while (position < last)
+            {
+                double next_center = center + (sketch->weights[position] + sketch->weights[position + 1]) / 2.0;
+                if (target < next_center)
+                    break;
+                center = next_center;
+                position++;
+            }
+            double next_center = center + (sketch->weights[position] + sketch->weights[position + 1]) / 2.0;
+            double fraction = (target - center) / (next_center - center);
+            value = sketch->means[position] + (sketch->means[position + 1] - sketch->means[position]) * fraction;
+        }
+        result.data[index] = value;
+    }
+    INSTRUMENT_END();
+    return result;
+}
+
+double quantile_sketch_percentile(QuantileSketch *sketch, double percentile)
+{
+    CNumPyArray percentiles = {&percentile, 1};
+    CNumPyArray result = quantile_sketch_percentiles(sketch, &percentiles);
+    double value = result.data[0];
+    free_array(&result);
+    return value;
+}
+
+// Serialize into a newly allocated blob (free it with free()); returns its length in bytes.
+// Layout: magic, centroid count (uint32), compression, total weight, min, max, means, weights.
+size_t quantile_sketch_serialize(QuantileSketch *sketch, unsigned char **out_bytes)
+{
+    if (sketch->buffer_count > 0)
+        compress_quantile_sketch(sketch, NULL);
+    uint32_t header[2] = {QUANTILE_SKETCH_MAGIC, (uint32_t)sketch->centroid_count};
+    double fields[4] = {sketch->compression, sketch->total_weight, sketch->min_value, sketch->max_value};
+    size_t byte_count = sizeof(header) + sizeof(fields) + 2 * sketch->centroid_count * sizeof(double);
+    unsigned char *bytes = malloc(byte_count);
+    if (bytes == NULL)
+    {
+        fprintf(stderr, "Memory allocation failed.\n");
+        exit(1);
+    }
+    unsigned char *cursor = bytes;
+    memcpy(cursor, header, sizeof(header));                                   cursor += sizeof(header);
+    memcpy(cursor, fields, sizeof(fields));                                   cursor += sizeof(fields);
+    if (sketch->centroid_count > 0)                                           // an empty sketch has no centroid arrays
+    {
+        memcpy(cursor, sketch->means, sketch->centroid_count * sizeof(double));   cursor += sketch->centroid_count * sizeof(double);
+        memcpy(cursor, sketch->weights, sketch->centroid_count * sizeof(double));
+    }
+    *out_bytes = bytes;
+    return byte_count;
+}
+
+QuantileSketch quantile_sketch_deserialize(const unsigned char *bytes, size_t byte_count)
+{
+    uint32_t header[2];
+    double fields[4];
+    if (byte_count < sizeof(header) + sizeof(fields))
+    {
+        fprintf(stderr, "quantile sketch: blob too short (%zu bytes)\n", byte_count);
+        exit(1);
+    }
+    memcpy(header, bytes, sizeof(header));
+    memcpy(fields, bytes + sizeof(header), sizeof(fields));
+    size_t centroid_count = header[1];
+    if (header[0] != QUANTILE_SKETCH_MAGIC
+        || byte_count != sizeof(header) + sizeof(fields) + 2 * centroid_count * sizeof(double))
+    {
+        fprintf(stderr, "quantile sketch: blob is not a serialized sketch\n");
+        exit(1);
+    }
+    QuantileSketch sketch = create_quantile_sketch(fields[0]);
+    sketch.total_weight = fields[1];
+    sketch.min_value = fields[2];
+    sketch.max_value = fields[3];
+    sketch.centroid_count = centroid_count;
+    sketch.means = malloc(centroid_count * sizeof(double) + 1);
+    sketch.weights = malloc(centroid_count * sizeof(double) + 1);
+    if (sketch.means == NULL || sketch.weights == NULL)
+    {
+        fprintf(stderr, "Memory allocation failed.\n");
+        exit(1);
+    }
+    const unsigned char *cursor = bytes + sizeof(header) + sizeof(fields);
+    memcpy(sketch.means, cursor, centroid_count * sizeof(double));
+    memcpy(sketch.weights, cursor + centroid_count * sizeof(double), centroid_count * sizeof(double));
+    double weight_sum = 0.0;
+    bool valid = centroid_count > 0 ? sketch.min_value <= sketch.means[0] && sketch.means[centroid_count - 1] <= sketch.max_value
+                                    : sketch.total_weight == 0.0;
+    for (size_t index = 0; index < centroid_count && valid; ++index)
+    {
+        valid = isfinite(sketch.means[index]) && isfinite(sketch.weights[index]) && sketch.weights[index] > 0.0
+            && (index == 0 || sketch.means[index - 1] <= sketch.means[index]);
+        weight_sum += sketch.weights[index];
+    }
+    if (!valid || !(fabs(weight_sum - sketch.total_weight) <= 1e-9 * sketch.total_weight))
+    {
+        fprintf(stderr, "quantile sketch: blob holds inconsistent centroids\n");
+        exit(1);
+    }
+    return sketch;
+}
+
+// -------------------------- Histograms, Bincount & Digitize --------------------------
+//
+// Counting kernels keep several private copies of the bins and send neighbouring elements to
+// different copies, then add the copies together at the end. Runs of equal values then do not
+// wait on the previous increment of the same counter, and the same layout gives each thread
+// its own bins if the loop is ever split across threads.
+// histogram_array bins by one multiply per element and then, like numpy.histogram, moves the
+// bin by one where rounding put a value on the wrong side of the linspace-computed edges.
+// bincount_array has no bin limit of its own: a value so large that its bin count cannot even
+// be expressed as an allocation size is rejected, and anything smaller is limited only by
+// memory (max(value) + 1 counters plus the result), failing like any other allocation.
+
+#define HISTOGRAM_COPIES 4            // private bin copies (power of two)
+#define HISTOGRAM_COPY_LIMIT 4096     // more bins than this use a single copy to save memory
+
+size_t histogram_copy_count(size_t bin_count)
+{
+    return bin_count <= HISTOGRAM_COPY_LIMIT ? HISTOGRAM_COPIES : 1;
+}
+
+size_t *create_private_bins(size_t bin_count, size_t copies)
+{
+    size_t *bins = calloc(bin_count * copies + 1, sizeof(size_t));
+    if (bins == NULL)
+    {
+        fprintf(stderr, "Memory allocation failed.\n");
+        exit(1);
+    }
+    return bins;
+}
+
+// Sum the private copies into a counts array and release them
+CNumPyArray merge_private_bins(size_t *bins, size_t bin_count, size_t copies)
+{
+    CNumPyArray counts = create_array(NULL, bin_count);
+    for (size_t copy = 0; copy < copies; ++copy)
+        for (size_t bin = 0; bin < bin_count; ++bin)
+            counts.data[bin] += (double)bins[copy * bin_count + bin];
+    free(bins);
+    return counts;
+}
+
+// Number of sorted edges that are <= value (or < value when strict), without branches in the loop
+size_t count_edges_below(const double *edges, size_t edge_count, double value, bool strict)
+{
+    if (edge_count == 0)
+        return 0;
+    const double *base = edges;
+    size_t length = edge_count;
+    while (length > 1)
+    {
+        size_t half = length / 2;
+        bool move = strict ? base[half] < value : base[half] <= value;
+        base += move ? half : 0;                       // compiles to a conditional move
+        length -= half;
+    }
+    bool last = strict ? base[0] < value : base[0] <= value;
+    return (size_t)(base - edges) + (last ? 1 : 0);
+}
+
+void require_increasing_edges(const CNumPyArray *edges, const char *message)
+{
+    for (size_t index = 1; index < edges->size; ++index)
+    {
+        if (!(edges->data[index - 1] < edges->data[index]))
+        {
+            fprintf(stderr, "%s: edges must be strictly increasing\n", message);
+            exit(1);
+        }
+    }
+}
+
+// Counts of values in bin_count equal-width bins over [range_min, range_max].
+// Bins are half-open except the last, which includes range_max. Values outside the range and NaN are skipped.
+CNumPyArray histogram_array(const CNumPyArray *array, size_t bin_count, double range_min, double range_max)
+{
+    INSTRUMENT_BEGIN(OP_HISTOGRAM, array->size);
+    if (bin_count == 0 || !(range_min < range_max))
+    {
+        fprintf(stderr, "histogram: need at least one bin and range_min < range_max\n");
+        exit(1);
+    }
+    size_t copies = histogram_copy_count(bin_count);
+    size_t *bins = create_private_bins(bin_count, copies);
+    double scale = (double)bin_count / (range_max - range_min);   // one multiply per element
+    double width = (range_max - range_min) / (double)bin_count;   // linspace step of the edges
+    for (size_t index = 0; index < array->size; ++index)
+    {
+        double value = array->data[index];
+        if (!(value >= range_min && value <= range_max))
+            continue;
+        size_t bin = (size_t)((value - range_min) * scale);
+        if (bin >= bin_count)
+            bin = bin_count - 1;                       // range_max itself, or rounding just below it
+        // correct against the edges numpy.histogram uses: range_min + k * width, last = range_max
+        if (bin > 0 && value < range_min + (double)bin * width)
+            bin--;
+        else if (bin + 1 < bin_count && value >= range_min + (double)(bin + 1) * width)
+            bin++;
+        bins[(index & (copies - 1)) * bin_count + bin]++;
+    }
+    CNumPyArray result = merge_private_bins(bins, bin_count, copies);
+    INSTRUMENT_END();
+    return result;
+}
+
+// Counts of values in the bins between consecutive sorted edges (edges->size - 1 bins).
+// Bins are half-open except the last, which includes the final edge.
+CNumPyArray histogram_edges_array(const CNumPyArray *array, const CNumPyArray *edges)
+{
+    INSTRUMENT_BEGIN(OP_HISTOGRAM_EDGES, array->size);
+    if (edges->size < 2)
+    {
+        fprintf(stderr, "histogram: need at least two edges\n");
+        exit(1);
+    }
+    require_increasing_edges(edges, "histogram");
+    size_t bin_count = edges->size - 1;
+    double first_edge = edges->data[0], last_edge = edges->data[bin_count];
+    size_t copies = histogram_copy_count(bin_count);
+    size_t *bins = create_private_bins(bin_count, copies);
+    for (size_t index = 0; index < array->size; ++index)
+    {
+        double value = array->data[index];
+        if (!(value >= first_edge && value <= last_edge))
+            continue;
+        size_t bin = count_edges_below(edges->data, edges->size, value, false) - 1;
+        if (bin >= bin_count)
+            bin = bin_count - 1;                       // value equals the last edge
+        bins[(index & (copies - 1)) * bin_count + bin]++;
+    }
+    CNumPyArray result = merge_private_bins(bins, bin_count, copies);
+    INSTRUMENT_END();
+    return result;
+}
+
+// Count occurrences of each non-negative integer value; the result has max(value) + 1 entries,
+// or at least min_length
+CNumPyArray bincount_array(const CNumPyArray *array, size_t min_length)
+{
+    INSTRUMENT_BEGIN(OP_BINCOUNT, array->size);
+    if (min_length >= SIZE_MAX / sizeof(double))
+    {
+        fprintf(stderr, "bincount: min_length %zu is more bins than memory can address\n", min_length);
+        exit(1);
+    }
+    size_t bin_count = min_length;
+    for (size_t index = 0; index < array->size; ++index)
+    {
+        double value = array->data[index];
+        if (!(value >= 0.0) || !isfinite(value) || value != floor(value))
+        {
+            fprintf(stderr, "bincount: values must be non-negative integers (got %f)\n", value);
+            exit(1);
+        }
+        if (value >= (double)(SIZE_MAX / sizeof(double)))
+        {
+            fprintf(stderr, "bincount: value %.0f needs more bins than memory can address\n", value);
+            exit(1);
+        }
+        if ((size_t)value + 1 > bin_count)
+            bin_count = (size_t)value + 1;
+    }
+    size_t copies = histogram_copy_count(bin_count);
+    size_t *bins = create_private_bins(bin_count, copies);
+    for (size_t index = 0; index < array->size; ++index)
+        bins[(index & (copies - 1)) * bin_count + (size_t)array->data[index]]++;
+    CNumPyArray result = merge_private_bins(bins, bin_count, copies);
+    INSTRUMENT_END();
+    return result;
+}
+
+// Bin index of each value against sorted edges, like NumPy's digitize:
+// right == false: edges[i-1] <= value < edges[i]; right == true: edges[i-1] < value <= edges[i].
+// Values below the first edge get 0, values past the last edge (and NaN) get edges->size.
+CNumPyArray digitize_array(const CNumPyArray *array, const CNumPyArray *edges, bool right)
+{
+    INSTRUMENT_BEGIN(OP_DIGITIZE, array->size);
+    require_increasing_edges(edges, "digitize");
+    CNumPyArray result = create_array(NULL, array->size);
+    for (size_t index = 0; index < array->size; ++index)
+    {
+        double value = array->data[index];
+        size_t bin = isnan(value) ? edges->size : count_edges_below(edges->data, edges->size, value, right);
+        result.data[index] = (double)bin;
+    }
+    INSTRUMENT_END();
+    return result;
+}
+
+// -------------------------- Boolean Masks --------------------------
+//
+// Comparisons return a CNumPyMask: one bit per element, 64 elements per word, so a mask over
+// n elements takes n / 8 bytes instead of 8n for a double array. Bit i lives in
+// words[i / 64] at position i % 64 (least significant first). Unused bits of the last word
+// are always zero, so whole words can be counted and tested directly.
+
+typedef struct {
+    uint64_t *words;       // packed bits
+    size_t size;           // number of elements (bits)
+} CNumPyMask;
+
+size_t mask_word_count(size_t size)
+{
+    return (size + 63) / 64;
+}
+
+CNumPyMask create_mask(size_t mask_size)
+{
+    CNumPyMask mask;
+    mask.size = mask_size;
+    mask.words = calloc(mask_word_count(mask_size) + 1, sizeof(uint64_t));   // all false
+    if (mask.words == NULL)
+    {
+        fprintf(stderr, "Memory allocation failed.\n");
+        exit(1);
+    }
+    return mask;
+}
+
+void free_mask(CNumPyMask *mask)
+{
+    free(mask->words);
+    mask->words = NULL;
+    mask->size = 0;
+}
+
+bool mask_bit(const CNumPyMask *mask, size_t index)
+{
+    return (mask->words[index / 64] >> (index % 64)) & 1;
+}
+
+int popcount_word(uint64_t word)
+{
+#if defined(__GNUC__)
+    return __builtin_popcountll(word);                 // single instruction on most CPUs
+#else
+    int count = 0;
+    for (; word != 0; word &= word - 1)
+        count++;
+    return count;
+#endif
+}
+
+int lowest_bit_index(uint64_t word)                    // word must not be zero
+{
+#if defined(__GNUC__)
+    return __builtin_ctzll(word);
+#else
+    int index = 0;
+    while (!((word >> index) & 1))
+        index++;
+    return index;
+#endif
+}
+
+void require_mask_size(const CNumPyArray *array, const CNumPyMask *mask, const char *message)
+{
+    if (array->size != mask->size)
+    {
+        fprintf(stderr, "%s: array and mask sizes not equal (%zu, %zu)\n", message, array->size, mask->size);
+        exit(1);
+    }
+}
+
+// Comparison kinds for the packing kernel below
+typedef enum { COMPARE_LESS, COMPARE_GREATER, COMPARE_EQUAL } CompareKind;
+
+// Compare 64 elements at a time and pack the results into one word. The inner loop has no
+// branches, so the compiler turns it into vector compares plus a movemask-style bit gather.
+// If other is NULL, every element is compared with scalar instead.
+CNumPyMask compare_into_mask(const CNumPyArray *array, const double *other, double scalar, CompareKind kind)
+{
+    INSTRUMENT_BEGIN(OP_MASK_COMPARE, array->size);
+    CNumPyMask mask = create_mask(array->size);
+    const double *data = array->data;
+    for (size_t first = 0; first < array->size; first += 64)
+    {
+        size_t count = array->size - first < 64 ? array->size - first : 64;
+        uint64_t word = 0;
+        for (size_t lane = 0; lane < count; ++lane)
+        {
+            double right = other != NULL ? other[first + lane] : scalar;
+            bool bit = kind == COMPARE_LESS ? data[first + lane] < right
+                     : kind == COMPARE_GREATER ? data[first + lane] > right
+                     : data[first + lane] == right;
+            word |= (uint64_t)bit << lane;
+        }
+        mask.words[first / 64] = word;
+    }
+    INSTRUMENT_END();
+    return mask;
+}
+
+CNumPyMask less_array(const CNumPyArray *array1, const CNumPyArray *array2)
+{
+    require_same_size(array1, array2, "less");
+    return compare_into_mask(array1, array2->data, 0.0, COMPARE_LESS);
+}
+CNumPyMask greater_array(const CNumPyArray *array1, const CNumPyArray *array2)
+{
+    require_same_size(array1, array2, "greater");
+    return compare_into_mask(array1, array2->data, 0.0, COMPARE_GREATER);
+}
+CNumPyMask equal_elementwise_array(const CNumPyArray *array1, const CNumPyArray *array2)
+{
+    require_same_size(array1, array2, "equal");
+    return compare_into_mask(array1, array2->data, 0.0, COMPARE_EQUAL);
+}
+CNumPyMask less_scalar(const CNumPyArray *array, double value)    { return compare_into_mask(array, NULL, value, COMPARE_LESS); }
+CNumPyMask greater_scalar(const CNumPyArray *array, double value) { return compare_into_mask(array, NULL, value, COMPARE_GREATER); }
+CNumPyMask equal_scalar(const CNumPyArray *array, double value)   { return compare_into_mask(array, NULL, value, COMPARE_EQUAL); }
+
+// Mask of nonzero elements (NaN counts as nonzero, as in C)
+CNumPyMask mask_from_array(const CNumPyArray *array)
+{
+    CNumPyMask mask = compare_into_mask(array, NULL, 0.0, COMPARE_EQUAL);
+    for (size_t word = 0; word < mask_word_count(mask.size); ++word)
+        mask.words[word] = ~mask.words[word];
+    if (mask.size % 64 != 0)
+        mask.words[mask.size / 64] &= (UINT64_C(1) << (mask.size % 64)) - 1;   // clear unused bits
+    return mask;
+}
+
+// Expand a mask to an array of 0.0 and 1.0
+CNumPyArray mask_to_array(const CNumPyMask *mask)
+{
+    CNumPyArray result = create_array(NULL, mask->size);
+    for (size_t index = 0; index < mask->size; ++index)
+        result.data[index] = mask_bit(mask, index) ? 1.0 : 0.0;
+    return result;
+}
+
+void require_same_mask_size(const CNumPyMask *mask1, const CNumPyMask *mask2, const char *message)
+{
+    if (mask1->size != mask2->size)
+    {
+        fprintf(stderr, "%s: mask sizes not equal (%zu, %zu)\n", message, mask1->size, mask2->size);
+        exit(1);
+    }
+}
+
+CNumPyMask mask_and(const CNumPyMask *mask1, const CNumPyMask *mask2)
+{
+    INSTRUMENT_BEGIN(OP_MASK_LOGIC, mask1->size);
+    require_same_mask_size(mask1, mask2, "mask_and");
+    CNumPyMask result = create_mask(mask1->size);
+    for (size_t word = 0; word < mask_word_count(mask1->size); ++word)
+        result.words[word] = mask1->words[word] & mask2->words[word];
+    INSTRUMENT_END();
+    return result;
+}
+
+CNumPyMask mask_or(const CNumPyMask *mask1, const CNumPyMask *mask2)
+{
+    INSTRUMENT_BEGIN(OP_MASK_LOGIC, mask1->size);
+    require_same_mask_size(mask1, mask2, "mask_or");
+    CNumPyMask result = create_mask(mask1->size);
+    for (size_t word = 0; word < mask_word_count(mask1->size); ++word)
+        result.words[word] = mask1->words[word] | mask2->words[word];
+    INSTRUMENT_END();
+    return result;
+}
+
+CNumPyMask mask_not(const CNumPyMask *mask)
+{
+    INSTRUMENT_BEGIN(OP_MASK_LOGIC, mask->size);
+    CNumPyMask result = create_mask(mask->size);
+    for (size_t word = 0; word < mask_word_count(mask->size); ++word)
+        result.words[word] = ~mask->words[word];
+    if (mask->size % 64 != 0)
+        result.words[mask->size / 64] &= (UINT64_C(1) << (mask->size % 64)) - 1;   // clear unused bits
+    INSTRUMENT_END();
+    return result;
+}
+
+// Number of true elements
+size_t count_mask(const CNumPyMask *mask)
+{
+    INSTRUMENT_BEGIN(OP_COUNT_MASK, mask->size);
+    size_t count = 0;
+    for (size_t word = 0; word < mask_word_count(mask->size); ++word)
+        count += (size_t)popcount_word(mask->words[word]);
+    INSTRUMENT_END();
+    return count;
+}
+
+// Pick array1[i] where the mask is set and array2[i] elsewhere
+CNumPyArray where_array(const CNumPyMask *mask, const CNumPyArray *array1, const CNumPyArray *array2)
+{
+    INSTRUMENT_BEGIN(OP_WHERE, mask->size);
+    require_same_size(array1, array2, "where");
+    require_mask_size(array1, mask, "where");
+    CNumPyArray result = create_array(NULL, array1->size);
+    for (size_t index = 0; index < array1->size; ++index)
+        result.data[index] = mask_bit(mask, index) ? array1->data[index] : array2->data[index];
+    INSTRUMENT_END();
+    return result;
+}
+
+// -------------------------- Masked Operations --------------------------
+//
+// Masked arithmetic applies the operation where the mask is set and keeps array1's value
+// elsewhere. Masked reductions only look at selected elements and skip 64 unselected
+// elements per zero word.
+
+CNumPyArray masked_add_array(const CNumPyArray *array1, const CNumPyArray *array2, const CNumPyMask *mask)
+{
+    INSTRUMENT_BEGIN(OP_MASKED_ARITHMETIC, array1->size);
+    require_same_size(array1, array2, "masked_add");
+    require_mask_size(array1, mask, "masked_add");
+    CNumPyArray result = create_array(NULL, array1->size);
+    for (size_t index = 0; index < array1->size; ++index)
+        result.data[index] = mask_bit(mask, index) ? array1->data[index] + array2->data[index] : array1->data[index];
+    INSTRUMENT_END();
+    return result;
+}
+
+CNumPyArray masked_subtract_array(const CNumPyArray *array1, const CNumPyArray *array2, const CNumPyMask *mask)
+{
+    INSTRUMENT_BEGIN(OP_MASKED_ARITHMETIC, array1->size);
+    require_same_size(array1, array2, "masked_subtract");
+    require_mask_size(array1, mask, "masked_subtract");
+    CNumPyArray result = create_array(NULL, array1->size);
+    for (size_t index = 0; index < array1->size; ++index)
+        result.data[index] = mask_bit(mask, index) ? array1->data[index] - array2->data[index] : array1->data[index];
+    INSTRUMENT_END();
+    return result;
+}
+
+CNumPyArray masked_multiply_array(const CNumPyArray *array1, const CNumPyArray *array2, const CNumPyMask *mask)
+{
+    INSTRUMENT_BEGIN(OP_MASKED_ARITHMETIC, array1->size);
+    require_same_size(array1, array2, "masked_multiply");
+    require_mask_size(array1, mask, "masked_multiply");
+    CNumPyArray result = create_array(NULL, array1->size);
+    for (size_t index = 0; index < array1->size; ++index)
+        result.data[index] = mask_bit(mask, index) ? array1->data[index] * array2->data[index] : array1->data[index];
+    INSTRUMENT_END();
+    return result;
+}
+
+CNumPyArray masked_divide_array(const CNumPyArray *array1, const CNumPyArray *array2, const CNumPyMask *mask)
+{
+    INSTRUMENT_BEGIN(OP_MASKED_ARITHMETIC, array1->size);
+    require_same_size(array1, array2, "masked_divide");
+    require_mask_size(array1, mask, "masked_divide");
+    CNumPyArray result = create_array(NULL, array1->size);
+    for (size_t index = 0; index < array1->size; ++index)
+    {
+        if (!mask_bit(mask, index))
+            result.data[index] = array1->data[index];
+        else
+            result.data[index] = array2->data[index] == 0.0 ? 0.0 : array1->data[index] / array2->data[index];   // same zero rule as divide_array
+    }
+    INSTRUMENT_END();
+    return result;
+}
+
+double masked_sum_array(const CNumPyArray *array, const CNumPyMask *mask)
+{
+    INSTRUMENT_BEGIN(OP_MASKED_SUM, array->size);
+    require_mask_size(array, mask, "masked_sum");
+    double sum = 0.0;
+    for (size_t word_index = 0; word_index < mask_word_count(mask->size); ++word_index)
+    {
+        uint64_t word = mask->words[word_index];
+        const double *block = array->data + word_index * 64;
+        if (word == UINT64_MAX)
+        {
+            for (size_t lane = 0; lane < 64; ++lane)   // fully selected block
+                sum += block[lane];
+        }
+        else
+        {
+            for (; word != 0; word &= word - 1)        // visit set bits only
+                sum += block[lowest_bit_index(word)];
+        }
+    }
+    INSTRUMENT_END();
+    return sum;
+}
+
+// Mean of selected elements; NaN if nothing is selected
+double masked_mean_array(const CNumPyArray *array, const CNumPyMask *mask)
+{
+    size_t count = count_mask(mask);
+    return count == 0 ? NAN : masked_sum_array(array, mask) / (double)count;
+}
+
+double masked_extreme(const CNumPyArray *array, const CNumPyMask *mask, bool find_max)
+{
+    INSTRUMENT_BEGIN(OP_MASKED_EXTREME, array->size);
+    double extreme = NAN;
+    bool found = false;
+    for (size_t word_index = 0; word_index < mask_word_count(mask->size); ++word_index)
+    {
+        for (uint64_t word = mask->words[word_index]; word != 0; word &= word - 1)
+        {
+            double value = array->data[word_index * 64 + (size_t)lowest_bit_index(word)];
+            if (!found || (find_max ? value > extreme : value < extreme))
+                extreme = value;
+            found = true;
+        }
+    }
+    INSTRUMENT_END();
+    return extreme;
+}
+
+// Largest / smallest selected element; NaN if nothing is selected
+double masked_max_array(const CNumPyArray *array, const CNumPyMask *mask)
+{
+    require_mask_size(array, mask, "masked_max");
+    return masked_extreme(array, mask, true);
+}
+
+double masked_min_array(const CNumPyArray *array, const CNumPyMask *mask)
+{
+    require_mask_size(array, mask, "masked_min");
+    return masked_extreme(array, mask, false);
+}
+
+// -------------------------- Compaction, Take & Put --------------------------
+//
+// Compaction runs in two passes over blocks of the mask: first every block's popcount gives
+// its output offset, then each block copies its selected elements to that offset. Blocks
+// never depend on each other in the second pass, so the output order is the input order
+// however the blocks are scheduled.
+
+#define COMPACT_BLOCK_WORDS 64          // mask words (64 elements each) per compaction block
+#define TAKE_PREFETCH_DISTANCE 16       // how many indices ahead take/put prefetch
+
+void prefetch_address(const void *address)
+{
+#if defined(__GNUC__)
+    __builtin_prefetch(address);
+#else
+    (void)address;
+#endif
+}
+
+// Copy the selected elements of one block of mask words to out, keeping their order
+void compact_block(const double *data, const uint64_t *words, size_t first_word, size_t last_word, double *out)
+{
+    size_t written = 0;
+    for (size_t word_index = first_word; word_index < last_word; ++word_index)
+    {
+        uint64_t word = words[word_index];
+        const double *block = data + word_index * 64;
+        if (word == 0)
+            continue;                                  // nothing selected in these 64
+        if (word == UINT64_MAX)
+        {
+            memcpy(out + written, block, 64 * sizeof(double));
+            written += 64;
+            continue;
+        }
+        for (; word != 0; word &= word - 1)
+            out[written++] = block[lowest_bit_index(word)];
+    }
+}
+
+// Elements of array where the mask is set, in their original order
+CNumPyArray compress_array(const CNumPyArray *array, const CNumPyMask *mask)
+{
+    INSTRUMENT_BEGIN(OP_COMPRESS, array->size);
+    require_mask_size(array, mask, "compress");
+    size_t word_count = mask_word_count(mask->size);
+    size_t block_count = (word_count + COMPACT_BLOCK_WORDS - 1) / COMPACT_BLOCK_WORDS;
+    size_t *offsets = malloc((block_count + 1) * sizeof(size_t));
+    if (offsets == NULL)
+    {
+        fprintf(stderr, "Memory allocation failed.\n");
+        exit(1);
+    }
+    // pass 1: output offset of every block
+    offsets[0] = 0;
+    for (size_t block = 0; block < block_count; ++block)
+    {
+        size_t last_word = (block + 1) * COMPACT_BLOCK_WORDS < word_count ? (block + 1) * COMPACT_BLOCK_WORDS : word_count;
+        size_t selected = 0;
+        for (size_t word_index = block * COMPACT_BLOCK_WORDS; word_index < last_word; ++word_index)
+            selected += (size_t)popcount_word(mask->words[word_index]);
+        offsets[block + 1] = offsets[block] + selected;
+    }
+    // pass 2: independent copies into place
+    CNumPyArray result = create_array(NULL, offsets[block_count]);
+    for (size_t block = 0; block < block_count; ++block)
+    {
+        size_t last_word = (block + 1) * COMPACT_BLOCK_WORDS < word_count ? (block + 1) * COMPACT_BLOCK_WORDS : word_count;
+        compact_block(array->data, mask->words, block * COMPACT_BLOCK_WORDS, last_word, result.data + offsets[block]);
+    }
+    free(offsets);
+    INSTRUMENT_END();
+    return result;
+}
+
+// Write the positions of set bits to out_indices (which needs count_mask(mask) entries); returns the count
+size_t mask_to_indices(const CNumPyMask *mask, size_t *out_indices)
+{
+    size_t written = 0;
+    for (size_t word_index = 0; word_index < mask_word_count(mask->size); ++word_index)
+        for (uint64_t word = mask->words[word_index]; word != 0; word &= word - 1)
+            out_indices[written++] = word_index * 64 + (size_t)lowest_bit_index(word);
+    return written;
+}
+
+void require_indices_in_range(const CNumPyArray *array, const size_t *indices, size_t index_count, const char *message)
+{
+    for (size_t position = 0; position < index_count; ++position)
+    {
+        if (indices[position] >= array->size)
+        {
+            fprintf(stderr, "%s: index %zu out of range (size %zu)\n", message, indices[position], array->size);
+            exit(1);
+        }
+    }
+}
+
+// Gather: result[i] = array[indices[i]]. Random indices are prefetched a few iterations ahead.
+CNumPyArray take_array(const CNumPyArray *array, const size_t *indices, size_t index_count)
+{
+    INSTRUMENT_BEGIN(OP_TAKE, index_count);
+    require_indices_in_range(array, indices, index_count, "take");
+    CNumPyArray result = create_array(NULL, index_count);
+    for (size_t position = 0; position < index_count; ++position)
+    {
+        if (position + TAKE_PREFETCH_DISTANCE < index_count)
+            prefetch_address(&array->data[indices[position + TAKE_PREFETCH_DISTANCE]]);
+        result.data[position] = array->data[indices[position]];
+    }
+    INSTRUMENT_END();
+    return result;
+}
+
+// Scatter in place: array[indices[i]] = values[i]. With repeated indices the last write wins.
+void put_array(CNumPyArray *array, const size_t *indices, size_t index_count, const CNumPyArray *values)
+{
+    INSTRUMENT_BEGIN(OP_PUT, index_count);
+    if (values->size != index_count)
+    {
+        fprintf(stderr, "put: %zu indices but %zu values\n", index_count, values->size);
+        exit(1);
+    }
+    require_indices_in_range(array, indices, index_count, "put");
+    for (size_t position = 0; position < index_count; ++position)
+    {
+        if (position + TAKE_PREFETCH_DISTANCE < index_count)
+            prefetch_address(&array->data[indices[position + TAKE_PREFETCH_DISTANCE]]);
+        array->data[indices[position]] = values->data[position];
+    }
+    INSTRUMENT_END();
+}
+
+// -------------------------- Linear Algebra --------------------------
+
+double dot_array(const CNumPyArray *array1, const CNumPyArray *array2)
+{
+    INSTRUMENT_BEGIN(OP_DOT_ARRAY, array1->size);
+    require_same_size(array1, array2, "dot");
+    double sum = 0.0;
+    for (size_t index = 0; index < array1->size; ++index)
+        sum += array1->data[index] * array2->data[index];
+    INSTRUMENT_END();
+    return sum;
+}
+
+// Compute L2 norm (Euclidean)
+double l2_norm(const CNumPyArray *array)
+{
+    INSTRUMENT_BEGIN(OP_L2_NORM, array->size);
+    double s = 0.0;
+    for (size_t index = 0; index < array->size; ++index)
+        s += array->data[index] * array->data[index];   // accumulate square
+    INSTRUMENT_END();
+    return sqrt(s);
+}
+
+// -------------------------- Accurate Summation Modes --------------------------
+//
+// sum_array, mean_array, variance_array and dot_array add terms one by one into a single
+// double, which is fast but loses digits on long or badly scaled inputs. The *_mode variants
+// let the caller pick the accumulation:
+//   SUMMATION_FAST      the plain loop (same result as the functions above)
+//   SUMMATION_PAIRWISE  NumPy's method: 8 running sums per 128-element block, blocks added as a
+//                       binary tree; error grows with log(n) instead of n, at almost no cost
+//   SUMMATION_NEUMAIER  Kahan-Babuska-Neumaier compensation in 4 independent lanes; error about
+//                       one rounding, independent of n
+//   SUMMATION_EXACT     a fixed-point superaccumulator covering the whole double range; the
+//                       sum is exact and rounded once at the end. For dot_array each product
+//                       is also split exactly with fma, so the dot product is correctly rounded.
+// Terms are produced in blocks of 128 into a small buffer, and each mode works on that buffer.
+// Infinities, NaN and overflowing products follow the usual IEEE rules in every mode.
+
+#define SUMMATION_BLOCK 128             // terms per block (NumPy's pairwise block size)
+#define NEUMAIER_LANES 4                // independent compensated sums
+#define SUPERACCUMULATOR_CHUNKS 68      // 32-bit digits covering 2^-1074 .. 2^1102
+#define SUPERACCUMULATOR_FLUSH 1048576  // carries are propagated after this many additions
+
+typedef enum { SUMMATION_FAST, SUMMATION_PAIRWISE, SUMMATION_NEUMAIER, SUMMATION_EXACT } SummationMode;
+
+// What is being summed: values, products of two arrays, or squared deviations from center
+typedef enum { TERMS_VALUES, TERMS_PRODUCTS, TERMS_SQUARED_DEVIATIONS } TermKind;
+
+typedef struct {
+    TermKind kind;
+    const double *first;
+    const double *second;   // used by TERMS_PRODUCTS
+    double center;          // used by TERMS_SQUARED_DEVIATIONS
+} SumTerms;
+
+// Write terms [start, start + count) into buffer (count <= SUMMATION_BLOCK)
+void fill_terms(const SumTerms *terms, size_t start, size_t count, double *buffer)
+{
+    const double *first = terms->first + start;
+    switch (terms->kind)
+    {
+    case TERMS_VALUES:
+        memcpy(buffer, first, count * sizeof(double));
+        break;
+    case TERMS_PRODUCTS:
+        for (size_t index = 0; index < count; ++index)
+            buffer[index] = first[index] * terms->second[start + index];
+        break;
+    case TERMS_SQUARED_DEVIATIONS:
+        for (size_t index = 0; index < count; ++index)
+            buffer[index] = (first[index] - terms->center) * (first[index] - terms->center);
+        break;
+    }
+}
+
+double fast_sum(const SumTerms *terms, size_t count)
+{
+    double buffer[SUMMATION_BLOCK];
+    double sum = 0.0;
+    for (size_t start = 0; start < count; start += SUMMATION_BLOCK)
+    {
+        size_t block = count - start < SUMMATION_BLOCK ? count - start : SUMMATION_BLOCK;
+        fill_terms(terms, start, block, buffer);
+        for (size_t index = 0; index < block; ++index)
+            sum += buffer[index];
+    }
+    return sum;
+}
+
+double pairwise_sum(const SumTerms *terms, size_t start, size_t count)
+{
+    if (count > SUMMATION_BLOCK)
+    {
+        size_t half = count / 2;
+        half -= half % 8;                              // keep blocks aligned to the 8 lanes
+        return pairwise_sum(terms, start, half) + pairwise_sum(terms, start + half, count - half);
+    }
+    double buffer[SUMMATION_BLOCK];
+    fill_terms(terms, start, count, buffer);
+    if (count < 8)
+    {
+        double sum = 0.0;
+        for (size_t index = 0; index < count; ++index)
+            sum += buffer[index];
+        return sum;
+    }
+    double lanes[8];
+    for (size_t lane = 0; lane < 8; ++lane)
+        lanes[lane] = buffer[lane];
+    size_t index = 8;
+    for (; index + 8 <= count; index += 8)
+        for (size_t lane = 0; lane < 8; ++lane)
+            lanes[lane] += buffer[index + lane];
+    double sum = ((lanes[0] + lanes[1]) + (lanes[2] + lanes[3])) + ((lanes[4] + lanes[5]) + (lanes[6] + lanes[7]));
+    for (; index < count; ++index)
+        sum += buffer[index];
+    return sum;
+}
+
+double neumaier_sum(const SumTerms *terms, size_t count)
+{
+    double buffer[SUMMATION_BLOCK];
+    double sums[NEUMAIER_LANES] = {0.0}, compensations[NEUMAIER_LANES] = {0.0};
+    for (size_t start = 0; start < count; start += SUMMATION_BLOCK)
+    {
+        size_t block = count - start < SUMMATION_BLOCK ? count - start : SUMMATION_BLOCK;
+        fill_terms(terms, start, block, buffer);
+        size_t index = 0;
+        for (; index + NEUMAIER_LANES <= block; index += NEUMAIER_LANES)
+        {
+            for (size_t lane = 0; lane < NEUMAIER_LANES; ++lane)
+            {
+                // branch-free Neumaier step so the lanes vectorize
+                double value = buffer[index + lane];
+                double total = sums[lane] + value;
+                bool sum_larger = fabs(sums[lane]) >= fabs(value);
+                compensations[lane] += sum_larger ? (sums[lane] - total) + value : (value - total) + sums[lane];
+                sums[lane] = total;
+            }
+        }
+        for (; index < block; ++index)
+            compensated_add(&sums[0], &compensations[0], buffer[index]);
+    }
+    double sum = 0.0, compensation = 0.0;
+    for (size_t lane = 0; lane < NEUMAIER_LANES; ++lane)
+    {
+        compensated_add(&sum, &compensation, sums[lane]);
+        compensated_add(&sum, &compensation, compensations[lane]);
+    }
+    return sum + compensation;
+}
+
+// Superaccumulator: the sum as a big fixed-point number in base 2^32, where chunk i holds
+// the digit worth 2^(32 i - 1074). Chunks are int64, so digits may run ahead of their carries
+// for up to SUPERACCUMULATOR_FLUSH additions before the carries must be propagated.
+typedef struct {
+    int64_t chunks[SUPERACCUMULATOR_CHUNKS];
+    size_t pending;         // additions since the last carry propagation
+    double special;         // running sum of infinities and NaNs, which have no fixed-point form
+    bool has_special;
+} Superaccumulator;
+
+void propagate_carries(Superaccumulator *accumulator)
+{
+    for (size_t index = 0; index + 1 < SUPERACCUMULATOR_CHUNKS; ++index)
+    {
+        int64_t low = (int64_t)((uint64_t)accumulator->chunks[index] & 0xFFFFFFFFu);
+        accumulator->chunks[index + 1] += (accumulator->chunks[index] - low) / 4294967296LL;
+        accumulator->chunks[index] = low;
+    }
+    accumulator->pending = 0;
+}
+
+void superaccumulator_add(Superaccumulator *accumulator, double value)
+{
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    int exponent_field = (int)((bits >> 52) & 0x7FF);
+    if (exponent_field == 0x7FF)
+    {
+        accumulator->special += value;                 // inf or NaN
+        accumulator->has_special = true;
+        return;
+    }
+    uint64_t mantissa = bits & 0xFFFFFFFFFFFFFULL;
+    if (exponent_field != 0)
+        mantissa |= 1ULL << 52;                        // implicit leading bit of normal numbers
+    else
+        exponent_field = 1;                            // subnormals share the smallest exponent
+    if (mantissa == 0)
+        return;
+    // value = mantissa * 2^(position - 1074), spread over three 32-bit digits
+    size_t position = (size_t)(exponent_field - 1);
+    size_t chunk = position / 32;
+    unsigned int offset = (unsigned int)(position % 32);
+    uint64_t low_part = (mantissa & 0xFFFFFFFFu) << offset;
+    uint64_t high_part = (mantissa >> 32) << offset;
+    int64_t digit0 = (int64_t)(low_part & 0xFFFFFFFFu);
+    int64_t digit1 = (int64_t)((low_part >> 32) + (high_part & 0xFFFFFFFFu));
+    int64_t digit2 = (int64_t)(high_part >> 32);
+    if (bits >> 63)
+    {
+        digit0 = -digit0;
+        digit1 = -digit1;
+        digit2 = -digit2;
+    }
+    accumulator->chunks[chunk] += digit0;
+    accumulator->chunks[chunk + 1] += digit1;
+    accumulator->chunks[chunk + 2] += digit2;
+    if (++accumulator->pending == SUPERACCUMULATOR_FLUSH)
+        propagate_carries(accumulator);
+}
+
+int leading_zeros32(uint32_t word)                     // word must not be zero
+{
+    int count = 0;
+    while (!(word & 0x80000000u))
+    {
+        word <<= 1;
+        count++;
+    }
+    return count;
+}
+
+// Round the accumulated value to the nearest double (ties to even)
+double superaccumulator_result(Superaccumulator *accumulator)
+{
+    if (accumulator->has_special)
+        return accumulator->special;
+    propagate_carries(accumulator);
+    double sign = 1.0;
+    if (accumulator->chunks[SUPERACCUMULATOR_CHUNKS - 1] < 0)
+    {
+        sign = -1.0;                                   // work on the magnitude
+        for (size_t index = 0; index < SUPERACCUMULATOR_CHUNKS; ++index)
+            accumulator->chunks[index] = -accumulator->chunks[index];
+        propagate_carries(accumulator);
+    }
+    int highest = SUPERACCUMULATOR_CHUNKS - 1;
+    while (highest >= 0 && accumulator->chunks[highest] == 0)
+        highest--;
+    if (highest < 0)
+        return 0.0;
+    if (highest <= 1)
+    {
+        // below 2^-1010 the value fits in 64 bits: one conversion rounds it, and the scaling is exact
+        uint64_t value = (uint64_t)accumulator->chunks[0] | ((uint64_t)accumulator->chunks[1] << 32);
+        return sign * ldexp((double)value, -1074);
+    }
+    if (accumulator->chunks[highest] > 0xFFFFFFFFLL)
+        return sign * INFINITY;                        // far beyond the largest double
+    // take the top 64 significant bits; everything below only matters as a "sticky" bit
+    uint32_t high = (uint32_t)accumulator->chunks[highest];
+    uint32_t middle = (uint32_t)accumulator->chunks[highest - 1];
+    uint32_t low = (uint32_t)accumulator->chunks[highest - 2];
+    int shift = leading_zeros32(high);
+    uint64_t top = ((uint64_t)high << (32 + shift)) | ((uint64_t)middle << shift);
+    if (shift > 0)
+        top |= (uint64_t)low >> (32 - shift);
+    bool sticky = ((uint32_t)((uint64_t)low << shift)) != 0;
+    for (int index = highest - 3; index >= 0 && !sticky; --index)
+        sticky = accumulator->chunks[index] != 0;
+    // keep 53 of the 64 bits, rounding to nearest even
+    uint64_t mantissa = top >> 11;
+    uint64_t remainder = top & 0x7FF;
+    if (remainder > 0x400 || (remainder == 0x400 && (sticky || (mantissa & 1))))
+        mantissa++;
+    int exponent = 11 + 32 - shift + (highest - 2) * 32 - 1074;
+    return sign * ldexp((double)mantissa, exponent);
+}
+
+double exact_sum(const SumTerms *terms, size_t count)
+{
+    Superaccumulator accumulator;
+    memset(&accumulator, 0, sizeof(accumulator));
+    double buffer[SUMMATION_BLOCK];
+    for (size_t start = 0; start < count; start += SUMMATION_BLOCK)
+    {
+        size_t block = count - start < SUMMATION_BLOCK ? count - start : SUMMATION_BLOCK;
+        fill_terms(terms, start, block, buffer);
+        for (size_t index = 0; index < block; ++index)
+            superaccumulator_add(&accumulator, buffer[index]);
+        if (terms->kind == TERMS_PRODUCTS)
+        {
+            // add the rounding error of each product, which fma recovers exactly
+            for (size_t index = 0; index < block; ++index)
+            {
+                double error = fma(terms->first[start + index], terms->second[start + index], -buffer[index]);
+                if (isfinite(error))
+                    superaccumulator_add(&accumulator, error);
+            }
+        }
+    }
+    return superaccumulator_result(&accumulator);
+}
+
+double accumulate_terms(const SumTerms *terms, size_t count, SummationMode mode)
+{
+    INSTRUMENT_BEGIN(OP_SUMMATION_MODE, count);
+    double sum;
+    switch (mode)
+    {
+    case SUMMATION_PAIRWISE: sum = pairwise_sum(terms, 0, count); break;
+    case SUMMATION_NEUMAIER: sum = neumaier_sum(terms, count); break;
+    case SUMMATION_EXACT:    sum = exact_sum(terms, count); break;
+    case SUMMATION_FAST:
+    default:                 sum = fast_sum(terms, count); break;
+    }
+    INSTRUMENT_END();
+    return sum;
+}
+
+double sum_array_mode(const CNumPyArray *array, SummationMode mode)
+{
+    SumTerms terms = {TERMS_VALUES, array->data, NULL, 0.0};
+    return accumulate_terms(&terms, array->size, mode);
+}
+
+double mean_array_mode(const CNumPyArray *array, SummationMode mode)
+{
+    return sum_array_mode(array, mode) / array->size;
+}
+
+// Two-pass population variance; both passes use the chosen mode
+double variance_array_mode(const CNumPyArray *array, SummationMode mode)
+{
+    SumTerms terms = {TERMS_SQUARED_DEVIATIONS, array->data, NULL, mean_array_mode(array, mode)};
+    return accumulate_terms(&terms, array->size, mode) / array->size;
+}
+
+double dot_array_mode(const CNumPyArray *array1, const CNumPyArray *array2, SummationMode mode)
+{
+    require_same_size(array1, array2, "dot");
+    SumTerms terms = {TERMS_PRODUCTS, array1->data, array2->data, 0.0};
+    return accumulate_terms(&terms, array1->size, mode);
+}
+
+// -------------------------- Random Number Generation --------------------------
+//
+// RandomGenerator fills arrays directly, without rand() and its global lock. Two algorithms:
+//   RANDOM_PHILOX   Philox4x32-10, a counter-based generator: the random bits of element i are
+//                   a pure function of (seed, i). random_skip(generator, n) jumps to element n
+//                   in O(1), so an array filled in chunks (for example one chunk per thread,
+//                   each with its own copy skipped to its offset) is identical to a single fill.
+//   RANDOM_XOSHIRO  xoshiro256++, a fast sequential generator run as 4 interleaved lanes whose
+//                   states are 2^128 steps apart. random_jump gives a copy a stream that never
+//                   overlaps the original, which is how independent threads are seeded.
+//                   random_skip works too, but costs one lane step per skipped element.
+// Distributions: uniform, normal (Doornik's 128-level ziggurat), exponential and integers.
+// Element i of a fill takes its first 64 random bits from a batch generated in one tight loop;
+// the rare rejected draws ask for more bits for that same element from a counter-based
+// substream keyed by (element, attempt): a Philox block, or for xoshiro a SplitMix64 hash
+// of a seeded retry key. Retries never consume the main stream, so with either algorithm the
+// results do not depend on how the fill was split into calls or chunks.
+
+#define XOSHIRO_LANES 4                 // interleaved xoshiro states
+#define RANDOM_BLOCK 256                // elements whose first random words are made at once
+#define ZIGGURAT_LEVELS 128
+#define ZIGGURAT_R 3.442619855899       // start of the normal tail
+#define ZIGGURAT_V 9.91256303526217e-3  // area of each ziggurat level
+
+typedef enum { RANDOM_PHILOX, RANDOM_XOSHIRO } RandomAlgorithm;
+
+typedef struct {
+    RandomAlgorithm algorithm;
+    uint64_t position;                      // index of the next element to generate
+    uint32_t key[2];                        // Philox key
+    uint64_t state[4][XOSHIRO_LANES];       // xoshiro state word k of each lane
+    uint64_t retry_key;                     // xoshiro retry substream key
+} RandomGenerator;
+
+// SplitMix64, used to turn a seed into well-mixed key and state words
+uint64_t splitmix64(uint64_t *seed)
+{
+    uint64_t z = (*seed += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+uint64_t rotate_left(uint64_t value, int shift)
+{
+    return (value << shift) | (value >> (64 - shift));
+}
+
+// Philox4x32-10 block function: 4 counter words and 2 key words in, 4 random words out
+void philox_block(const uint32_t counter_in[4], const uint32_t key_in[2], uint32_t out[4])
+{
+    uint32_t c0 = counter_in[0], c1 = counter_in[1], c2 = counter_in[2], c3 = counter_in[3];
+    uint32_t k0 = key_in[0], k1 = key_in[1];
+    for (int round = 0; round < 10; ++round)
+    {
+        uint64_t product0 = (uint64_t)0xD2511F53u * c0;
+        uint64_t product1 = (uint64_t)0xCD9E8D57u * c2;
+        uint32_t next0 = (uint32_t)(product1 >> 32) ^ c1 ^ k0;
+        uint32_t next2 = (uint32_t)(product0 >> 32) ^ c3 ^ k1;
+        c1 = (uint32_t)product1;
+        c3 = (uint32_t)product0;
+        c0 = next0;
+        c2 = next2;
+        k0 += 0x9E3779B9u;                             // Weyl sequence key schedule
+        k1 += 0xBB67AE85u;
+    }
+    out[0] = c0; out[1] = c1; out[2] = c2; out[3] = c3;
+}
+
+// Philox words for element: attempt 0 shares one block between two neighbouring elements,
+// later attempts (rejection retries) get a block of their own
+uint64_t philox_word(const RandomGenerator *generator, uint64_t element, uint32_t attempt)
+{
+    uint64_t block_index = attempt == 0 ? element / 2 : element;
+    uint32_t counter[4] = {(uint32_t)block_index, (uint32_t)(block_index >> 32), attempt, 0};
+    uint32_t out[4];
+    philox_block(counter, generator->key, out);
+    size_t half = attempt == 0 ? (size_t)(element % 2) : 0;
+    return (uint64_t)out[2 * half] | ((uint64_t)out[2 * half + 1] << 32);
+}
+
+// Advance one xoshiro256++ lane and return its output
+uint64_t xoshiro_next(RandomGenerator *generator, size_t lane)
+{
+    uint64_t (*s)[XOSHIRO_LANES] = generator->state;
+    uint64_t result = rotate_left(s[0][lane] + s[3][lane], 23) + s[0][lane];
+    uint64_t shifted = s[1][lane] << 17;
+    s[2][lane] ^= s[0][lane];
+    s[3][lane] ^= s[1][lane];
+    s[1][lane] ^= s[2][lane];
+    s[0][lane] ^= s[3][lane];
+    s[2][lane] ^= shifted;
+    s[3][lane] = rotate_left(s[3][lane], 45);
+    return result;
+}
+
+// Advance one lane by 2^128 steps (the reference xoshiro256 jump polynomial)
+void xoshiro_jump_lane(RandomGenerator *generator, size_t lane)
+{
+    static const uint64_t jump[4] = {0x180EC6D33CFD0ABAULL, 0xD5A61266F0C9392CULL, 0xA9582618E03FC9AAULL, 0x39ABDC4529B1661CULL};
+    uint64_t jumped[4] = {0, 0, 0, 0};
+    for (int word = 0; word < 4; ++word)
+    {
+        for (int bit = 0; bit < 64; ++bit)
+        {
+            if (jump[word] & (1ULL << bit))
+                for (int k = 0; k < 4; ++k)
+                    jumped[k] ^= generator->state[k][lane];
+            xoshiro_next(generator, lane);
+        }
+    }
+    for (int k = 0; k < 4; ++k)
+        generator->state[k][lane] = jumped[k];
+}
+
+RandomGenerator create_random_generator(uint64_t seed, RandomAlgorithm algorithm)
+{
+    RandomGenerator generator;
+    memset(&generator, 0, sizeof(generator));
+    generator.algorithm = algorithm;
+    uint64_t mixed = splitmix64(&seed);
+    generator.key[0] = (uint32_t)mixed;
+    generator.key[1] = (uint32_t)(mixed >> 32);
+    generator.retry_key = splitmix64(&seed);
+    for (int k = 0; k < 4; ++k)
+        generator.state[k][0] = splitmix64(&seed);
+    for (size_t lane = 1; lane < XOSHIRO_LANES; ++lane)
+    {
+        for (int k = 0; k < 4; ++k)
+            generator.state[k][lane] = generator.state[k][lane - 1];
+        xoshiro_jump_lane(&generator, lane);           // each lane starts 2^128 after the previous
+    }
+    return generator;
+}
+
+// Move to element position + count: O(1) for Philox, one lane step per element for xoshiro.
+// Either way the following fills continue exactly as an unsplit fill would.
+void random_skip(RandomGenerator *generator, uint64_t count)
+{
+    if (generator->algorithm == RANDOM_PHILOX)
+    {
+        generator->position += count;
+        return;
+    }
+    for (uint64_t step = 0; step < count; ++step)
+        xoshiro_next(generator, (size_t)((generator->position + step) % XOSHIRO_LANES));
+    generator->position += count;
+}
+
+// Move to a stream that never overlaps the current one (give each thread a jumped copy)
+void random_jump(RandomGenerator *generator)
+{
+    if (generator->algorithm == RANDOM_PHILOX)
+    {
+        generator->key[1] ^= 0x80000000u;              // a different key is a different stream
+        generator->key[0] += 1;
+        return;
+    }
+    for (size_t lane = 0; lane < XOSHIRO_LANES; ++lane)
+        for (size_t step = 0; step < XOSHIRO_LANES; ++step)
+            xoshiro_jump_lane(generator, lane);        // past every lane's current range
+    generator->retry_key = splitmix64(&generator->retry_key);
+}
+
+// First 64 random bits of elements [position, position + count), made in one batch
+void random_first_words(RandomGenerator *generator, size_t count, uint64_t *out)
+{
+    uint64_t first = generator->position;
+    if (generator->algorithm == RANDOM_PHILOX)
+    {
+        size_t index = 0;
+        if (first % 2 == 1 && count > 0)
+            out[index++] = philox_word(generator, first, 0);   // second half of a shared block
+        for (; index + 2 <= count; index += 2)
+        {
+            uint64_t block_index = (first + index) / 2;
+            uint32_t counter[4] = {(uint32_t)block_index, (uint32_t)(block_index >> 32), 0, 0};
+            uint32_t words[4];
+            philox_block(counter, generator->key, words);
+            out[index] = (uint64_t)words[0] | ((uint64_t)words[1] << 32);
+            out[index + 1] = (uint64_t)words[2] | ((uint64_t)words[3] << 32);
+        }
+        if (index < count)
+            out[index] = philox_word(generator, first + index, 0);
+    }
+    else
+    {
+        size_t index = 0;
+        for (; index < count && (first + index) % XOSHIRO_LANES != 0; ++index)
+            out[index] = xoshiro_next(generator, (size_t)((first + index) % XOSHIRO_LANES));
+        // whole groups: step all lanes together on local copies, a loop the compiler vectorizes
+        uint64_t s0[XOSHIRO_LANES], s1[XOSHIRO_LANES], s2[XOSHIRO_LANES], s3[XOSHIRO_LANES];
+        memcpy(s0, generator->state[0], sizeof(s0));
+        memcpy(s1, generator->state[1], sizeof(s1));
+        memcpy(s2, generator->state[2], sizeof(s2));
+        memcpy(s3, generator->state[3], sizeof(s3));
+        for (; index + XOSHIRO_LANES <= count; index += XOSHIRO_LANES)
+        {
+            for (size_t lane = 0; lane < XOSHIRO_LANES; ++lane)
+            {
+                out[index + lane] = rotate_left(s0[lane] + s3[lane], 23) + s0[lane];
+                uint64_t shifted = s1[lane] << 17;
+                s2[lane] ^= s0[lane];
+                s3[lane] ^= s1[lane];
+                s1[lane] ^= s2[lane];
+                s0[lane] ^= s3[lane];
+                s2[lane] ^= shifted;
+                s3[lane] = rotate_left(s3[lane], 45);
+            }
+        }
+        memcpy(generator->state[0], s0, sizeof(s0));
+        memcpy(generator->state[1], s1, sizeof(s1));
+        memcpy(generator->state[2], s2, sizeof(s2));
+        memcpy(generator->state[3], s3, sizeof(s3));
+        for (; index < count; ++index)
+            out[index] = xoshiro_next(generator, (size_t)((first + index) % XOSHIRO_LANES));
+    }
+}
+
+// Extra random bits for one element after its first word was rejected: a pure function of
+// (element, attempt), so it does not matter which call or chunk generated the element
+uint64_t random_retry_word(const RandomGenerator *generator, uint64_t element, uint32_t attempt)
+{
+    if (generator->algorithm == RANDOM_PHILOX)
+        return philox_word(generator, element, attempt);
+    uint64_t counter = generator->retry_key ^ (element * 0xD1B54A32D192ED03ULL);
+    counter += (uint64_t)attempt * 0x9E3779B97F4A7C15ULL;
+    return splitmix64(&counter);
+}
+
+// 53 random bits as a double in [0, 1)
+double word_to_unit(uint64_t word)
+{
+    return (double)(word >> 11) * 0x1.0p-53;
+}
+
+typedef enum { DISTRIBUTION_UNIFORM, DISTRIBUTION_NORMAL, DISTRIBUTION_EXPONENTIAL, DISTRIBUTION_INTEGER } Distribution;
+
+double ziggurat_x[ZIGGURAT_LEVELS + 1];
+double ziggurat_ratio[ZIGGURAT_LEVELS];
+atomic_bool ziggurat_ready = false;
+atomic_flag ziggurat_lock = ATOMIC_FLAG_INIT;
+
+// Build the tables once; threads filling their own chunks may race to be first, so the loser
+// waits on the lock and the release store publishes the finished tables to every reader.
+void build_ziggurat_tables(void)
+{
+    if (atomic_load_explicit(&ziggurat_ready, memory_order_acquire))
+        return;
+    while (atomic_flag_test_and_set_explicit(&ziggurat_lock, memory_order_acquire))
+        ;
+    if (atomic_load_explicit(&ziggurat_ready, memory_order_relaxed))
+    {
+        atomic_flag_clear_explicit(&ziggurat_lock, memory_order_release);
+        return;
+    }
+    double f = exp(-0.5 * ZIGGURAT_R * ZIGGURAT_R);
+    ziggurat_x[0] = ZIGGURAT_V / f;                    // base strip, includes the tail area
+    ziggurat_x[1] = ZIGGURAT_R;
+    ziggurat_x[ZIGGURAT_LEVELS] = 0.0;
+    for (int level = 2; level < ZIGGURAT_LEVELS; ++level)
+    {
+        ziggurat_x[level] = sqrt(-2.0 * log(ZIGGURAT_V / ziggurat_x[level - 1] + f));
+        f = exp(-0.5 * ziggurat_x[level] * ziggurat_x[level]);
+    }
+    for (int level = 0; level < ZIGGURAT_LEVELS; ++level)
+        ziggurat_ratio[level] = ziggurat_x[level + 1] / ziggurat_x[level];
+    atomic_store_explicit(&ziggurat_ready, true, memory_order_release);
+    atomic_flag_clear_explicit(&ziggurat_lock, memory_order_release);
+}
+
+// Standard normal from the element's first word, drawing retries only when the fast test fails
+double ziggurat_normal(RandomGenerator *generator, uint64_t element, uint64_t word)
+{
+    uint32_t attempt = 0;
+    for (;;)
+    {
+        double u = 2.0 * word_to_unit(word) - 1.0;
+        int level = (int)(word & (ZIGGURAT_LEVELS - 1)); // low bits, not used by u
+        if (fabs(u) < ziggurat_ratio[level])
+            return u * ziggurat_x[level];              // inside the rectangle: about 98% of draws
+        if (level == 0)
+        {
+            // tail beyond R (Marsaglia's method)
+            double x, y;
+            do
+            {
+                x = log(1.0 - word_to_unit(random_retry_word(generator, element, ++attempt))) / ZIGGURAT_R;
+                y = log(1.0 - word_to_unit(random_retry_word(generator, element, ++attempt)));
+            } while (-2.0 * y < x * x);
+            return u < 0.0 ? x - ZIGGURAT_R : ZIGGURAT_R - x;
+        }
+        double x = u * ziggurat_x[level];
+        double f0 = exp(-0.5 * (ziggurat_x[level] * ziggurat_x[level] - x * x));
+        double f1 = exp(-0.5 * (ziggurat_x[level + 1] * ziggurat_x[level + 1] - x * x));
+        if (f1 + word_to_unit(random_retry_word(generator, element, ++attempt)) * (f0 - f1) < 1.0)
+            return x;                                  // inside the wedge under the curve
+        word = random_retry_word(generator, element, ++attempt);
+    }
+}
+
+// Fill out with the distribution. Parameters: uniform [a, b), normal (mean a, std b),
+// exponential (scale a), integer [a, b) with range = b - a.
+void random_fill(RandomGenerator *generator, CNumPyArray *out, Distribution distribution, double a, double b, uint64_t range)
+{
+    INSTRUMENT_BEGIN(OP_RANDOM_FILL, out->size);
+    uint64_t words[RANDOM_BLOCK];
+    if (distribution == DISTRIBUTION_NORMAL)
+        build_ziggurat_tables();
+    // 2^64 mod range: integer words below this are rejected to avoid modulo bias
+    uint64_t threshold = range == 0 ? 0 : (0 - range) % range;
+    for (size_t start = 0; start < out->size; start += RANDOM_BLOCK)
+    {
+        size_t count = out->size - start < RANDOM_BLOCK ? out->size - start : RANDOM_BLOCK;
+        uint64_t first_element = generator->position;
+        random_first_words(generator, count, words);
+        double *target = out->data + start;
+        switch (distribution)
+        {
+        case DISTRIBUTION_UNIFORM:
+            for (size_t index = 0; index < count; ++index)
+                target[index] = a + (b - a) * word_to_unit(words[index]);
+            break;
+        case DISTRIBUTION_EXPONENTIAL:
+            for (size_t index = 0; index < count; ++index)
+                target[index] = -a * log(1.0 - word_to_unit(words[index]));
+            break;
+        case DISTRIBUTION_NORMAL:
+            for (size_t index = 0; index < count; ++index)
+                target[index] = a + b * ziggurat_normal(generator, first_element + index, words[index]);
+            break;
+        case DISTRIBUTION_INTEGER:
+            for (size_t index = 0; index < count; ++index)
+            {
+                uint64_t word = words[index];
+                for (uint32_t attempt = 1; word < threshold; ++attempt)
+                    word = random_retry_word(generator, first_element + index, attempt);
+                target[index] = a + (double)(word % range);
+            }
+            break;
+        }
+        generator->position = first_element + count;
+    }
+    INSTRUMENT_END();
+}
+
+CNumPyArray random_uniform_array(RandomGenerator *generator, size_t array_size, double low, double high)
+{
+    CNumPyArray result = create_array(NULL, array_size);
+    random_fill(generator, &result, DISTRIBUTION_UNIFORM, low, high, 0);
+    return result;
+}
+
+CNumPyArray random_normal_array(RandomGenerator *generator, size_t array_size, double mean, double std)
+{
+    CNumPyArray result = create_array(NULL, array_size);
+    random_fill(generator, &result, DISTRIBUTION_NORMAL, mean, std, 0);
+    return result;
+}
+
+CNumPyArray random_exponential_array(RandomGenerator *generator, size_t array_size, double scale)
+{
+    CNumPyArray result = create_array(NULL, array_size);
+    random_fill(generator, &result, DISTRIBUTION_EXPONENTIAL, scale, 0.0, 0);
+    return result;
+}
+
+// Uniform integers in [low, high), stored as doubles (exact while |value| <= 2^53)
+CNumPyArray random_integers_array(RandomGenerator *generator, size_t array_size, int64_t low, int64_t high)
+{
+    if (high <= low)
+    {
+        fprintf(stderr, "random_integers: need low < high (got %lld, %lld)\n", (long long)low, (long long)high);
+        exit(1);
+    }
+    CNumPyArray result = create_array(NULL, array_size);
+    random_fill(generator, &result, DISTRIBUTION_INTEGER, (double)low, (double)high, (uint64_t)high - (uint64_t)low);
+    return result;
+}
+
+// -------------------------- Fast Fourier Transform --------------------------
+//
+// Complex arrays are stored split, as one CNumPyArray of real parts and one of imaginary parts,
+// so every butterfly loop below reads and writes unit-stride double arrays the compiler can
+// vectorize. Conventions follow numpy.fft: the forward transform is unscaled
+// (X[k] = sum x[j] * exp(-2*pi*i*j*k/n)) and the inverse divides by n.
+//   Lengths whose prime factors are all 2, 3 and 5 run a Stockham autosort FFT: one pass per
+//   radix-4/2/3/5 factor, ping-ponging between the data and one scratch buffer, with the
+//   twiddle factors of every pass precomputed in the plan.
+//   Other lengths use Bluestein's algorithm: the DFT is rewritten as a convolution with a chirp
+//   and evaluated with a 2/3/5-smooth FFT of length >= 2n-1, so any n costs O(n log n).
+//   rfft of an even length n packs the input into n/2 complex values, runs a half-length FFT
+//   and untangles the result; irfft runs the same steps backwards.
+// Plans (factorization, twiddles, Bluestein chirp) are kept in a small most-recently-used
+// cache, so repeated transforms of one length pay the setup once. The cache is not
+// thread-safe; fft_clear_plan_cache frees it.
+
+#define FFT_MAX_STAGES 64               // a length below 2^64 has at most 64 prime factors
+#define FFT_PLAN_CACHE_SIZE 8           // plans kept for reuse
+
+typedef struct {
+    CNumPyArray real;
+    CNumPyArray imag;
+} CNumPyComplexArray;
+
+// Complex array from separate real and imaginary parts; either may be NULL for zeros
+CNumPyComplexArray create_complex_array(const double *real, const double *imag, size_t size)
+{
+    CNumPyComplexArray array;
+    array.real = create_array(real, size);
+    array.imag = create_array(imag, size);
+    return array;
+}
+
+void free_complex_array(CNumPyComplexArray *array)
+{
+    free_array(&array->real);
+    free_array(&array->imag);
+}
+
+typedef struct FFTPlan {
+    size_t size;
+    size_t stage_count;
+    size_t radices[FFT_MAX_STAGES];
+    double *twiddle_real;               // per pass: exp(-2*pi*i*p*k/length) for k = 1..radix-1
+    double *twiddle_imag;
+    struct FFTPlan *convolution_plan;   // Bluestein only: plan of the convolution length
+    double *chirp_real;                 // Bluestein only: exp(-i*pi*k^2/size)
+    double *chirp_imag;
+    double *filter_real;                // Bluestein only: FFT of the conjugate chirp
+    double *filter_imag;
+    double *half_twiddle_real;          // real transforms of length 2*size: exp(-i*pi*k/size)
+    double *half_twiddle_imag;
+} FFTPlan;
+
+// exp(-2*pi*i*numerator/denominator), with numerator reduced first to keep the angle accurate
+void unit_root(size_t numerator, size_t denominator, double *real, double *imag)
+{
+    double angle = -2.0 * M_PI * (double)(numerator % denominator) / (double)denominator;
+    *real = cos(angle);
+    *imag = sin(angle);
+}
+
+// True if n has no prime factor other than 2, 3 and 5
+bool is_fft_smooth(size_t n)
+{
+    if (n == 0)
+        return false;
+    while (n % 2 == 0) n /= 2;
+    while (n % 3 == 0) n /= 3;
+    while (n % 5 == 0) n /= 5;
+    return n == 1;
+}
+
+// Smallest length >= n that the mixed-radix FFT handles directly (useful for zero padding)
+size_t next_fast_fft_size(size_t n)
+{
+    if (n <= 1)
+        return 1;
+    while (!is_fft_smooth(n))
+        ++n;
+    return n;
+}
+
+FFTPlan *create_fft_plan(size_t size);
+void fft_execute(const FFTPlan *plan, double *real, double *imag);
+void fft_execute_inverse(const FFTPlan *plan, double *real, double *imag);
+
+void free_fft_plan(FFTPlan *plan)
+{
+    if (plan == NULL)
+        return;
+    free(plan->twiddle_real);
+    free(plan->twiddle_imag);
+    free_fft_plan(plan->convolution_plan);
+    free(plan->chirp_real);
+    free(plan->chirp_imag);
+    free(plan->filter_real);
+    free(plan->filter_imag);
+    free(plan->half_twiddle_real);
+    free(plan->half_twiddle_imag);
+    free(plan);
+}
+
+// Bluestein setup: chirp of length size, and the FFT of its conjugate laid out circularly
+void prepare_bluestein(FFTPlan *plan)
+{
+    size_t size = plan->size;
+    size_t length = next_fast_fft_size(2 * size - 1);
+    plan->convolution_plan = create_fft_plan(length);
+    plan->chirp_real = allocate_or_exit(size * sizeof(double), false);
+    plan->chirp_imag = allocate_or_exit(size * sizeof(double), false);
+    plan->filter_real = allocate_or_exit(length * sizeof(double), true);
+    plan->filter_imag = allocate_or_exit(length * sizeof(double), true);
+    size_t square = 0;                          // k^2 mod 2*size, updated incrementally
+    for (size_t k = 0; k < size; ++k)
+    {
+        unit_root(square, 2 * size, &plan->chirp_real[k], &plan->chirp_imag[k]);
+        plan->filter_real[k] = plan->chirp_real[k];
+        plan->filter_imag[k] = -plan->chirp_imag[k];
+        if (k > 0)
+        {
+            plan->filter_real[length - k] = plan->chirp_real[k];
+            plan->filter_imag[length - k] = -plan->chirp_imag[k];
+        }
+        square = (square + 2 * k + 1) % (2 * size);
+    }
+    fft_execute(plan->convolution_plan, plan->filter_real, plan->filter_imag);
+}
+
+FFTPlan *create_fft_plan(size_t size)
+{
+    FFTPlan *plan = allocate_or_exit(sizeof(FFTPlan), true);
+    plan->size = size;
+    size_t remaining = size;
+    while (remaining % 4 == 0) { plan->radices[plan->stage_count++] = 4; remaining /= 4; }
+    while (remaining % 2 == 0) { plan->radices[plan->stage_count++] = 2; remaining /= 2; }
+    while (remaining % 3 == 0) { plan->radices[plan->stage_count++] = 3; remaining /= 3; }
+    while (remaining % 5 == 0) { plan->radices[plan->stage_count++] = 5; remaining /= 5; }
+    if (remaining > 1)
+    {
+        plan->stage_count = 0;
+        prepare_bluestein(plan);
+        return plan;
+    }
+
+    // Pass with radix r on sub-length L = r*m needs exp(-2*pi*i*p*k/L) for p < m, 1 <= k < r
+    size_t twiddle_count = 0, length = size;
+    for (size_t stage = 0; stage < plan->stage_count; ++stage)
+    {
+        twiddle_count += (plan->radices[stage] - 1) * (length / plan->radices[stage]);
+        length /= plan->radices[stage];
+    }
+    plan->twiddle_real = allocate_or_exit(twiddle_count * sizeof(double), false);
+    plan->twiddle_imag = allocate_or_exit(twiddle_count * sizeof(double), false);
+    size_t offset = 0;
+    length = size;
+    for (size_t stage = 0; stage < plan->stage_count; ++stage)
+    {
+        size_t radix = plan->radices[stage], m = length / radix;
+        for (size_t k = 1; k < radix; ++k)
+            for (size_t p = 0; p < m; ++p)
+                unit_root(p * k, length, &plan->twiddle_real[offset + (k - 1) * m + p],
+                          &plan->twiddle_imag[offset + (k - 1) * m + p]);
+        offset += (radix - 1) * m;
+        length = m;
+    }
+    return plan;
+}
+
+FFTPlan *fft_plan_cache[FFT_PLAN_CACHE_SIZE];
+
+// Cached plan for size; the most recently used plan moves to the front, the oldest is evicted
+FFTPlan *fft_plan(size_t size)
+{
+    size_t position = 0;
+    while (position < FFT_PLAN_CACHE_SIZE && fft_plan_cache[position] != NULL
+           && fft_plan_cache[position]->size != size)
+        ++position;
+    FFTPlan *plan;
+    if (position < FFT_PLAN_CACHE_SIZE && fft_plan_cache[position] != NULL)
+    {
+        plan = fft_plan_cache[position];
+    }
+    else
+    {
+        if (position == FFT_PLAN_CACHE_SIZE)
+            free_fft_plan(fft_plan_cache[--position]);
+        plan = create_fft_plan(size);
+    }
+    for (; position > 0; --position)
+        fft_plan_cache[position] = fft_plan_cache[position - 1];
+    fft_plan_cache[0] = plan;
+    return plan;
+}
+
+void fft_clear_plan_cache(void)
+{
+    for (size_t position = 0; position < FFT_PLAN_CACHE_SIZE; ++position)
+    {
+        free_fft_plan(fft_plan_cache[position]);
+        fft_plan_cache[position] = NULL;
+    }
+}
+
+#if defined(__SSE2__)
+// y = c * w for two columns at once (complex multiply on split real/imaginary vectors)
+void store_twiddled_sse2(__m128d c_real, __m128d c_imag, __m128d w_real, __m128d w_imag, double *out_real, double *out_imag)
+{
+    _mm_storeu_pd(out_real, _mm_sub_pd(_mm_mul_pd(c_real, w_real), _mm_mul_pd(c_imag, w_imag)));
+    _mm_storeu_pd(out_imag, _mm_add_pd(_mm_mul_pd(c_real, w_imag), _mm_mul_pd(c_imag, w_real)));
+}
+
+// The q loop of one fft_pass butterfly group, two columns per iteration with SSE2. The
+// arithmetic is the scalar loop's, operation for operation, so results are bit-identical.
+// Returns the first q left for the scalar loop (0 or 1 columns remain).
+size_t fft_columns_sse2(size_t radix, size_t m, size_t p, size_t stride, const double *twiddle_real,
+                        const double *twiddle_imag, const double *in_real, const double *in_imag,
+                        double *out_real, double *out_imag)
+{
+    size_t step = stride * m;
+    size_t q = 0;
+    __m128d w_real[4], w_imag[4];
+    for (size_t k = 1; k < radix; ++k)
+    {
+        w_real[k - 1] = _mm_set1_pd(twiddle_real[(k - 1) * m + p]);
+        w_imag[k - 1] = _mm_set1_pd(twiddle_imag[(k - 1) * m + p]);
+    }
+    if (radix == 2)
+    {
+        for (; q + 2 <= stride; q += 2)
+        {
+            __m128d a0r = _mm_loadu_pd(in_real + q), a0i = _mm_loadu_pd(in_imag + q);
+            __m128d a1r = _mm_loadu_pd(in_real + q + step), a1i = _mm_loadu_pd(in_imag + q + step);
+            _mm_storeu_pd(out_real + q, _mm_add_pd(a0r, a1r));
+            _mm_storeu_pd(out_imag + q, _mm_add_pd(a0i, a1i));
+            store_twiddled_sse2(_mm_sub_pd(a0r, a1r), _mm_sub_pd(a0i, a1i), w_real[0], w_imag[0],
+                                out_real + q + stride, out_imag + q + stride);
+        }
+    }
+    else if (radix == 4)
+    {
+        for (; q + 2 <= stride; q += 2)
+        {
+            __m128d a0r = _mm_loadu_pd(in_real + q), a0i = _mm_loadu_pd(in_imag + q);
+            __m128d a1r = _mm_loadu_pd(in_real + q + step), a1i = _mm_loadu_pd(in_imag + q + step);
+            __m128d a2r = _mm_loadu_pd(in_real + q + 2 * step), a2i = _mm_loadu_pd(in_imag + q + 2 * step);
+            __m128d a3r = _mm_loadu_pd(in_real + q + 3 * step), a3i = _mm_loadu_pd(in_imag + q + 3 * step);
+            __m128d s02r = _mm_add_pd(a0r, a2r), s02i = _mm_add_pd(a0i, a2i);
+            __m128d d02r = _mm_sub_pd(a0r, a2r), d02i = _mm_sub_pd(a0i, a2i);
+            __m128d s13r = _mm_add_pd(a1r, a3r), s13i = _mm_add_pd(a1i, a3i);
+            __m128d d13r = _mm_sub_pd(a1i, a3i), d13i = _mm_sub_pd(a3r, a1r);    // (a1 - a3) * -i
+            _mm_storeu_pd(out_real + q, _mm_add_pd(s02r, s13r));
+            _mm_storeu_pd(out_imag + q, _mm_add_pd(s02i, s13i));
+            store_twiddled_sse2(_mm_add_pd(d02r, d13r), _mm_add_pd(d02i, d13i), w_real[0], w_imag[0],
+                                out_real + q + stride, out_imag + q + stride);
+            store_twiddled_sse2(_mm_sub_pd(s02r, s13r), _mm_sub_pd(s02i, s13i), w_real[1], w_imag[1],
+                                out_real + q + 2 * stride, out_imag + q + 2 * stride);
+            store_twiddled_sse2(_mm_sub_pd(d02r, d13r), _mm_sub_pd(d02i, d13i), w_real[2], w_imag[2],
+                                out_real + q + 3 * stride, out_imag + q + 3 * stride);
+        }
+    }
+    else if (radix == 3)
+    {
+        const __m128d half = _mm_set1_pd(0.5), sin60 = _mm_set1_pd(0.86602540378443864676);
+        for (; q + 2 <= stride; q += 2)
+        {
+            __m128d a0r = _mm_loadu_pd(in_real + q), a0i = _mm_loadu_pd(in_imag + q);
+            __m128d a1r = _mm_loadu_pd(in_real + q + step), a1i = _mm_loadu_pd(in_imag + q + step);
+            __m128d a2r = _mm_loadu_pd(in_real + q + 2 * step), a2i = _mm_loadu_pd(in_imag + q + 2 * step);
+            __m128d sr = _mm_add_pd(a1r, a2r), si = _mm_add_pd(a1i, a2i);
+            __m128d mr = _mm_sub_pd(a0r, _mm_mul_pd(half, sr)), mi = _mm_sub_pd(a0i, _mm_mul_pd(half, si));
+            __m128d dr = _mm_mul_pd(sin60, _mm_sub_pd(a1i, a2i)), di = _mm_mul_pd(sin60, _mm_sub_pd(a2r, a1r));
+            _mm_storeu_pd(out_real + q, _mm_add_pd(a0r, sr));
+            _mm_storeu_pd(out_imag + q, _mm_add_pd(a0i, si));
+            store_twiddled_sse2(_mm_add_pd(mr, dr), _mm_add_pd(mi, di), w_real[0], w_imag[0],
+                                out_real + q + stride, out_imag + q + stride);
+            store_twiddled_sse2(_mm_sub_pd(mr, dr), _mm_sub_pd(mi, di), w_real[1], w_imag[1],
+                                out_real + q + 2 * stride, out_imag + q + 2 * stride);
+        }
+    }
+    else // radix 5
+    {
+        const __m128d cos72 = _mm_set1_pd(0.30901699437494742410), sin72 = _mm_set1_pd(0.95105651629515357212);
+        const __m128d cos144 = _mm_set1_pd(-0.80901699437494742410), sin144 = _mm_set1_pd(0.58778525229247312917);
+        for (; q + 2 <= stride; q += 2)
+        {
+            __m128d a0r = _mm_loadu_pd(in_real + q), a0i = _mm_loadu_pd(in_imag + q);
+            __m128d a1r = _mm_loadu_pd(in_real + q + step), a1i = _mm_loadu_pd(in_imag + q + step);
+            __m128d a2r = _mm_loadu_pd(in_real + q + 2 * step), a2i = _mm_loadu_pd(in_imag + q + 2 * step);
+            __m128d a3r = _mm_loadu_pd(in_real + q + 3 * step), a3i = _mm_loadu_pd(in_imag + q + 3 * step);
+            __m128d a4r = _mm_loadu_pd(in_real + q + 4 * step), a4i = _mm_loadu_pd(in_imag + q + 4 * step);
+            __m128d s14r = _mm_add_pd(a1r, a4r), s14i = _mm_add_pd(a1i, a4i);
+            __m128d d14r = _mm_sub_pd(a1r, a4r), d14i = _mm_sub_pd(a1i, a4i);
+            __m128d s23r = _mm_add_pd(a2r, a3r), s23i = _mm_add_pd(a2i, a3i);
+            __m128d d23r = _mm_sub_pd(a2r, a3r), d23i = _mm_sub_pd(a2i, a3i);
+            __m128d m1r = _mm_add_pd(_mm_add_pd(a0r, _mm_mul_pd(cos72, s14r)), _mm_mul_pd(cos144, s23r));
+            __m128d m1i = _mm_add_pd(_mm_add_pd(a0i, _mm_mul_pd(cos72, s14i)), _mm_mul_pd(cos144, s23i));
+            __m128d m2r = _mm_add_pd(_mm_add_pd(a0r, _mm_mul_pd(cos144, s14r)), _mm_mul_pd(cos72, s23r));
+            __m128d m2i = _mm_add_pd(_mm_add_pd(a0i, _mm_mul_pd(cos144, s14i)), _mm_mul_pd(cos72, s23i));
+            __m128d n1r = _mm_add_pd(_mm_mul_pd(sin72, d14r), _mm_mul_pd(sin144, d23r));
+            __m128d n1i = _mm_add_pd(_mm_mul_pd(sin72, d14i), _mm_mul_pd(sin144, d23i));
+            __m128d n2r = _mm_sub_pd(_mm_mul_pd(sin144, d14r), _mm_mul_pd(sin72, d23r));
+            __m128d n2i = _mm_sub_pd(_mm_mul_pd(sin144, d14i), _mm_mul_pd(sin72, d23i));
+            _mm_storeu_pd(out_real + q, _mm_add_pd(_mm_add_pd(a0r, s14r), s23r));
+            _mm_storeu_pd(out_imag + q, _mm_add_pd(_mm_add_pd(a0i, s14i), s23i));
+            store_twiddled_sse2(_mm_add_pd(m1r, n1i), _mm_sub_pd(m1i, n1r), w_real[0], w_imag[0],
+                                out_real + q + stride, out_imag + q + stride);
+            store_twiddled_sse2(_mm_add_pd(m2r, n2i), _mm_sub_pd(m2i, n2r), w_real[1], w_imag[1],
+                                out_real + q + 2 * stride, out_imag + q + 2 * stride);
+            store_twiddled_sse2(_mm_sub_pd(m2r, n2i), _mm_add_pd(m2i, n2r), w_real[2], w_imag[2],
+                                out_real + q + 3 * stride, out_imag + q + 3 * stride);
+            store_twiddled_sse2(_mm_sub_pd(m1r, n1i), _mm_add_pd(m1i, n1r), w_real[3], w_imag[3],
+                                out_real + q + 4 * stride, out_imag + q + 4 * stride);
+        }
+    }
+    return q;
+}
+#endif
+
+// One Stockham pass. The current sub-transforms have length radix*m and are interleaved with
+// the given stride: input element j of sub-transform (p, q) is x[q + stride*(p + j*m)], and
+// output k goes to y[q + stride*(radix*p + k)] after multiplying by twiddle (k, p).
+// The q loop is unit-stride and twiddle-constant, which is the loop that vectorizes; with SSE2
+// fft_columns_sse2 runs it two columns at a time and the scalar loops finish any odd column.
+void fft_pass(size_t radix, size_t m, size_t stride, const double *twiddle_real, const double *twiddle_imag,
+              const double *x_real, const double *x_imag, double *y_real, double *y_imag)
+{
+    const double sin60 = 0.86602540378443864676;                // sin(2*pi/3)
+    const double cos72 = 0.30901699437494742410, sin72 = 0.95105651629515357212;
+    const double cos144 = -0.80901699437494742410, sin144 = 0.58778525229247312917;
+    for (size_t p = 0; p < m; ++p)
+    {
+        const double *in_real = x_real + stride * p, *in_imag = x_imag + stride * p;
+        double *out_real = y_real + stride * radix * p, *out_imag = y_imag + stride * radix * p;
+        size_t step = stride * m;                               // distance between inputs j and j+1
+        size_t first_q = 0;
+#if defined(__SSE2__)
+        first_q = fft_columns_sse2(radix, m, p, stride, twiddle_real, twiddle_imag, in_real, in_imag, out_real, out_imag);
+#endif
+        if (radix == 2)
+        {
+            double w1r = twiddle_real[p], w1i = twiddle_imag[p];
+            for (size_t q = first_q; q < stride; ++q)
+            {
+                double a0r = in_real[q], a0i = in_imag[q], a1r = in_real[q + step], a1i = in_imag[q + step];
+                double dr = a0r - a1r, di = a0i - a1i;
+                out_real[q] = a0r + a1r;
+                out_imag[q] = a0i + a1i;
+                out_real[q + stride] = dr * w1r - di * w1i;
+                out_imag[q + stride] = dr * w1i + di * w1r;
+            }
+        }
+        else if (radix == 4)
+        {
+            double w1r = twiddle_real[p], w1i = twiddle_imag[p];
+            double w2r = twiddle_real[m + p], w2i = twiddle_imag[m + p];
+            double w3r = twiddle_real[2 * m + p], w3i = twiddle_imag[2 * m + p];
+            for (size_t q = first_q; q < stride; ++q)
+            {
+                double a0r = in_real[q], a0i = in_imag[q];
+                double a1r = in_real[q + step], a1i = in_imag[q + step];
+                double a2r = in_real[q + 2 * step], a2i = in_imag[q + 2 * step];
+                double a3r = in_real[q + 3 * step], a3i = in_imag[q + 3 * step];
+                double s02r = a0r + a2r, s02i = a0i + a2i, d02r = a0r - a2r, d02i = a0i - a2i;
+                double s13r = a1r + a3r, s13i = a1i + a3i;
+                double d13r = a1i - a3i, d13i = a3r - a1r;             // (a1 - a3) * -i
+                double c1r = d02r + d13r, c1i = d02i + d13i;
+                double c2r = s02r - s13r, c2i = s02i - s13i;
+                double c3r = d02r - d13r, c3i = d02i - d13i;
+                out_real[q] = s02r + s13r;
+                out_imag[q] = s02i + s13i;
+                out_real[q + stride] = c1r * w1r - c1i * w1i;
+                out_imag[q + stride] = c1r * w1i + c1i * w1r;
+                out_real[q + 2 * stride] = c2r * w2r - c2i * w2i;
+                out_imag[q + 2 * stride] = c2r * w2i + c2i * w2r;
+                out_real[q + 3 * stride] = c3r * w3r - c3i * w3i;
+                out_imag[q + 3 * stride] = c3r * w3i + c3i * w3r;
+            }
+        }
+        else if (radix == 3)
+        {
+            double w1r = twiddle_real[p], w1i = twiddle_imag[p];
+            double w2r = twiddle_real[m + p], w2i = twiddle_imag[m + p];
+            for (size_t q = first_q; q < stride; ++q)
+            {
+                double a0r = in_real[q], a0i = in_imag[q];
+                double a1r = in_real[q + step], a1i = in_imag[q + step];
+                double a2r = in_real[q + 2 * step], a2i = in_imag[q + 2 * step];
+                double sr = a1r + a2r, si = a1i + a2i;
+                double mr = a0r - 0.5 * sr, mi = a0i - 0.5 * si;
+                double dr = sin60 * (a1i - a2i), di = sin60 * (a2r - a1r); // -i*sin60*(a1 - a2)
+                double c1r = mr + dr, c1i = mi + di, c2r = mr - dr, c2i = mi - di;
+                out_real[q] = a0r + sr;
+                out_imag[q] = a0i + si;
+                out_real[q + stride] = c1r * w1r - c1i * w1i;
+                out_imag[q + stride] = c1r * w1i + c1i * w1r;
+                out_real[q + 2 * stride] = c2r * w2r - c2i * w2i;
+                out_imag[q + 2 * stride] = c2r * w2i + c2i * w2r;
+            }
+        }
+        else // radix 5
+        {
+            double w1r = twiddle_real[p], w1i = twiddle_imag[p];
+            double w2r = twiddle_real[m + p], w2i = twiddle_imag[m + p];
+            double w3r = twiddle_real[2 * m + p], w3i = twiddle_imag[2 * m + p];
+            double w4r = twiddle_real[3 * m + p], w4i = twiddle_imag[3 * m + p];
+            for (size_t q = first_q; q < stride; ++q)
+            {
+                double a0r = in_real[q], a0i = in_imag[q];
+                double a1r = in_real[q + step], a1i = in_imag[q + step];
+                double a2r = in_real[q + 2 * step], a2i = in_imag[q + 2 * step];
+                double a3r = in_real[q + 3 * step], a3i = in_imag[q + 3 * step];
+                double a4r = in_real[q + 4 * step], a4i = in_imag[q + 4 * step];
+                double s14r = a1r + a4r, s14i = a1i + a4i, d14r = a1r - a4r, d14i = a1i - a4i;
+                double s23r = a2r + a3r, s23i = a2i + a3i, d23r = a2r - a3r, d23i = a2i - a3i;
+                double m1r = a0r + cos72 * s14r + cos144 * s23r, m1i = a0i + cos72 * s14i + cos144 * s23i;
+                double m2r = a0r + cos144 * s14r + cos72 * s23r, m2i = a0i + cos144 * s14i + cos72 * s23i;
+                double n1r = sin72 * d14r + sin144 * d23r, n1i = sin72 * d14i + sin144 * d23i;
+                double n2r = sin144 * d14r - sin72 * d23r, n2i = sin144 * d14i - sin72 * d23i;
+                // c1 = m1 - i*n1, c4 = m1 + i*n1, c2 = m2 - i*n2, c3 = m2 + i*n2
+                double c1r = m1r + n1i, c1i = m1i - n1r, c4r = m1r - n1i, c4i = m1i + n1r;
+                double c2r = m2r + n2i, c2i = m2i - n2r, c3r = m2r - n2i, c3i = m2i + n2r;
+                out_real[q] = a0r + s14r + s23r;
+                out_imag[q] = a0i + s14i + s23i;
+                out_real[q + stride] = c1r * w1r - c1i * w1i;
+                out_imag[q + stride] = c1r * w1i + c1i * w1r;
+                out_real[q + 2 * stride] = c2r * w2r - c2i * w2i;
+                out_imag[q + 2 * stride] = c2r * w2i + c2i * w2r;
+                out_real[q + 3 * stride] = c3r * w3r - c3i * w3i;
+                out_imag[q + 3 * stride] = c3r * w3i + c3i * w3r;
+                out_real[q + 4 * stride] = c4r * w4r - c4i * w4i;
+                out_imag[q + 4 * stride] = c4r * w4i + c4i * w4r;
+            }
+        }
+    }
+}
 
-// -------------------------- Array Creation & Deletion --------------------------
+// Bluestein: X[k] = chirp[k] * sum_j (x[j] * chirp[j]) * conj(chirp[k - j])
+void bluestein_execute(const FFTPlan *plan, double *real, double *imag)
+{
+    const FFTPlan *convolution = plan->convolution_plan;
+    size_t length = convolution->size;
+    double *work_real = allocate_or_exit(length * sizeof(double), true);
+    double *work_imag = allocate_or_exit(length * sizeof(double), true);
+    for (size_t k = 0; k < plan->size; ++k)
+    {
+        work_real[k] = real[k] * plan->chirp_real[k] - imag[k] * plan->chirp_imag[k];
+        work_imag[k] = real[k] * plan->chirp_imag[k] + imag[k] * plan->chirp_real[k];
+    }
+    fft_execute(convolution, work_real, work_imag);
+    for (size_t k = 0; k < length; ++k)
+    {
+        double product_real = work_real[k] * plan->filter_real[k] - work_imag[k] * plan->filter_imag[k];
+        double product_imag = work_real[k] * plan->filter_imag[k] + work_imag[k] * plan->filter_real[k];
+        work_real[k] = product_real;
+        work_imag[k] = product_imag;
+    }
+    fft_execute_inverse(convolution, work_real, work_imag);
+    for (size_t k = 0; k < plan->size; ++k)
+    {
+        real[k] = work_real[k] * plan->chirp_real[k] - work_imag[k] * plan->chirp_imag[k];
+        imag[k] = work_real[k] * plan->chirp_imag[k] + work_imag[k] * plan->chirp_real[k];
+    }
+    free(work_real);
+    free(work_imag);
+}
 
-CNumPyArray create_array(const double *initial_values, size_t array_size)
+// Unscaled forward transform of plan->size values, in place
+void fft_execute(const FFTPlan *plan, double *real, double *imag)
 {
-    CNumPyArray array;
-    array.size = array_size;                           // set array length
-    array.data = (double *)malloc(array_size * sizeof(double));  // allocate memory
-    if (array.data == NULL)
+    if (plan->convolution_plan != NULL)
     {
-        fprintf(stderr, "Memory allocation failed.\n");
-        exit(1);
+        bluestein_execute(plan, real, imag);
+        return;
     }
-    if (initial_values != NULL)
+    if (plan->stage_count == 0)
+        return;
+    size_t size = plan->size;
+    double *scratch_real = allocate_or_exit(size * sizeof(double), false);
+    double *scratch_imag = allocate_or_exit(size * sizeof(double), false);
+    // With an odd pass count, start from the scratch copy so the last pass lands in place
+    double *x_real = real, *x_imag = imag, *y_real = scratch_real, *y_imag = scratch_imag;
+    if (plan->stage_count % 2 == 1)
     {
-        memcpy(array.data, initial_values, array_size * sizeof(double)); // copy values if provided
+        memcpy(scratch_real, real, size * sizeof(double));
+        memcpy(scratch_imag, imag, size * sizeof(double));
+        x_real = scratch_real; x_imag = scratch_imag; y_real = real; y_imag = imag;
     }
-    else
+    const double *twiddle_real = plan->twiddle_real, *twiddle_imag = plan->twiddle_imag;
+    size_t length = size, stride = 1;
+    for (size_t stage = 0; stage < plan->stage_count; ++stage)
     {
-        memset(array.data, 0, array_size * sizeof(double)); // default fill to 0
+        size_t radix = plan->radices[stage], m = length / radix;
+        fft_pass(radix, m, stride, twiddle_real, twiddle_imag, x_real, x_imag, y_real, y_imag);
+        twiddle_real += (radix - 1) * m;
+        twiddle_imag += (radix - 1) * m;
+        length = m;
+        stride *= radix;
+        double *swap_real = x_real; x_real = y_real; y_real = swap_real;
+        double *swap_imag = x_imag; x_imag = y_imag; y_imag = swap_imag;
     }
-    return array;
+    free(scratch_real);
+    free(scratch_imag);
 }
 
-CNumPyArray array_zeros(size_t array_size)
+// Scaled inverse transform in place: conj(fft(conj(x))) / size
+void fft_execute_inverse(const FFTPlan *plan, double *real, double *imag)
 {
-    return create_array(NULL, array_size); // all zeros
+    size_t size = plan->size;
+    for (size_t k = 0; k < size; ++k)
+        imag[k] = -imag[k];
+    fft_execute(plan, real, imag);
+    double scale = 1.0 / (double)size;
+    for (size_t k = 0; k < size; ++k)
+    {
+        real[k] *= scale;
+        imag[k] = -imag[k] * scale;
+    }
 }
 
-CNumPyArray array_ones(size_t array_size)
+void require_nonempty_transform(size_t size, const char *message)
 {
-    CNumPyArray array = create_array(NULL, array_size);
-    for (size_t index = 0; index < array_size; ++index)
+    if (size == 0)
     {
-        array.data[index] = 1.0;                      // set each element to one
+        fprintf(stderr, "%s: transform length must be positive.\n", message);
+        exit(1);
     }
-    return array;
 }
 
-CNumPyArray array_full(size_t array_size, double fill_value)
+void require_same_complex_size(const CNumPyComplexArray *array, const char *message)
 {
-    CNumPyArray array = create_array(NULL, array_size);
-    for (size_t index = 0; index < array_size; ++index)
-        array.data[index] = fill_value;                // fill with user-specified value
-    return array;
+    if (array->real.size != array->imag.size)
+    {
+        fprintf(stderr, "%s: real and imaginary parts differ in size (%zu vs %zu).\n",
+                message, array->real.size, array->imag.size);
+        exit(1);
+    }
 }
 
-CNumPyArray array_range(double start_value, double end_value, double step_value)
+// Discrete Fourier transform of a complex array (numpy.fft.fft)
+CNumPyComplexArray fft_array(const CNumPyComplexArray *input)
 {
-    // computes how many elements
-    size_t count = (size_t)ceil((end_value - start_value) / step_value);
-    CNumPyArray array = create_array(NULL, count);
-    for (size_t index = 0; index < count; ++index)
+    INSTRUMENT_BEGIN(OP_FFT, input->real.size);
+    require_same_complex_size(input, "fft");
+    require_nonempty_transform(input->real.size, "fft");
+    CNumPyComplexArray result = create_complex_array(input->real.data, input->imag.data, input->real.size);
+    fft_execute(fft_plan(input->real.size), result.real.data, result.imag.data);
+    INSTRUMENT_END();
+    return result;
+}
+
+// Inverse transform, scaled by 1/n (numpy.fft.ifft)
+CNumPyComplexArray ifft_array(const CNumPyComplexArray *input)
+{
+    INSTRUMENT_BEGIN(OP_IFFT, input->real.size);
+    require_same_complex_size(input, "ifft");
+    require_nonempty_transform(input->real.size, "ifft");
+    CNumPyComplexArray result = create_complex_array(input->real.data, input->imag.data, input->real.size);
+    fft_execute_inverse(fft_plan(input->real.size), result.real.data, result.imag.data);
+    INSTRUMENT_END();
+    return result;
+}
+
+// exp(-i*pi*k/size) for k < size, used to split or join a packed real transform of 2*size
+void prepare_half_twiddles(FFTPlan *plan)
+{
+    if (plan->half_twiddle_real != NULL)
+        return;
+    plan->half_twiddle_real = allocate_or_exit(plan->size * sizeof(double), false);
+    plan->half_twiddle_imag = allocate_or_exit(plan->size * sizeof(double), false);
+    for (size_t k = 0; k < plan->size; ++k)
+        unit_root(k, 2 * plan->size, &plan->half_twiddle_real[k], &plan->half_twiddle_imag[k]);
+}
+
+// Transform of a real array: the n/2 + 1 non-negative frequency bins (numpy.fft.rfft)
+CNumPyComplexArray rfft_array(const CNumPyArray *input)
+{
+    INSTRUMENT_BEGIN(OP_RFFT, input->size);
+    size_t size = input->size;
+    require_nonempty_transform(size, "rfft");
+    size_t bins = size / 2 + 1;
+    if (size % 2 == 1)
     {
-        array.data[index] = start_value + step_value * ((double)index); // calculate each value
+        CNumPyComplexArray full = create_complex_array(input->data, NULL, size);
+        fft_execute(fft_plan(size), full.real.data, full.imag.data);
+        CNumPyComplexArray result = create_complex_array(full.real.data, full.imag.data, bins);
+        free_complex_array(&full);
+        INSTRUMENT_END();
+        return result;
     }
-    return array;
+    // Even samples become real parts and odd samples imaginary parts of a half-length signal z.
+    // With E, O the transforms of the even and odd samples, Z = E + i*O and
+    // X[k] = E[k] + exp(-i*pi*k/h) * O[k], where E[k] = (Z[k] + conj(Z[h-k])) / 2 and
+    // O[k] = (Z[k] - conj(Z[h-k])) / 2i.
+    size_t half = size / 2;
+    FFTPlan *plan = fft_plan(half);
+    prepare_half_twiddles(plan);
+    CNumPyComplexArray packed = create_complex_array(NULL, NULL, half);
+    for (size_t k = 0; k < half; ++k)
+    {
+        packed.real.data[k] = input->data[2 * k];
+        packed.imag.data[k] = input->data[2 * k + 1];
+    }
+    fft_execute(plan, packed.real.data, packed.imag.data);
+    CNumPyComplexArray result = create_complex_array(NULL, NULL, bins);
+    const double *z_real = packed.real.data, *z_imag = packed.imag.data;
+    result.real.data[0] = z_real[0] + z_imag[0];
+    result.real.data[half] = z_real[0] - z_imag[0];
+    for (size_t k = 1; k < half; ++k)
+    {
+        double even_real = 0.5 * (z_real[k] + z_real[half - k]);
+        double even_imag = 0.5 * (z_imag[k] - z_imag[half - k]);
+        double odd_real = 0.5 * (z_imag[k] + z_imag[half - k]);
+        double odd_imag = 0.5 * (z_real[half - k] - z_real[k]);
+        double w_real = plan->half_twiddle_real[k], w_imag = plan->half_twiddle_imag[k];
+        result.real.data[k] = even_real + odd_real * w_real - odd_imag * w_imag;
+        result.imag.data[k] = even_imag + odd_real * w_imag + odd_imag * w_real;
+    }
+    free_complex_array(&packed);
+    INSTRUMENT_END();
+    return result;
 }
 
-CNumPyArray array_linspace(double start_value, double end_value, size_t number_values)
+// Real signal of output_size samples from its non-negative frequency bins (numpy.fft.irfft).
+// Bins beyond the spectrum are taken as zero and extra bins are ignored; the imaginary parts
+// of the zero bin (and of the Nyquist bin for even output_size) are ignored.
+CNumPyArray irfft_array(const CNumPyComplexArray *spectrum, size_t output_size)
 {
-    // evenly spaced from start to end (inclusive)
-    CNumPyArray array = create_array(NULL, number_values);
-    if (number_values == 1)
+    INSTRUMENT_BEGIN(OP_IRFFT, output_size);
+    require_same_complex_size(spectrum, "irfft");
+    require_nonempty_transform(output_size, "irfft");
+    size_t bins = output_size / 2 + 1;
+    CNumPyComplexArray padded = create_complex_array(NULL, NULL, bins);
+    size_t available = spectrum->real.size < bins ? spectrum->real.size : bins;
+    for (size_t k = 0; k < available; ++k)
     {
-        array.data[0] = start_value;
+        padded.real.data[k] = spectrum->real.data[k];
+        padded.imag.data[k] = spectrum->imag.data[k];
     }
-    else
+    padded.imag.data[0] = 0.0;
+    CNumPyArray result = allocate_array(output_size);
+    if (output_size % 2 == 1)
     {
-        for (size_t index = 0; index < number_values; ++index)
+        // Rebuild the full Hermitian spectrum and run a complex inverse
+        CNumPyComplexArray full = create_complex_array(NULL, NULL, output_size);
+        for (size_t k = 0; k < bins; ++k)
         {
-            array.data[index] = start_value + (end_value - start_value) * index / (number_values - 1); // linear interpolation
+            full.real.data[k] = padded.real.data[k];
+            full.imag.data[k] = padded.imag.data[k];
+            if (k > 0)
+            {
+                full.real.data[output_size - k] = padded.real.data[k];
+                full.imag.data[output_size - k] = -padded.imag.data[k];
+            }
         }
+        fft_execute_inverse(fft_plan(output_size), full.real.data, full.imag.data);
+        memcpy(result.data, full.real.data, output_size * sizeof(double));
+        free_complex_array(&full);
+        free_complex_array(&padded);
+        INSTRUMENT_END();
+        return result;
     }
-    return array;
+    // Undo rfft's untangling: E[k] = (X[k] + conj(X[h-k])) / 2,
+    // O[k] = (X[k] - conj(X[h-k])) / 2 * exp(i*pi*k/h), Z = E + i*O, z = ifft(Z)
+    size_t half = output_size / 2;
+    padded.imag.data[half] = 0.0;
+    FFTPlan *plan = fft_plan(half);
+    prepare_half_twiddles(plan);
+    CNumPyComplexArray packed = create_complex_array(NULL, NULL, half);
+    for (size_t k = 0; k < half; ++k)
+    {
+        double x_real = padded.real.data[k], x_imag = padded.imag.data[k];
+        double mirror_real = padded.real.data[half - k], mirror_imag = -padded.imag.data[half - k];
+        double even_real = 0.5 * (x_real + mirror_real), even_imag = 0.5 * (x_imag + mirror_imag);
+        double difference_real = 0.5 * (x_real - mirror_real), difference_imag = 0.5 * (x_imag - mirror_imag);
+        double w_real = plan->half_twiddle_real[k], w_imag = -plan->half_twiddle_imag[k];
+        double odd_real = difference_real * w_real - difference_imag * w_imag;
+        double odd_imag = difference_real * w_imag + difference_imag * w_real;
+        packed.real.data[k] = even_real - odd_imag;
+        packed.imag.data[k] = even_imag + odd_real;
+    }
+    fft_execute_inverse(plan, packed.real.data, packed.imag.data);
+    for (size_t k = 0; k < half; ++k)
+    {
+        result.data[2 * k] = packed.real.data[k];
+        result.data[2 * k + 1] = packed.imag.data[k];
+    }
+    free_complex_array(&packed);
+    free_complex_array(&padded);
+    INSTRUMENT_END();
+    return result;
 }
 
-void free_array(CNumPyArray *array)
+// -------------------------- Convolution & Correlation --------------------------
+//
+// convolve_array and correlate_array follow numpy.convolve / numpy.correlate for real arrays,
+// with the three output modes:
+//   CONVOLVE_FULL   every overlap, length n + m - 1
+//   CONVOLVE_SAME   length max(n, m), centered on the full result
+//   CONVOLVE_VALID  only complete overlaps, length max(n, m) - min(n, m) + 1
+// Correlation is convolution with the kernel reversed. Two methods compute the result:
+//   direct       for each kernel tap, out[t] += v[j] * a[t - j] over a block of outputs; the
+//                inner loop is a unit-stride multiply-add, two outputs at a time with SSE2,
+//                and the output block stays in L1 across taps. Costs about outputs * m
+//                multiply-adds.
+//   FFT          overlap-add: the longer input is cut into blocks, each block is multiplied
+//                by the kernel spectrum with rfft/irfft of a 2/3/5-smooth length, and the
+//                overlapping tails are summed. Costs about blocks * N log N.
+// The choice comes from a cost model whose two constants (seconds per multiply-add and per
+// N log N unit of FFT work) are measured the first time a large enough convolution runs, or
+// explicitly with calibrate_convolution. Small problems always run direct. Because the
+// constants are timings, whether a given large call runs direct or FFT, and therefore its
+// last-bit rounding, can differ between runs and machines. To pin the choice, set
+// convolution_cost_model to fixed constants (with calibrated = true) before convolving.
+
+#define CONVOLVE_BLOCK 2048             // outputs accumulated together by the direct method
+#define CONVOLVE_ALWAYS_DIRECT 65536    // outputs * taps below which FFT never pays
+#define CONVOLVE_CALIBRATION_SIZE 4096  // problem size timed by calibrate_convolution
+
+typedef enum { CONVOLVE_FULL, CONVOLVE_SAME, CONVOLVE_VALID } ConvolveMode;
+
+typedef struct {
+    bool calibrated;
+    double direct_cost;                 // seconds per multiply-add of the direct method
+    double fft_cost;                    // seconds per N log2 N of a real FFT of length N
+} ConvolutionCostModel;
+
+ConvolutionCostModel convolution_cost_model = {false, 0.0, 0.0};
+
+// Slice [start, start + length) of the full convolution of signal (n) with kernel (m)
+void convolve_direct(const double *signal, size_t n, const double *kernel, size_t m,
+                     size_t start, size_t length, double *out)
 {
-    if (array->data)
+    memset(out, 0, length * sizeof(double));
+    for (size_t block = 0; block < length; block += CONVOLVE_BLOCK)
     {
-        free(array->data);            // release memory
-        array->data = NULL;
+        size_t first = start + block;
+        size_t last = first + (length - block < CONVOLVE_BLOCK ? length - block : CONVOLVE_BLOCK);
+        for (size_t tap = 0; tap < m; ++tap)
+        {
+            // full[t] += kernel[tap] * signal[t - tap] for 0 <= t - tap < n
+            size_t from = first > tap ? first : tap;
+            size_t to = last < n + tap ? last : n + tap;
+            if (from >= to)
+                continue;
+            double weight = kernel[tap];
+            double *target = out + (from - start);
+            const double *source = signal + (from - tap);
+            size_t t = 0;
+#if defined(__SSE2__)
+            __m128d weights = _mm_set1_pd(weight);    // same multiply then add per element as below
+            for (; t + 2 <= to - from; t += 2)
+                _mm_storeu_pd(target + t, _mm_add_pd(_mm_loadu_pd(target + t), _mm_mul_pd(weights, _mm_loadu_pd(source + t))));
+#endif
+            for (; t < to - from; ++t)
+                target[t] += weight * source[t];
+        }
     }
-    array->size = 0;                  // mark as empty
 }
 
-CNumPyArray copy_array(const CNumPyArray *array)
+// Smallest even 2/3/5-smooth length >= n, so the real FFT can use its half-length path
+size_t even_fft_size(size_t n)
 {
-    return create_array(array->data, array->size);  // shallow copy
+    size_t size = next_fast_fft_size(n < 2 ? 2 : n);
+    while (size % 2 != 0)
+        size = next_fast_fft_size(size + 1);
+    return size;
 }
 
-// -------------------------- Array Utilities --------------------------
+// FFT block length for a kernel of m taps: about 8 m, so most of each block is new output
+size_t overlap_add_block(size_t m, size_t full_length)
+{
+    size_t block = even_fft_size(8 * m > 64 ? 8 * m : 64);
+    size_t whole = even_fft_size(full_length);
+    return whole < block ? whole : block;
+}
 
-void print_array(const CNumPyArray *array, int print_precision)
+// Same slice as convolve_direct, computed by FFT overlap-add
+void convolve_fft(const double *signal, size_t n, const double *kernel, size_t m,
+                  size_t start, size_t length, double *out)
 {
-    printf("[");
-    for (size_t index = 0; index < array->size; ++index)
+    size_t block = overlap_add_block(m, n + m - 1);
+    size_t step = block - m + 1;                            // new signal samples per block
+    CNumPyArray padded = create_array(NULL, block);
+    memcpy(padded.data, kernel, m * sizeof(double));
+    CNumPyComplexArray kernel_spectrum = rfft_array(&padded);
+    memset(out, 0, length * sizeof(double));
+    for (size_t offset = 0; offset < n && offset < start + length; offset += step)
     {
-        printf("%.*f", print_precision, array->data[index]);           // print with specified digits
-        if (index + 1 != array->size)
+        // this block contributes to full[offset, offset + count + m - 1)
+        size_t count = n - offset < step ? n - offset : step;
+        if (offset + count + m - 1 <= start)
+            continue;
+        memset(padded.data, 0, block * sizeof(double));
+        memcpy(padded.data, signal + offset, count * sizeof(double));
+        CNumPyComplexArray spectrum = rfft_array(&padded);
+        for (size_t bin = 0; bin < spectrum.real.size; ++bin)
         {
-            printf(", ");
+            double real = spectrum.real.data[bin], imag = spectrum.imag.data[bin];
+            spectrum.real.data[bin] = real * kernel_spectrum.real.data[bin] - imag * kernel_spectrum.imag.data[bin];
+            spectrum.imag.data[bin] = real * kernel_spectrum.imag.data[bin] + imag * kernel_spectrum.real.data[bin];
         }
+        CNumPyArray piece = irfft_array(&spectrum, block);
+        size_t from = offset > start ? offset : start;
+        size_t to = offset + count + m - 1;
+        if (to > start + length)
+            to = start + length;
+        for (size_t t = from; t < to; ++t)
+            out[t - start] += piece.data[t - offset];
+        free_complex_array(&spectrum);
+        free_array(&piece);
     }
-    printf("]\n");
+    free_complex_array(&kernel_spectrum);
+    free_array(&padded);
 }
 
-void fill_array(CNumPyArray *array, double fill_value)
+// Measure the two cost constants on this machine (runs automatically when first needed)
+void calibrate_convolution(void)
 {
-    for (size_t index = 0; index < array->size; ++index)
-        array->data[index] = fill_value;               // fill each element
+    size_t size = CONVOLVE_CALIBRATION_SIZE, taps = 64;
+    CNumPyArray signal = array_full(size, 0.5);
+    CNumPyArray kernel = array_full(taps, 0.25);
+    CNumPyArray out = allocate_array(size);
+    struct timespec start;
+    size_t repeats = 1;
+    double seconds;
+    do {
+        repeats *= 2;
+        current_time(&start);
+        for (size_t round = 0; round < repeats; ++round)
+            convolve_direct(signal.data, size, kernel.data, taps, taps - 1, size - taps + 1, out.data);
+        seconds = elapsed_seconds(&start);
+    } while (seconds < 1e-3);
+    convolution_cost_model.direct_cost = seconds / ((double)repeats * (double)(size - taps + 1) * (double)taps);
+
+    repeats = 1;
+    do {
+        repeats *= 2;
+        current_time(&start);
+        for (size_t round = 0; round < repeats; ++round)
+        {
+            CNumPyComplexArray spectrum = rfft_array(&signal);
+            CNumPyArray back = irfft_array(&spectrum, size);
+            free_complex_array(&spectrum);
+            free_array(&back);
+        }
+        seconds = elapsed_seconds(&start);
+    } while (seconds < 1e-3);
+    convolution_cost_model.fft_cost = seconds / ((double)repeats * 2.0 * (double)size * log2((double)size));
+    convolution_cost_model.calibrated = true;
+    free_array(&signal);
+    free_array(&kernel);
+    free_array(&out);
 }
 
-void reverse_array(CNumPyArray *array)
+// Cost model: true if overlap-add is expected to beat the direct method
+bool convolution_prefers_fft(size_t n, size_t m, size_t length)
 {
-    size_t last_index = array->size - 1;
-    for (size_t index = 0; index < array->size / 2; ++index)
+    if ((double)length * (double)m < CONVOLVE_ALWAYS_DIRECT)
+        return false;
+    if (!convolution_cost_model.calibrated)
+        calibrate_convolution();
+    size_t block = overlap_add_block(m, n + m - 1);
+    double blocks = ceil((double)n / (double)(block - m + 1));
+    double fft_seconds = convolution_cost_model.fft_cost * (2.0 * blocks + 1.0) * (double)block * log2((double)block);
+    double direct_seconds = convolution_cost_model.direct_cost * (double)length * (double)m;
+    return fft_seconds < direct_seconds;
+}
+
+// Shared driver: the longer input is treated as the signal, since convolution commutes
+CNumPyArray convolve_values(const CNumPyArray *first, const CNumPyArray *second, bool reverse_second,
+                            ConvolveMode mode, const char *message)
+{
+    INSTRUMENT_BEGIN(reverse_second ? OP_CORRELATE : OP_CONVOLVE, first->size + second->size);
+    if (first->size == 0 || second->size == 0)
     {
-        double temp = array->data[index];
-        array->data[index] = array->data[last_index - index];
-        array->data[last_index - index] = temp;        // swap pairs from each end
+        fprintf(stderr, "%s: inputs must not be empty.\n", message);
+        exit(1);
+    }
+    CNumPyArray kernel_copy = {NULL, 0};
+    const double *kernel = second->data;
+    if (reverse_second)
+    {
+        kernel_copy = allocate_array(second->size);
+        for (size_t index = 0; index < second->size; ++index)
+            kernel_copy.data[index] = second->data[second->size - 1 - index];
+        kernel = kernel_copy.data;
+    }
+    const double *signal = first->data;
+    size_t n = first->size, m = second->size;
+    bool swapped = m > n;
+    if (swapped)
+    {
+        const double *swap = signal; signal = kernel; kernel = swap;
+        size_t swap_size = n; n = m; m = swap_size;
     }
+    size_t start = 0, length = n + m - 1;
+    if (mode == CONVOLVE_SAME)
+    {
+        // numpy centers a correlation with a longer template from the other end
+        start = swapped && reverse_second ? m / 2 : (m - 1) / 2;
+        length = n;
+    }
+    else if (mode == CONVOLVE_VALID)
+    {
+        start = m - 1;
+        length = n - m + 1;
+    }
+    CNumPyArray result = allocate_array(length);
+    if (convolution_prefers_fft(n, m, length))
+        convolve_fft(signal, n, kernel, m, start, length, result.data);
+    else
+        convolve_direct(signal, n, kernel, m, start, length, result.data);
+    if (reverse_second)
+        free_array(&kernel_copy);
+    INSTRUMENT_END();
+    return result;
 }
 
-// Compare two arrays for elementwise equality
-bool equal_array(const CNumPyArray *array1, const CNumPyArray *array2)
+// Discrete linear convolution of array with kernel (numpy.convolve)
+CNumPyArray convolve_array(const CNumPyArray *array, const CNumPyArray *kernel, ConvolveMode mode)
 {
-    if (array1->size != array2->size)
-        return false;
-    for (size_t index = 0; index < array1->size; ++index)
-        if (array1->data[index] != array2->data[index])
-            return false;
-    return true;
+    return convolve_values(array, kernel, false, mode, "convolve");
 }
 
-// Return true if any element is nonzero
-bool any_array(const CNumPyArray *array)
+// Cross-correlation: result[k] = sum_j array[j + k] * template[j] (numpy.correlate)
+CNumPyArray correlate_array(const CNumPyArray *array, const CNumPyArray *template_array, ConvolveMode mode)
 {
-    for (size_t index = 0; index < array->size; ++index)
-        if (array->data[index] != 0)
-            return true;
-    return false;
+    return convolve_values(array, template_array, true, mode, "correlate");
 }
 
-// Return true if all elements are nonzero
-bool all_array(const CNumPyArray *array)
+// -------------------------- Polynomials & Interpolation --------------------------
+//
+// polyval_array evaluates one polynomial at every element (numpy.polyval: coefficients from
+// the highest power down). Horner's rule is a chain of dependent multiply-adds per element, so
+// elements are processed POLYVAL_LANES at a time with the lanes held in a small local array:
+// the chains are independent, the lane loop vectorizes, and each step can contract to an FMA.
+// With that much independent work Estrin's scheme would add operations without saving time.
+//
+// interp_array is piecewise-linear interpolation against sorted breakpoints (numpy.interp;
+// values beyond the ends take the end values). When the queries are themselves sorted, one
+// merge-walk moves a single segment pointer forward through the breakpoints; otherwise each
+// query uses the branchless binary search shared with the histograms.
+
+#define POLYVAL_LANES 8                 // elements evaluated together
+
+CNumPyArray polyval_array(const CNumPyArray *coefficients, const CNumPyArray *array)
 {
-    for (size_t index = 0; index < array->size; ++index)
-        if (array->data[index] == 0)
+    INSTRUMENT_BEGIN(OP_POLYVAL, array->size);
+    CNumPyArray result = allocate_array(array->size);
+    const double *c = coefficients->data;
+    size_t degree_count = coefficients->size;
+    if (degree_count == 0)
+    {
+        store_value(result.data, array->size, 0.0);
+        INSTRUMENT_END();
+        return result;
+    }
+    size_t index = 0;
+    for (; index + POLYVAL_LANES <= array->size; index += POLYVAL_LANES)
+    {
+        const double *x = array->data + index;
+        double value[POLYVAL_LANES];
+        for (size_t lane = 0; lane < POLYVAL_LANES; ++lane)
+            value[lane] = c[0];
+        for (size_t term = 1; term < degree_count; ++term)
+            for (size_t lane = 0; lane < POLYVAL_LANES; ++lane)
+                value[lane] = value[lane] * x[lane] + c[term];
+        memcpy(result.data + index, value, sizeof(value));
+    }
+    for (; index < array->size; ++index)
+    {
+        double value = c[0];
+        for (size_t term = 1; term < degree_count; ++term)
+            value = value * array->data[index] + c[term];
+        result.data[index] = value;
+    }
+    INSTRUMENT_END();
+    return result;
+}
+
+// Value on segment [xp[segment], xp[segment + 1]], or an end value outside the breakpoints
+double interpolate_segment(const double *xp, const double *fp, size_t count, size_t segment, double x)
+{
+    if (segment == 0)
+        return fp[0];                       // x < xp[0]
+    if (segment >= count)
+        return fp[count - 1];               // x >= xp[last]
+    size_t left = segment - 1;
+    double slope = (fp[left + 1] - fp[left]) / (xp[left + 1] - xp[left]);
+    return fp[left] + slope * (x - xp[left]);
+}
+
+bool is_nondecreasing(const CNumPyArray *array)
+{
+    for (size_t index = 1; index < array->size; ++index)
+        if (!(array->data[index - 1] <= array->data[index]))  // NaN also breaks the order
             return false;
     return true;
 }
 
-// Clip every value into range [min_value, max_value]
-CNumPyArray clip_array(const CNumPyArray *array, double min_value, double max_value)
+// Piecewise-linear interpolation of (xp, fp) at each element of array (numpy.interp)
+CNumPyArray interp_array(const CNumPyArray *array, const CNumPyArray *xp, const CNumPyArray *fp)
 {
-    CNumPyArray out = create_array(NULL, array->size);
+    INSTRUMENT_BEGIN(OP_INTERP, array->size);
+    if (xp->size == 0 || xp->size != fp->size)
+    {
+        fprintf(stderr, "interp: need the same nonzero number of breakpoints and values (%zu vs %zu)\n",
+                xp->size, fp->size);
+        exit(1);
+    }
+    require_increasing_edges(xp, "interp");
+    CNumPyArray result = allocate_array(array->size);
+    size_t count = xp->size;
+    if (is_nondecreasing(array))
+    {
+        // segment = number of breakpoints <= x, which only grows along sorted queries
+        size_t segment = 0;
+        for (size_t index = 0; index < array->size; ++index)
+        {
+            double x = array->data[index];
+            while (segment < count && xp->data[segment] <= x)
+                ++segment;
+            result.data[index] = interpolate_segment(xp->data, fp->data, count, segment, x);
+        }
+        INSTRUMENT_END();
+        return result;
+    }
     for (size_t index = 0; index < array->size; ++index)
     {
-        if (array->data[index] < min_value)
-            out.data[index] = min_value;
-        else if (array->data[index] > max_value)
-            out.data[index] = max_value;
-        else
-            out.data[index] = array->data[index];   // unmodified if in range
+        double x = array->data[index];
+        if (isnan(x))
+        {
+            result.data[index] = x;
+            continue;
+        }
+        size_t segment = count_edges_below(xp->data, count, x, false);
+        result.data[index] = interpolate_segment(xp->data, fp->data, count, segment, x);
     }
-    return out;
+    INSTRUMENT_END();
+    return result;
 }
 
-// Unique: return sorted unique values (slow method for demonstration)
-CNumPyArray unique_array(const CNumPyArray *array)
+// -------------------------- Sorted Search --------------------------
+//
+// searchsorted_array(sorted, queries, side) returns, for each query, the position where it
+// would be inserted to keep sorted in order (numpy.searchsorted): SEARCH_LEFT gives the first
+// position with sorted[i] >= query, SEARCH_RIGHT the first with sorted[i] > query. NaN queries
+// go to the end. Positions are returned as doubles, like digitize_array.
+// Three strategies:
+//   sorted queries   galloping from the previous answer, O(log distance) per query
+//   Eytzinger        for arrays beyond the caches with many queries: the values stored in
+//                    breadth-first order of the implicit binary search tree (children of node
+//                    k at 2k and 2k+1). The top of the tree shares a few cache lines, each step
+//                    is a conditional index update, and the nodes two levels down are
+//                    prefetched, so the memory latency of consecutive levels overlaps.
+//   otherwise        the branchless binary search on the sorted array itself
+// A SearchIndex keeps the Eytzinger layout so many query batches can reuse it. The sorted
+// position of a tree node is computed from its number, so no rank table has to be read.
+
+typedef enum { SEARCH_LEFT, SEARCH_RIGHT } SearchSide;
+
+#define EYTZINGER_PREFETCH_STRIDE 4     // node k's grandchildren, two levels down, start at 4k
+#define EYTZINGER_MIN_SIZE 131072       // below ~1 MiB plain binary search is as fast
+
+typedef struct {
+    double *layout;                     // layout[1..size] in Eytzinger order (layout[0] unused)
+    double *values;                     // sorted copy, for the sorted-query path
+    size_t size;
+} SearchIndex;
+
+void require_sorted(const CNumPyArray *sorted, const char *message)
 {
-    if (array->size == 0) return array_zeros(0);   // empty remains empty
-    CNumPyArray temp = copy_array(array);
+    if (!is_nondecreasing(sorted))
+    {
+        fprintf(stderr, "%s: array must be sorted in ascending order without NaN\n", message);
+        exit(1);
+    }
+}
 
-    // simple selection sort
-    for (size_t i = 0; i < temp.size; ++i)
+int highest_bit_index(uint64_t word)                    // word must not be zero
+{
+#if defined(__GNUC__)
+    return 63 - __builtin_clzll(word);
+#else
+    int index = 63;
+    while (!((word >> index) & 1))
+        index--;
+    return index;
+#endif
+}
+
+// Sorted position of Eytzinger node k (1 <= k <= size). In a perfect tree of `levels` levels,
+// node k at depth d has in-order rank (2 (k - 2^d) + 1) 2^(levels-1-d) - 1, and the last-level
+// slots sit at the even ranks. Subtract the missing last-level slots that precede k.
+size_t eytzinger_rank(size_t node, size_t size)
+{
+    int levels = highest_bit_index(size) + 1;
+    int depth = highest_bit_index(node);
+    size_t first_on_level = (size_t)1 << depth;
+    size_t rank = ((2 * (node - first_on_level) + 1) << (levels - 1 - depth)) - 1;
+    size_t present_last = size - ((size_t)1 << (levels - 1)) + 1;
+    size_t last_before = (rank + 1) / 2;
+    return last_before > present_last ? rank - (last_before - present_last) : rank;
+}
+
+// In-order walk of the implicit tree assigns the sorted values to their Eytzinger slots
+size_t fill_eytzinger(double *layout, size_t size, const double *sorted, size_t next, size_t node)
+{
+    if (node <= size)
     {
-        size_t min_index = i;
-        for (size_t j = i + 1; j < temp.size; ++j)
+        next = fill_eytzinger(layout, size, sorted, next, 2 * node);
+        layout[node] = sorted[next++];
+        next = fill_eytzinger(layout, size, sorted, next, 2 * node + 1);
+    }
+    return next;
+}
+
+SearchIndex create_search_index(const CNumPyArray *sorted)
+{
+    INSTRUMENT_BEGIN(OP_SEARCH_INDEX, sorted->size);
+    require_sorted(sorted, "create_search_index");
+    SearchIndex index;
+    index.size = sorted->size;
+    index.layout = allocate_or_exit((sorted->size + 1) * sizeof(double), false);
+    index.values = allocate_or_exit(sorted->size * sizeof(double), false);
+    memcpy(index.values, sorted->data, sorted->size * sizeof(double));
+    fill_eytzinger(index.layout, index.size, sorted->data, 0, 1);
+    INSTRUMENT_END();
+    return index;
+}
+
+void free_search_index(SearchIndex *index)
+{
+    free(index->layout);
+    free(index->values);
+    index->layout = NULL;
+    index->values = NULL;
+    index->size = 0;
+}
+
+// Eytzinger descent: go right past every node that sorts before the query. The answer is the
+// last node where the path went left, found by dropping the trailing right-turns (1 bits)
+// and that left turn from k. All complete levels are walked with a fixed trip count, and the
+// partial last level takes one conditional step, so the loop exit is always predicted.
+// Prefetch addresses may lie past the layout; they are formed as integers, and a prefetch
+// never faults.
+size_t eytzinger_search(const SearchIndex *index, double query, bool strict)
+{
+    const double *layout = index->layout;
+    size_t size = index->size, node = 1;
+    if (size == 0)
+        return 0;
+    uintptr_t base = (uintptr_t)layout;
+    int complete_levels = highest_bit_index(size);        // levels above the last one
+    if (strict)
+    {
+        for (int level = 0; level < complete_levels; ++level)
         {
-            if (temp.data[j] < temp.data[min_index])
-                min_index = j;
+            prefetch_address((const void *)(base + node * EYTZINGER_PREFETCH_STRIDE * sizeof(double)));
+            node = 2 * node + (layout[node] < query ? 1 : 0);
         }
-        double t = temp.data[i];
-        temp.data[i] = temp.data[min_index];
-        temp.data[min_index] = t;
     }
-    // unique extraction, always copy first element
-    double *unique_buffer = malloc(temp.size * sizeof(double));
-    size_t unique_size = 1;
-    unique_buffer[0] = temp.data[0];
-    for (size_t index = 1; index < temp.size; ++index)
+    else
     {
-        if (temp.data[index] != temp.data[index - 1])
+        for (int level = 0; level < complete_levels; ++level)
         {
-            unique_buffer[unique_size++] = temp.data[index];
+            prefetch_address((const void *)(base + node * EYTZINGER_PREFETCH_STRIDE * sizeof(double)));
+            node = 2 * node + (layout[node] <= query ? 1 : 0);
         }
     }
-    free_array(&temp);
-    CNumPyArray res;
-    res.size = unique_size;
-    res.data = realloc(unique_buffer, unique_size * sizeof(double)); // resize
-    return res;
+    bool inside = node <= size;
+    double last = layout[inside ? node : 0];
+    bool before = strict ? last < query : last <= query;
+    node = inside ? 2 * node + (before ? 1 : 0) : node;
+    node >>= lowest_bit_index(~(uint64_t)node) + 1;
+    return node == 0 ? size : eytzinger_rank(node, size);
 }
 
-// Sort array in-place
-void sort_array(CNumPyArray *array)
+// Galloping search for sorted queries: each answer is at or after the previous one
+void search_sorted_queries(const double *values, size_t count, const CNumPyArray *queries, bool strict, double *out)
 {
-    // simple selection sort for clarity
-    for (size_t i = 0; i + 1 < array->size; ++i)
+    size_t position = 0;
+    for (size_t query_index = 0; query_index < queries->size; ++query_index)
     {
-        size_t min_index = i;
-        for (size_t j = i + 1; j < array->size; ++j)
-            if (array->data[j] < array->data[min_index])
-                min_index = j;
-        double t = array->data[i];
-        array->data[i] = array->data[min_index];
-        array->data[min_index] = t;
+        double query = queries->data[query_index];
+        size_t low = position, high = position, step = 1;
+        while (high < count && (strict ? values[high] < query : values[high] <= query))
+        {
+            low = high + 1;
+            high += step;
+            step *= 2;
+        }
+        if (high > count)
+            high = count;
+        position = low + count_edges_below(values + low, high - low, query, strict);
+        out[query_index] = (double)position;
+    }
+}
+
+// Insertion positions of queries in an indexed sorted array
+CNumPyArray searchsorted_index(const SearchIndex *index, const CNumPyArray *queries, SearchSide side)
+{
+    INSTRUMENT_BEGIN(OP_SEARCHSORTED_INDEX, queries->size);
+    bool strict = side == SEARCH_LEFT;
+    CNumPyArray result = allocate_array(queries->size);
+    if (is_nondecreasing(queries))
+    {
+        search_sorted_queries(index->values, index->size, queries, strict, result.data);
+        INSTRUMENT_END();
+        return result;
+    }
+    for (size_t query_index = 0; query_index < queries->size; ++query_index)
+    {
+        double query = queries->data[query_index];
+        size_t position = isnan(query) ? index->size : eytzinger_search(index, query, strict);
+        result.data[query_index] = (double)position;
+    }
+    INSTRUMENT_END();
+    return result;
+}
+
+// Insertion positions of queries in an ascending array (numpy.searchsorted)
+CNumPyArray searchsorted_array(const CNumPyArray *sorted, const CNumPyArray *queries, SearchSide side)
+{
+    INSTRUMENT_BEGIN(OP_SEARCHSORTED, queries->size);
+    require_sorted(sorted, "searchsorted");
+    bool strict = side == SEARCH_LEFT;
+    if (is_nondecreasing(queries))
+    {
+        CNumPyArray result = allocate_array(queries->size);
+        search_sorted_queries(sorted->data, sorted->size, queries, strict, result.data);
+        INSTRUMENT_END();
+        return result;
+    }
+    // The layout only pays off once sorted outgrows the caches, and building it costs about
+    // one pass over sorted, so a one-off index needs many queries as well
+    if (sorted->size >= EYTZINGER_MIN_SIZE
+        && (double)queries->size * log2((double)sorted->size) >= (double)sorted->size)
+    {
+        SearchIndex index = create_search_index(sorted);
+        CNumPyArray result = searchsorted_index(&index, queries, side);
+        free_search_index(&index);
+        INSTRUMENT_END();
+        return result;
+    }
+    CNumPyArray result = allocate_array(queries->size);
+    for (size_t query_index = 0; query_index < queries->size; ++query_index)
+    {
+        double query = queries->data[query_index];
+        size_t position = isnan(query) ? sorted->size : count_edges_below(sorted->data, sorted->size, query, strict);
+        result.data[query_index] = (double)position;
     }
+    INSTRUMENT_END();
+    return result;
 }
 
-// -------------------------- Element-wise Operations (Array-Array) --------------------------
+// -------------------------- Arrow C Data Interface --------------------------
+//
+// Columns move between CNumPy and Apache Arrow producers and consumers through the Arrow C
+// Data Interface (the ArrowArray / ArrowSchema structs below, as published by Arrow):
+//   - export_arrow_array hands an array (and optionally a validity mask) to Arrow. As float64
+//     the buffers themselves are handed over: the caller's array and mask are emptied, and the
+//     consumer frees them through the release callback. float32 and int32/int64 exports
+//     convert into one new buffer.
+//   - import_arrow_array takes ownership of an ArrowArray of float64, float32 or any 8 to 64-bit
+//     integer type. float64 values are used in place; the other types (and float64 buffers that
+//     are not 8-byte aligned) are converted to doubles once, and the source is released right
+//     away. Integers above 2^53 lose precision. free_arrow_column calls the producer's release.
+// Arrow's validity bitmap uses the same bit order as CNumPyMask (least significant bit first),
+// so null slots map onto the masked operations: masked_sum_array(&column.values,
+// &column.validity) skips them. An imported bitmap is copied into a CNumPyMask, since it may
+// start at any bit offset and its padding bits are unspecified; it is 1/64 the size of the
+// values. Only flat, non-dictionary arrays are supported.
+
+#ifndef ARROW_C_DATA_INTERFACE
+#define ARROW_C_DATA_INTERFACE
+
+#define ARROW_FLAG_DICTIONARY_ORDERED 1
+#define ARROW_FLAG_NULLABLE 2
+#define ARROW_FLAG_MAP_KEYS_SORTED 4
+
+struct ArrowSchema {
+    // Array type description
+    const char *format;
+    const char *name;
+    const char *metadata;
+    int64_t flags;
+    int64_t n_children;
+    struct ArrowSchema **children;
+    struct ArrowSchema *dictionary;
+
+    // Release callback
+    void (*release)(struct ArrowSchema *);
+    // Opaque producer-specific data
+    void *private_data;
+};
+
+struct ArrowArray {
+    // Array data description
+    int64_t length;
+    int64_t null_count;
+    int64_t offset;
+    int64_t n_buffers;
+    int64_t n_children;
+    const void **buffers;
+    struct ArrowArray **children;
+    struct ArrowArray *dictionary;
+
+    // Release callback
+    void (*release)(struct ArrowArray *);
+    // Opaque producer-specific data
+    void *private_data;
+};
+
+#endif // ARROW_C_DATA_INTERFACE
 
-void require_same_size(const CNumPyArray *array1, const CNumPyArray *array2, const char *message)
-{
-    if (array1->size != array2->size)
-    {
-        fprintf(stderr, "%s: arrays sizes not equal (%zu, %zu)\n", message, array1->size, array2->size);
-        exit(1);
-    }
-}
+typedef enum { ARROW_FLOAT64, ARROW_FLOAT32, ARROW_INT32, ARROW_INT64 } ArrowExportType;
 
-CNumPyArray add_array(const CNumPyArray *array1, const CNumPyArray *array2)
+typedef struct {
+    CNumPyArray values;                 // float64 view of the column; release with free_arrow_column
+    CNumPyMask validity;                // true where a value is present (all true without nulls)
+    size_t null_count;
+    struct ArrowArray source;           // producer's array while values points into it
+    bool owns_values;                   // values were converted into a CNumPy array
+} ArrowColumn;
+
+// Producer state behind an exported ArrowArray
+typedef struct {
+    const void *buffers[2];             // validity bitmap (or NULL), values
+    CNumPyArray values;                 // float64 export: the caller's array, moved
+    void *converted;                    // other exports: the converted value buffer
+    CNumPyMask validity;                // moved from the caller
+} ArrowExport;
+
+void release_arrow_export(struct ArrowArray *array)
 {
-    require_same_size(array1, array2, "add");
-    CNumPyArray result = create_array(NULL, array1->size);     // allocate result
-    for (size_t index = 0; index < array1->size; ++index)
-        result.data[index] = array1->data[index] + array2->data[index];
-    return result;
+    ArrowExport *producer = array->private_data;
+    free_array(&producer->values);
+    free(producer->converted);
+    free_mask(&producer->validity);
+    free(producer);
+    array->release = NULL;              // marks the struct as released
 }
 
-CNumPyArray subtract_array(const CNumPyArray *array1, const CNumPyArray *array2)
+void release_arrow_schema(struct ArrowSchema *schema)
 {
-    require_same_size(array1, array2, "subtract");
-    CNumPyArray result = create_array(NULL, array1->size);
-    for (size_t index = 0; index < array1->size; ++index)
-        result.data[index] = array1->data[index] - array2->data[index];
-    return result;
+    schema->release = NULL;             // format and name are static strings
 }
 
-CNumPyArray multiply_array(const CNumPyArray *array1, const CNumPyArray *array2)
+void reject_arrow_value(double value, size_t index, const char *type_name)
 {
-    require_same_size(array1, array2, "multiply");
-    CNumPyArray result = create_array(NULL, array1->size);
-    for (size_t index = 0; index < array1->size; ++index)
-        result.data[index] = array1->data[index] * array2->data[index];
-    return result;
+    fprintf(stderr, "arrow export: value %f at index %zu is not a valid %s\n", value, index, type_name);
+    exit(1);
 }
 
-CNumPyArray divide_array(const CNumPyArray *array1, const CNumPyArray *array2)
+// Values converted for a non-float64 export; integers must be exact and in range (nulls become 0)
+void *convert_arrow_values(const CNumPyArray *array, const CNumPyMask *validity, ArrowExportType type)
 {
-    require_same_size(array1, array2, "divide");
-    CNumPyArray result = create_array(NULL, array1->size);
-    for (size_t index = 0; index < array1->size; ++index)
+    size_t element_bytes = type == ARROW_INT64 ? sizeof(int64_t) : 4;
+    void *buffer = allocate_or_exit(array->size * element_bytes, false);
+    for (size_t index = 0; index < array->size; ++index)
     {
-        if (array2->data[index] == 0.0)
-            result.data[index] = 0.0;                 // safe zero on division by zero
+        double value = array->data[index];
+        bool present = validity == NULL || mask_bit(validity, index);
+        if (type == ARROW_FLOAT32)
+        {
+            ((float *)buffer)[index] = (float)value;
+        }
+        else if (type == ARROW_INT32)
+        {
+            if (present && !(value == floor(value) && value >= -2147483648.0 && value <= 2147483647.0))
+                reject_arrow_value(value, index, "int32");
+            ((int32_t *)buffer)[index] = present ? (int32_t)value : 0;
+        }
         else
-            result.data[index] = array1->data[index] / array2->data[index];
+        {
+            if (present && !(value == floor(value) && value >= -9223372036854775808.0 && value < 9223372036854775808.0))
+                reject_arrow_value(value, index, "int64");
+            ((int64_t *)buffer)[index] = present ? (int64_t)value : 0;
+        }
     }
-    return result;
+    return buffer;
 }
 
-CNumPyArray modulo_array(const CNumPyArray *array1, const CNumPyArray *array2)
+// Hand array (and validity, which may be NULL for "no nulls") to an Arrow consumer. Both are
+// moved: afterwards they are empty, and out_array's release callback frees the memory.
+void export_arrow_array(CNumPyArray *array, CNumPyMask *validity, ArrowExportType type,
+                        struct ArrowArray *out_array, struct ArrowSchema *out_schema)
 {
-    require_same_size(array1, array2, "modulo");
-    CNumPyArray result = create_array(NULL, array1->size);
-    for (size_t index = 0; index < array1->size; ++index)
-        result.data[index] = fmod(array1->data[index], array2->data[index]);
-    return result;
-}
+    INSTRUMENT_BEGIN(OP_ARROW_EXPORT, array->size);
+    static const char *formats[] = {"g", "f", "i", "l"};
+    if (validity != NULL)
+        require_mask_size(array, validity, "arrow export");
+    size_t length = array->size;
+    ArrowExport *producer = allocate_or_exit(sizeof(ArrowExport), true);
+    if (type == ARROW_FLOAT64)
+    {
+        producer->values = *array;
+        producer->buffers[1] = producer->values.data;
+    }
+    else
+    {
+        producer->converted = convert_arrow_values(array, validity, type);
+        producer->buffers[1] = producer->converted;
+        free_array(array);
+    }
+    size_t null_count = 0;
+    if (validity != NULL)
+    {
+        null_count = length - count_mask(validity);
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+        for (size_t word = 0; word < mask_word_count(length); ++word)
+            validity->words[word] = __builtin_bswap64(validity->words[word]);    // Arrow bitmaps are byte-ordered
+#endif
+        producer->validity = *validity;
+        producer->buffers[0] = producer->validity.words;
+        validity->words = NULL;
+        validity->size = 0;
+    }
+    array->data = NULL;
+    array->size = 0;
 
-// -------------------------- Element-wise Operations (Array-Scalar) --------------------------
+    out_array->length = (int64_t)length;
+    out_array->null_count = (int64_t)null_count;
+    out_array->offset = 0;
+    out_array->n_buffers = 2;
+    out_array->n_children = 0;
+    out_array->buffers = producer->buffers;
+    out_array->children = NULL;
+    out_array->dictionary = NULL;
+    out_array->release = release_arrow_export;
+    out_array->private_data = producer;
 
-CNumPyArray add_scalar(const CNumPyArray *array, double value)
+    out_schema->format = formats[type];
+    out_schema->name = "";
+    out_schema->metadata = NULL;
+    out_schema->flags = ARROW_FLAG_NULLABLE;
+    out_schema->n_children = 0;
+    out_schema->children = NULL;
+    out_schema->dictionary = NULL;
+    out_schema->release = release_arrow_schema;
+    out_schema->private_data = NULL;
+    INSTRUMENT_END();
+}
+
+// Validity as a CNumPyMask, starting at bit offset of an Arrow bitmap (NULL means all valid)
+CNumPyMask import_arrow_validity(const uint8_t *bitmap, size_t offset, size_t length)
 {
-    CNumPyArray result = create_array(NULL, array->size);
-    for (size_t index = 0; index < array->size; ++index)
-        result.data[index] = array->data[index] + value;
-    return result;
+    CNumPyMask mask = create_mask(length);
+    size_t word_count = mask_word_count(length);
+    if (bitmap == NULL)
+    {
+        for (size_t word = 0; word < word_count; ++word)
+            mask.words[word] = ~(uint64_t)0;
+    }
+    else
+    {
+        size_t byte_count = (offset + length + 7) / 8;  // bytes of the bitmap that hold our bits
+        size_t shift = offset % 8;
+        for (size_t word = 0; word < word_count; ++word)
+        {
+            uint64_t bits = 0;
+            for (size_t part = 0; part < 8; ++part)
+            {
+                size_t byte = offset / 8 + word * 8 + part;
+                if (byte >= byte_count)
+                    break;
+                unsigned value = bitmap[byte] >> shift;
+                if (shift != 0 && byte + 1 < byte_count)
+                    value |= (unsigned)bitmap[byte + 1] << (8 - shift);
+                bits |= (uint64_t)(value & 0xFF) << (8 * part);
+            }
+            mask.words[word] = bits;
+        }
+    }
+    if (length % 64 != 0)
+        mask.words[word_count - 1] &= ((uint64_t)1 << (length % 64)) - 1;  // keep unused bits zero
+    return mask;
 }
-CNumPyArray subtract_scalar(const CNumPyArray *array, double value)
+
+// Element width in bytes of a supported Arrow format, 0 if unsupported
+size_t arrow_format_width(const char *format)
 {
-    CNumPyArray result = create_array(NULL, array->size);
-    for (size_t index = 0; index < array->size; ++index)
-        result.data[index] = array->data[index] - value;
-    return result;
+    if (format == NULL || format[0] == '\0' || format[1] != '\0')
+        return 0;
+    switch (format[0])
+    {
+        case 'g': case 'l': case 'L': return 8;
+        case 'f': case 'i': case 'I': return 4;
+        case 's': case 'S': return 2;
+        case 'c': case 'C': return 1;
+        default: return 0;
+    }
 }
-CNumPyArray multiply_scalar(const CNumPyArray *array, double value)
+
+// Element index of an Arrow value buffer as a double; buffers need not be aligned
+double arrow_value(const char *values, char format, size_t width, size_t index)
 {
-    CNumPyArray result = create_array(NULL, array->size);
-    for (size_t index = 0; index < array->size; ++index)
-        result.data[index] = array->data[index] * value;
-    return result;
+    const char *element = values + index * width;
+    switch (format)
+    {
+        case 'g': { double value; memcpy(&value, element, sizeof(value)); return value; }
+        case 'f': { float value; memcpy(&value, element, sizeof(value)); return value; }
+        case 'l': { int64_t value; memcpy(&value, element, sizeof(value)); return (double)value; }
+        case 'L': { uint64_t value; memcpy(&value, element, sizeof(value)); return (double)value; }
+        case 'i': { int32_t value; memcpy(&value, element, sizeof(value)); return value; }
+        case 'I': { uint32_t value; memcpy(&value, element, sizeof(value)); return value; }
+        case 's': { int16_t value; memcpy(&value, element, sizeof(value)); return value; }
+        case 'S': { uint16_t value; memcpy(&value, element, sizeof(value)); return value; }
+        case 'c': return (int8_t)*element;
+        default:  return (uint8_t)*element;
+    }
 }
-CNumPyArray divide_scalar(const CNumPyArray *array, double value)
+
+// Take ownership of array (it is marked released); the schema is only read
+ArrowColumn import_arrow_array(struct ArrowArray *array, const struct ArrowSchema *schema)
 {
-    CNumPyArray result = create_array(NULL, array->size);
-    for (size_t index = 0; index < array->size; ++index)
-        result.data[index] = value == 0.0 ? 0.0 : array->data[index] / value;
-    return result;
+    INSTRUMENT_BEGIN(OP_ARROW_IMPORT, (size_t)array->length);
+    size_t width = arrow_format_width(schema->format);
+    if (array->release == NULL || width == 0 || array->n_buffers != 2 || array->n_children != 0
+        || array->dictionary != NULL || array->length < 0 || array->offset < 0)
+    {
+        fprintf(stderr, "arrow import: need a live flat array of float64, float32 or integers (format '%s')\n",
+                schema->format != NULL ? schema->format : "");
+        exit(1);
+    }
+    ArrowColumn column;
+    memset(&column, 0, sizeof(column));
+    column.source = *array;
+    array->release = NULL;
+    size_t length = (size_t)column.source.length, offset = (size_t)column.source.offset;
+    char format = schema->format[0];
+    const char *values = length > 0 ? (const char *)column.source.buffers[1] + offset * width : NULL;
+
+    column.validity = import_arrow_validity(column.source.null_count != 0 ? column.source.buffers[0] : NULL, offset, length);
+    column.null_count = length - count_mask(&column.validity);
+    if (format == 'g' && length > 0 && (uintptr_t)values % sizeof(double) == 0)
+    {
+        column.values.data = (double *)values;          // used in place; read-only by Arrow's rules
+        column.values.size = length;
+    }
+    else
+    {
+        column.values = allocate_array(length);
+        for (size_t index = 0; index < length; ++index)
+            column.values.data[index] = arrow_value(values, format, width, index);
+        column.owns_values = true;
+        column.source.release(&column.source);
+        column.source.release = NULL;
+    }
+    INSTRUMENT_END();
+    return column;
 }
-CNumPyArray modulo_scalar(const CNumPyArray *array, double value)
+
+void free_arrow_column(ArrowColumn *column)
 {
-    CNumPyArray result = create_array(NULL, array->size);
-    for (size_t index = 0; index < array->size; ++index)
-        result.data[index] = fmod(array->data[index], value);
-    return result;
+    if (column->owns_values)
+        free_array(&column->values);
+    if (column->source.release != NULL)
+        column->source.release(&column->source);
+    free_mask(&column->validity);
+    memset(column, 0, sizeof(*column));
 }
 
-// -------------------------- Element-wise Math Functions --------------------------
+// -------------------------- Benchmark Harness --------------------------
+//
+// Compiling with -DCNUMPY_BENCH builds a benchmark program instead of the demo (the "bench"
+// build; see the Usage notes at the top of the file):
+//   gcc -O2 -DCNUMPY_BENCH cnumpy_allinone.c -o cnumpy_bench -lm
+//   ./cnumpy_bench [--json] [--min-size N] [--max-size N] [--time SECONDS] [--cpu K] [--filter TEXT]
+// Every case runs at sizes 16, 64, 256, ... up to --max-size (default 2^24; up to 1e9 works
+// if memory allows). Per case and size: one warm-up run, then repetitions until --time
+// seconds (default 0.05) have passed, with at least 5 and at most 1000 runs. Reported:
+// median and p99 ns per element, GB/s from the bytes each element moves, and time-stamp
+// counter cycles per element. --cpu pins the process to one CPU (Linux); --json prints one
+// machine-readable document for regression tracking. Result allocation is part of every
+// timed run, as it is for callers. sort_array and unique_array are quadratic selection sorts
+// and stop at 4096 elements.
 
-typedef double (*UnaryFunction)(double);
+#if defined(CNUMPY_BENCH)
 
-CNumPyArray apply_unary(const CNumPyArray *array, UnaryFunction f)
-{
-    CNumPyArray result = create_array(NULL, array->size);
-    for (size_t index = 0; index < array->size; ++index)
-        result.data[index] = f(array->data[index]);
-    return result;
-}
+#define BENCH_DEFAULT_MAX_SIZE 16777216 // 2^24 elements
+#define BENCH_DEFAULT_SECONDS 0.05      // measuring time per case and size
+#define BENCH_MIN_REPEATS 5
+#define BENCH_MAX_REPEATS 1000
+#define BENCH_QUADRATIC_LIMIT 4096      // largest size for the selection-sort based cases
 
-CNumPyArray absolute_array(const CNumPyArray *array)   { return apply_unary(array, fabs); }
-CNumPyArray sin_array(const CNumPyArray *array)        { return apply_unary(array, sin); }
-CNumPyArray cos_array(const CNumPyArray *array)        { return apply_unary(array, cos); }
-CNumPyArray tan_array(const CNumPyArray *array)        { return apply_unary(array, tan); }
-CNumPyArray asin_array(const CNumPyArray *array)       { return apply_unary(array, asin); }
-CNumPyArray acos_array(const CNumPyArray *array)       { return apply_unary(array, acos); }
-CNumPyArray atan_array(const CNumPyArray *array)       { return apply_unary(array, atan); }
-CNumPyArray exp_array(const CNumPyArray *array)        { return apply_unary(array, exp); }
-CNumPyArray log_array(const CNumPyArray *array)        { return apply_unary(array, log); }
-CNumPyArray log10_array(const CNumPyArray *array)      { return apply_unary(array, log10); }
-CNumPyArray sqrt_array(const CNumPyArray *array)       { return apply_unary(array, sqrt); }
-CNumPyArray floor_array(const CNumPyArray *array)      { return apply_unary(array, floor); }
-CNumPyArray ceil_array(const CNumPyArray *array)       { return apply_unary(array, ceil); }
-CNumPyArray round_array(const CNumPyArray *array)      { return apply_unary(array, round); }
+typedef struct {
+    CNumPyArray first;                  // uniform in [0.5, 1.5), safe for sqrt, log and divide
+    CNumPyArray second;
+    size_t *indices;                    // room for argsort output
+    volatile double sink;               // keeps scalar results alive
+} BenchInputs;
 
-CNumPyArray pow_array(const CNumPyArray *array, double value)
-{
-    CNumPyArray result = create_array(NULL, array->size);
-    for (size_t index = 0; index < array->size; ++index)
-        result.data[index] = pow(array->data[index], value);
-    return result;
-}
+typedef void (*BenchFunction)(BenchInputs *inputs);
 
-// -------------------------- Aggregation & Statistics --------------------------
+typedef struct {
+    const char *family;
+    const char *name;
+    double bytes_per_element;           // memory traffic per element, for GB/s
+    size_t max_size;                    // 0 = no limit
+    BenchFunction run;
+} BenchCase;
 
-double sum_array(const CNumPyArray *array)
+typedef struct {
+    size_t repeats;
+    double median_seconds;
+    double p99_seconds;
+    double min_seconds;
+    double median_cycles;
+#if defined(CNUMPY_PERF)
+    PerfReading counters;               // summed over the timed runs
+#endif
+} BenchTiming;
+
+#if defined(CNUMPY_PERF)
+PerfCounters bench_perf_counters;       // the benchmark thread's counter group
+#endif
+
+double bench_square(double value) { return value * value; }
+
+void bench_zeros(BenchInputs *in)        { CNumPyArray r = array_zeros(in->first.size); free_array(&r); }
+void bench_ones(BenchInputs *in)         { CNumPyArray r = array_ones(in->first.size); free_array(&r); }
+void bench_range(BenchInputs *in)        { CNumPyArray r = array_range(0.0, (double)in->first.size, 1.0); free_array(&r); }
+void bench_copy(BenchInputs *in)         { CNumPyArray r = copy_array(&in->first); free_array(&r); }
+void bench_add(BenchInputs *in)          { CNumPyArray r = add_array(&in->first, &in->second); free_array(&r); }
+void bench_divide(BenchInputs *in)       { CNumPyArray r = divide_array(&in->first, &in->second); free_array(&r); }
+void bench_multiply_scalar(BenchInputs *in) { CNumPyArray r = multiply_scalar(&in->first, 1.5); free_array(&r); }
+void bench_pow_square(BenchInputs *in)   { CNumPyArray r = pow_array(&in->first, 2.0); free_array(&r); }
+void bench_clip(BenchInputs *in)         { CNumPyArray r = clip_array(&in->first, 0.75, 1.25); free_array(&r); }
+void bench_sin(BenchInputs *in)          { CNumPyArray r = sin_array(&in->first); free_array(&r); }
+void bench_apply_sqrt(BenchInputs *in)   { CNumPyArray r = apply_unary(&in->first, sqrt); free_array(&r); }
+void bench_apply_callback(BenchInputs *in) { CNumPyArray r = apply_unary(&in->first, bench_square); free_array(&r); }
+void bench_sum(BenchInputs *in)          { in->sink = sum_array(&in->first); }
+void bench_sum_pairwise(BenchInputs *in) { in->sink = sum_array_mode(&in->first, SUMMATION_PAIRWISE); }
+void bench_max(BenchInputs *in)          { in->sink = max_array(&in->first); }
+void bench_argmax(BenchInputs *in)       { in->sink = (double)argmax_array(&in->first); }
+void bench_variance(BenchInputs *in)     { in->sink = variance_array(&in->first); }
+void bench_sort(BenchInputs *in)         { CNumPyArray r = copy_array(&in->first); sort_array(&r); free_array(&r); }
+void bench_unique(BenchInputs *in)       { CNumPyArray r = unique_array(&in->first); free_array(&r); }
+void bench_argsort(BenchInputs *in)      { argsort_array(&in->first, in->indices); }
+void bench_median(BenchInputs *in)       { in->sink = median_array(&in->first, NULL); }
+void bench_dot(BenchInputs *in)          { in->sink = dot_array(&in->first, &in->second); }
+void bench_norm(BenchInputs *in)         { in->sink = l2_norm(&in->first); }
+
+const BenchCase bench_cases[] = {
+    {"creation",   "array_zeros",             8.0, 0, bench_zeros},
+    {"creation",   "array_ones",              8.0, 0, bench_ones},
+    {"creation",   "array_range",             8.0, 0, bench_range},
+    {"creation",   "copy_array",             16.0, 0, bench_copy},
+    {"arithmetic", "add_array",              24.0, 0, bench_add},
+    {"arithmetic", "divide_array",           24.0, 0, bench_divide},
+    {"arithmetic", "multiply_scalar",        16.0, 0, bench_multiply_scalar},
+    {"arithmetic", "pow_array(x, 2)",        16.0, 0, bench_pow_square},
+    {"arithmetic", "clip_array",             16.0, 0, bench_clip},
+    {"unary",      "sin_array",              16.0, 0, bench_sin},
+    {"unary",      "apply_unary(sqrt)",      16.0, 0, bench_apply_sqrt},
+    {"unary",      "apply_unary(callback)",  16.0, 0, bench_apply_callback},
+    {"reduction",  "sum_array",               8.0, 0, bench_sum},
+    {"reduction",  "sum_array_mode(pairwise)", 8.0, 0, bench_sum_pairwise},
+    {"reduction",  "max_array",               8.0, 0, bench_max},
+    {"reduction",  "argmax_array",            8.0, 0, bench_argmax},
+    {"reduction",  "variance_array",         16.0, 0, bench_variance},
+    {"sort",       "sort_array",             16.0, BENCH_QUADRATIC_LIMIT, bench_sort},
+    {"sort",       "unique_array",           24.0, BENCH_QUADRATIC_LIMIT, bench_unique},
+    {"sort",       "argsort_array",          16.0, 0, bench_argsort},
+    {"sort",       "median_array",           16.0, 0, bench_median},
+    {"linalg",     "dot_array",              16.0, 0, bench_dot},
+    {"linalg",     "l2_norm",                 8.0, 0, bench_norm},
+};
+
+int compare_doubles(const void *first, const void *second)
 {
-    double s = 0.0;
-    for (size_t index = 0; index < array->size; ++index)
-        s += array->data[index];                          // accumulate
-    return s;
+    double a = *(const double *)first, b = *(const double *)second;
+    return (a > b) - (a < b);
 }
 
-double product_array(const CNumPyArray *array)
+// Value at percentile (0..100) of sorted samples, nearest-rank
+double sample_percentile(const double *sorted, size_t count, double percentile)
 {
-    double p = 1.0;
-    for (size_t index = 0; index < array->size; ++index)
-        p *= array->data[index];                          // multiply over all
-    return p;
+    size_t rank = (size_t)ceil(percentile / 100.0 * (double)count);
+    return sorted[rank > 0 ? rank - 1 : 0];
 }
 
-double mean_array(const CNumPyArray *array)
+BenchTiming time_bench_case(const BenchCase *bench, BenchInputs *inputs, double budget_seconds)
 {
-    return sum_array(array) / array->size;                // arithmetic mean
+    double *seconds = allocate_or_exit(BENCH_MAX_REPEATS * sizeof(double), false);
+    double *cycles = allocate_or_exit(BENCH_MAX_REPEATS * sizeof(double), false);
+    bench->run(inputs);                                     // warm-up: caches, page faults, plans
+    BenchTiming timing;
+    memset(&timing, 0, sizeof(timing));
+    double total = 0.0;
+    while (timing.repeats < BENCH_MAX_REPEATS && (timing.repeats < BENCH_MIN_REPEATS || total < budget_seconds))
+    {
+#if defined(CNUMPY_PERF)
+        PerfSample counters_before = read_perf_counters(&bench_perf_counters);
+#endif
+        struct timespec start;
+        current_time(&start);
+        uint64_t first_cycle = read_cycle_counter();
+        bench->run(inputs);
+        uint64_t last_cycle = read_cycle_counter();
+        seconds[timing.repeats] = elapsed_seconds(&start);
+#if defined(CNUMPY_PERF)
+        PerfSample counters_after = read_perf_counters(&bench_perf_counters);
+        PerfReading reading = perf_difference(&bench_perf_counters, &counters_before, &counters_after);
+        add_perf_reading(&timing.counters, &reading);
+#endif
+        cycles[timing.repeats] = (double)(last_cycle - first_cycle);
+        total += seconds[timing.repeats];
+        timing.repeats++;
+    }
+    qsort(seconds, timing.repeats, sizeof(double), compare_doubles);
+    qsort(cycles, timing.repeats, sizeof(double), compare_doubles);
+    timing.median_seconds = sample_percentile(seconds, timing.repeats, 50.0);
+    timing.p99_seconds = sample_percentile(seconds, timing.repeats, 99.0);
+    timing.min_seconds = seconds[0];
+    timing.median_cycles = sample_percentile(cycles, timing.repeats, 50.0);
+    free(seconds);
+    free(cycles);
+    return timing;
 }
 
-double max_array(const CNumPyArray *array)
+bool pin_to_cpu(int cpu)
 {
-    double max_value = array->data[0];
-    for (size_t index = 1; index < array->size; ++index)
-        if (array->data[index] > max_value)
-            max_value = array->data[index];               // update if larger
-    return max_value;
+#if defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return sched_setaffinity(0, sizeof(set), &set) == 0;
+#else
+    (void)cpu;
+    return false;
+#endif
 }
 
-double min_array(const CNumPyArray *array)
+size_t parse_size_option(const char *text, const char *option)
 {
-    double min_value = array->data[0];
-    for (size_t index = 1; index < array->size; ++index)
-        if (array->data[index] < min_value)
-            min_value = array->data[index];
-    return min_value;
+    char *end;
+    double value = strtod(text, &end);                      // accepts 1e9 as well as 1000000000
+    if (end == text || *end != '\0' || value < 1.0)
+    {
+        fprintf(stderr, "%s: expected a positive size, got '%s'\n", option, text);
+        exit(1);
+    }
+    return (size_t)value;
 }
 
-size_t argmax_array(const CNumPyArray *array)
+int run_benchmarks(int argc, char **argv)
 {
-    size_t argmax_index = 0;
-    double max_value = array->data[0];
-    for (size_t index = 1; index < array->size; ++index)
-        if (array->data[index] > max_value)
+    bool json = false;
+    size_t min_size = 16, max_size = BENCH_DEFAULT_MAX_SIZE;
+    double budget_seconds = BENCH_DEFAULT_SECONDS;
+    int cpu = -1;
+    const char *filter = NULL;
+    for (int argument = 1; argument < argc; ++argument)
+    {
+        const char *option = argv[argument];
+        bool has_value = argument + 1 < argc;
+        if (strcmp(option, "--json") == 0)
+            json = true;
+        else if (strcmp(option, "--min-size") == 0 && has_value)
+            min_size = parse_size_option(argv[++argument], option);
+        else if (strcmp(option, "--max-size") == 0 && has_value)
+            max_size = parse_size_option(argv[++argument], option);
+        else if (strcmp(option, "--time") == 0 && has_value)
+            budget_seconds = atof(argv[++argument]);
+        else if (strcmp(option, "--cpu") == 0 && has_value)
+            cpu = atoi(argv[++argument]);
+        else if (strcmp(option, "--filter") == 0 && has_value)
+            filter = argv[++argument];
+        else
         {
-            argmax_index = index;
-            max_value = array->data[index];
+            bool help = strcmp(option, "--help") == 0;
+            fprintf(help ? stdout : stderr, "usage: %s [--json] [--min-size N] [--max-size N] [--time SECONDS] "
+                    "[--cpu K] [--filter TEXT]\n", argv[0]);
+            return help ? 0 : 1;
         }
-    return argmax_index;
-}
+    }
+    if (cpu >= 0 && !pin_to_cpu(cpu))
+    {
+        fprintf(stderr, "warning: could not pin to CPU %d, running unpinned\n", cpu);
+        cpu = -1;
+    }
+#if defined(CNUMPY_PERF)
+    bench_perf_counters = open_perf_counters();
+    if (bench_perf_counters.slot_count == 0)
+        fprintf(stderr, "warning: no hardware counters (no PMU, or kernel.perf_event_paranoid too high)\n");
+#endif
 
-size_t argmin_array(const CNumPyArray *array)
-{
-    size_t argmin_index = 0;
-    double min_value = array->data[0];
-    for (size_t index = 1; index < array->size; ++index)
-        if (array->data[index] < min_value)
+    if (json)
+        printf("{\n  \"cpu\": %d,\n  \"cycle_counter\": \"%s\",\n  \"results\": [", cpu, has_cycle_counter() ? "tsc" : "none");
+    else
+    {
+        printf("%-11s %-26s %11s %8s %10s %10s %8s %10s", "family", "case", "size", "repeats",
+               "ns/elem", "p99 ns/el", "GB/s", "cycles/el");
+#if defined(CNUMPY_PERF)
+        print_perf_header(stdout);
+#endif
+        printf("\n");
+    }
+    bool first_record = true;
+    RandomGenerator generator = create_random_generator(12345, RANDOM_PHILOX);
+    for (size_t size = min_size; size <= max_size; size = size * 4 > max_size && size < max_size ? max_size : size * 4)
+    {
+        BenchInputs inputs;
+        inputs.first = random_uniform_array(&generator, size, 0.5, 1.5);
+        inputs.second = random_uniform_array(&generator, size, 0.5, 1.5);
+        inputs.indices = allocate_or_exit(size * sizeof(size_t), false);
+        inputs.sink = 0.0;
+        for (size_t case_index = 0; case_index < sizeof(bench_cases) / sizeof(bench_cases[0]); ++case_index)
         {
-            argmin_index = index;
-            min_value = array->data[index];
+            const BenchCase *bench = &bench_cases[case_index];
+            if (bench->max_size != 0 && size > bench->max_size)
+                continue;
+            if (filter != NULL && strstr(bench->name, filter) == NULL && strstr(bench->family, filter) == NULL)
+                continue;
+            BenchTiming timing = time_bench_case(bench, &inputs, budget_seconds);
+            double per_element = 1e9 * timing.median_seconds / (double)size;
+            double p99_per_element = 1e9 * timing.p99_seconds / (double)size;
+            double gigabytes = bench->bytes_per_element * (double)size / timing.median_seconds / 1e9;
+            double cycles_per_element = timing.median_cycles / (double)size;
+            if (json)
+            {
+                printf("%s\n    {\"family\": \"%s\", \"name\": \"%s\", \"size\": %zu, \"repeats\": %zu, "
+                       "\"median_ns_per_element\": %.4g, \"p99_ns_per_element\": %.4g, \"min_ns_per_element\": %.4g, "
+                       "\"gb_per_s\": %.4g, \"cycles_per_element\": %.4g",
+                       first_record ? "" : ",", bench->family, bench->name, size, timing.repeats, per_element,
+                       p99_per_element, 1e9 * timing.min_seconds / (double)size, gigabytes, cycles_per_element);
+                first_record = false;
+            }
+            else
+            {
+                printf("%-11s %-26s %11zu %8zu %10.3f %10.3f %8.2f %10.2f", bench->family, bench->name, size,
+                       timing.repeats, per_element, p99_per_element, gigabytes, cycles_per_element);
+            }
+#if defined(CNUMPY_PERF)
+            print_perf_reading(stdout, &timing.counters, (double)timing.repeats * (double)size, json);
+#endif
+            printf(json ? "}" : "\n");
+            fflush(stdout);
         }
-    return argmin_index;
-}
-
-double variance_array(const CNumPyArray *array)
-{
-    double mu = mean_array(array);
-    double s2 = 0.0;
-    for (size_t index = 0; index < array->size; ++index)
-        s2 += (array->data[index] - mu) * (array->data[index] - mu);
-    return s2 / array->size;
-}
-double std_array(const CNumPyArray *array)
-{
-    return sqrt(variance_array(array));    // stddev
+        free_array(&inputs.first);
+        free_array(&inputs.second);
+        free(inputs.indices);
+        if (size == max_size)
+            break;
+    }
+    if (json)
+        printf("\n  ]\n}\n");
+#if defined(CNUMPY_PERF)
+    close_perf_counters(&bench_perf_counters);
+#endif
+    fft_clear_plan_cache();
+    return 0;
 }
 
-// -------------------------- Linear Algebra --------------------------
-
-double dot_array(const CNumPyArray *array1, const CNumPyArray *array2)
+int main(int argc, char **argv)
 {
-    require_same_size(array1, array2, "dot");
-    double sum = 0.0;
-    for (size_t index = 0; index < array1->size; ++index)
-        sum += array1->data[index] * array2->data[index];
-    return sum;
+    return run_benchmarks(argc, argv);
 }
 
-// Compute L2 norm (Euclidean)
-double l2_norm(const CNumPyArray *array)
-{
-    double s = 0.0;
-    for (size_t index = 0; index < array->size; ++index)
-        s += array->data[index] * array->data[index];   // accumulate square
-    return sqrt(s);
-}
+#endif // CNUMPY_BENCH
 
 // -------------------------- Demo/Main --------------------------
+//
+// Left out of the benchmark build and of programs that include this file as a library
+// (-DCNUMPY_NO_MAIN, e.g. the Python extension in cnumpy_python.c).
+
+#if !defined(CNUMPY_BENCH) && !defined(CNUMPY_NO_MAIN)
 
 int main(void)
 {
@@ -540,6 +6217,12 @@ int main(void)
     CNumPyArray clipped = clip_array(&array1, 3, 8);
     printf("Clip array1 to [3, 8]: ");
     print_array(&clipped, 1);
+    clip_array_inplace(&clipped, 4, 6);                                             // no new allocation
+    printf("Clip that again to [4, 6] in place: ");
+    print_array(&clipped, 1);
+    CNumPyArray normalized = affine_clip_array(&array1, 0.1, -0.5, 0.0, 0.4);       // clip(array1 * 0.1 - 0.5) in one pass
+    printf("clip(array1 * 0.1 - 0.5, 0, 0.4): ");
+    print_array(&normalized, 2);
 
     CNumPyArray array1_plus100 = add_scalar(&array1, 100);
     printf("array1 + 100 = ");
@@ -571,6 +6254,173 @@ int main(void)
     // Any and All
     printf("array1 any: %d, all: %d\n", any_array(&array1), all_array(&array_add));
 
+    // Cumulative demo
+    CNumPyArray cumulative_sum = cumsum_array(&array1);
+    printf("Cumulative sum of array1: ");
+    print_array(&cumulative_sum, 0);
+    CNumPyArray differences = diff_array(&cumulative_sum);
+    printf("Differences of cumulative sum: ");
+    print_array(&differences, 0);
+
+    // Median and percentile demo (selection, no full sort)
+    double quartile_values[] = {25.0, 50.0, 75.0};
+    CNumPyArray quartile_levels = create_array(quartile_values, 3);
+    CNumPyArray quartiles = percentile_array(&with_duplicates, &quartile_levels, NULL);
+    printf("Median of duplicates: %.1f, quartiles: ", median_array(&with_duplicates, NULL));
+    print_array(&quartiles, 2);
+
+    // Top-k and argsort demo
+    size_t top_indices[3];
+    CNumPyArray top_values = topk_array(&with_duplicates, 3, top_indices);
+    printf("Top 3 of duplicates: ");
+    print_array(&top_values, 0);
+    printf("  at indices %zu, %zu, %zu\n", top_indices[0], top_indices[1], top_indices[2]);
+    size_t sorted_order[7];
+    argsort_array(&with_duplicates, sorted_order);
+    printf("Argsort of duplicates:");
+    for (size_t index = 0; index < with_duplicates.size; ++index)
+        printf(" %zu", sorted_order[index]);
+    printf("\n");
+
+    // Streaming quantile sketch demo: feed batches, merge, serialize
+    QuantileSketch sketch = create_quantile_sketch(QUANTILE_SKETCH_DEFAULT_COMPRESSION);
+    QuantileSketch other_sketch = create_quantile_sketch(QUANTILE_SKETCH_DEFAULT_COMPRESSION);
+    quantile_sketch_add(&sketch, &array1);
+    quantile_sketch_add(&other_sketch, &with_duplicates);
+    quantile_sketch_merge(&sketch, &other_sketch);
+    unsigned char *sketch_bytes;
+    size_t sketch_byte_count = quantile_sketch_serialize(&sketch, &sketch_bytes);
+    QuantileSketch restored_sketch = quantile_sketch_deserialize(sketch_bytes, sketch_byte_count);
+    printf("Sketch of array1 + duplicates (%zu bytes): p50 = %.2f, p99 = %.2f\n", sketch_byte_count,
+           quantile_sketch_percentile(&restored_sketch, 50.0), quantile_sketch_percentile(&restored_sketch, 99.0));
+    free(sketch_bytes);
+    free_quantile_sketch(&sketch);
+    free_quantile_sketch(&other_sketch);
+    free_quantile_sketch(&restored_sketch);
+
+    // Histogram demo
+    CNumPyArray value_counts = histogram_array(&with_duplicates, 4, 2.0, 6.0);
+    printf("Histogram of duplicates, 4 bins over [2, 6]: ");
+    print_array(&value_counts, 0);
+    CNumPyArray occurrences = bincount_array(&with_duplicates, 0);
+    printf("Bincount of duplicates: ");
+    print_array(&occurrences, 0);
+
+    // Mask demo: select elements above 5 and work only on them
+    CNumPyMask above_five = greater_scalar(&array1, 5.0);
+    CNumPyArray above_five_values = mask_to_array(&above_five);
+    printf("array1 > 5: ");
+    print_array(&above_five_values, 0);
+    printf("Count %zu, masked sum %.2f, masked mean %.2f\n", count_mask(&above_five),
+           masked_sum_array(&array1, &above_five), masked_mean_array(&array1, &above_five));
+    CNumPyArray mixed_values = where_array(&above_five, &array1, &array_add);
+    printf("where(array1 > 5, array1, array1 + 1): ");
+    print_array(&mixed_values, 0);
+
+    // Compress / take demo
+    CNumPyArray selected_values = compress_array(&array1, &above_five);
+    printf("compress(array1, array1 > 5): ");
+    print_array(&selected_values, 0);
+    CNumPyArray sorted_duplicates = take_array(&with_duplicates, sorted_order, with_duplicates.size);
+    printf("take(duplicates, argsort(duplicates)): ");
+    print_array(&sorted_duplicates, 0);
+
+    // Summation modes demo: 1e16 + 1 - 1e16 loses the 1 in plain double arithmetic
+    double cancelling_values[] = {1e16, 1.0, -1e16};
+    CNumPyArray cancelling = create_array(cancelling_values, 3);
+    printf("Sum of [1e16, 1, -1e16]: fast %.1f, pairwise %.1f, neumaier %.1f, exact %.1f\n",
+           sum_array_mode(&cancelling, SUMMATION_FAST), sum_array_mode(&cancelling, SUMMATION_PAIRWISE),
+           sum_array_mode(&cancelling, SUMMATION_NEUMAIER), sum_array_mode(&cancelling, SUMMATION_EXACT));
+
+    // Random number demo: a seeded counter-based generator
+    RandomGenerator generator = create_random_generator(2024, RANDOM_PHILOX);
+    CNumPyArray noise = random_normal_array(&generator, 5, 0.0, 1.0);
+    printf("Five standard normal draws: ");
+    print_array(&noise, 3);
+    CNumPyArray dice = random_integers_array(&generator, 10, 1, 7);
+    printf("Ten dice rolls: ");
+    print_array(&dice, 0);
+
+    // Allocation policy demo: large arrays on 2 MiB pages, interleaved over NUMA nodes
+    AllocationPolicy previous_policy = get_allocation_policy();
+    AllocationPolicy large_policy = {true, PLACEMENT_INTERLEAVE, HUGE_PAGE_BYTES};
+    set_allocation_policy(large_policy);
+    CNumPyArray large = array_zeros((size_t)1 << 20);
+    printf("8 MiB zeros under huge-page policy: sum %.1f\n", sum_array(&large));
+    free_array(&large);
+    set_allocation_policy(previous_policy);
+
+    // FFT demo: a cosine with 2 cycles over 8 samples puts all its energy in bin 2
+    double cosine_values[8];
+    for (size_t sample = 0; sample < 8; ++sample)
+        cosine_values[sample] = cos(2.0 * M_PI * 2.0 * (double)sample / 8.0);
+    CNumPyArray cosine = create_array(cosine_values, 8);
+    CNumPyComplexArray spectrum = rfft_array(&cosine);
+    CNumPyArray magnitude = create_array(NULL, spectrum.real.size);
+    for (size_t bin = 0; bin < spectrum.real.size; ++bin)
+        magnitude.data[bin] = hypot(spectrum.real.data[bin], spectrum.imag.data[bin]);
+    printf("rfft magnitudes of cos(2*pi*2*t/8): ");
+    print_array(&magnitude, 2);
+    CNumPyArray recovered = irfft_array(&spectrum, 8);
+    printf("irfft round trip: ");
+    print_array(&recovered, 2);
+
+    // Convolution demo: a 3-tap moving average, and locating a pattern by correlation
+    double box_values[] = {1.0 / 3.0, 1.0 / 3.0, 1.0 / 3.0};
+    CNumPyArray box = create_array(box_values, 3);
+    CNumPyArray smoothed = convolve_array(&array1, &box, CONVOLVE_VALID);
+    printf("3-tap moving average of array1: ");
+    print_array(&smoothed, 2);
+    double pattern_values[] = {3.0, 4.0};
+    CNumPyArray pattern = create_array(pattern_values, 2);
+    CNumPyArray match = correlate_array(&with_duplicates, &pattern, CONVOLVE_VALID);
+    printf("Correlation of with_duplicates with [3, 4]: ");
+    print_array(&match, 0);
+
+    // Polynomial and interpolation demo: 2x^2 - 3x + 1, and a lookup curve through 3 points
+    double polynomial_values[] = {2.0, -3.0, 1.0};
+    CNumPyArray polynomial = create_array(polynomial_values, 3);
+    CNumPyArray polynomial_at = polyval_array(&polynomial, &array1);
+    printf("2x^2 - 3x + 1 at array1: ");
+    print_array(&polynomial_at, 1);
+    double breakpoint_values[] = {0.0, 5.0, 10.0}, curve_values[] = {0.0, 100.0, 50.0};
+    CNumPyArray breakpoints = create_array(breakpoint_values, 3);
+    CNumPyArray curve = create_array(curve_values, 3);
+    CNumPyArray looked_up = interp_array(&array1, &breakpoints, &curve);
+    printf("Curve (0,0)-(5,100)-(10,50) at array1: ");
+    print_array(&looked_up, 1);
+
+    // Sorted search demo: insertion points of a few values into array1
+    double query_values[] = {1.0, 4.0, 7.0, 11.0};
+    CNumPyArray queries = create_array(query_values, 4);
+    CNumPyArray insert_left = searchsorted_array(&array1, &queries, SEARCH_LEFT);
+    SearchIndex search_index = create_search_index(&array1);
+    CNumPyArray insert_right = searchsorted_index(&search_index, &queries, SEARCH_RIGHT);
+    printf("searchsorted([1, 4, 7, 11]) in array1: left ");
+    print_array(&insert_left, 0);
+    printf("  right (via reusable index) ");
+    print_array(&insert_right, 0);
+
+    // Arrow demo: hand a copy of array1 to Arrow with values <= 4 marked null, then take it back
+    CNumPyArray arrow_values = copy_array(&array1);
+    CNumPyMask arrow_validity = greater_scalar(&array1, 4.0);
+    struct ArrowArray arrow_array;
+    struct ArrowSchema arrow_schema;
+    export_arrow_array(&arrow_values, &arrow_validity, ARROW_FLOAT64, &arrow_array, &arrow_schema);
+    ArrowColumn column = import_arrow_array(&arrow_array, &arrow_schema);
+    printf("Arrow column '%s' of %zu values, %zu null: mean of the rest %.2f\n", arrow_schema.format,
+           column.values.size, column.null_count, masked_mean_array(&column.values, &column.validity));
+    free_arrow_column(&column);
+    arrow_schema.release(&arrow_schema);
+
+    // Rolling-window demo
+    CNumPyArray rolling_mean = rolling_mean_array(&array1, 3);
+    printf("Rolling mean (window 3): ");
+    print_array(&rolling_mean, 2);
+    CNumPyArray rolling_max = rolling_max_array(&with_duplicates, 3);
+    printf("Rolling max of duplicates (window 3): ");
+    print_array(&rolling_max, 0);
+
     // Freeing everything
     free_array(&array1);
     free_array(&ones);
@@ -580,10 +6430,53 @@ int main(void)
     free_array(&array_cube);
     free_array(&reversed);
     free_array(&clipped);
+    free_array(&normalized);
     free_array(&array1_plus100);
     free_array(&with_duplicates);
     free_array(&uniques);
     free_array(&linsp);
     free_array(&arra);
+    free_array(&cumulative_sum);
+    free_array(&differences);
+    free_array(&quartile_levels);
+    free_array(&quartiles);
+    free_array(&top_values);
+    free_array(&value_counts);
+    free_array(&occurrences);
+    free_mask(&above_five);
+    free_array(&above_five_values);
+    free_array(&mixed_values);
+    free_array(&selected_values);
+    free_array(&sorted_duplicates);
+    free_array(&cancelling);
+    free_array(&noise);
+    free_array(&dice);
+    free_array(&cosine);
+    free_complex_array(&spectrum);
+    free_array(&magnitude);
+    free_array(&recovered);
+    free_array(&box);
+    free_array(&smoothed);
+    free_array(&pattern);
+    free_array(&match);
+    free_array(&polynomial);
+    free_array(&polynomial_at);
+    free_array(&breakpoints);
+    free_array(&curve);
+    free_array(&looked_up);
+    free_array(&queries);
+    free_array(&insert_left);
+    free_array(&insert_right);
+    free_search_index(&search_index);
+    fft_clear_plan_cache();
+    free_array(&rolling_mean);
+    free_array(&rolling_max);
+#if defined(CNUMPY_INSTRUMENT)
+    InstrumentSnapshot counters = instrument_snapshot();
+    printf("\nInstrumentation counters for this demo:\n");
+    instrument_print(stdout, &counters, false);
+#endif
     return 0;
 }
+
+#endif // !CNUMPY_BENCH && !CNUMPY_NO_MAIN
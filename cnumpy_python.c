@@ -0,0 +1,870 @@
+/**
+ * ===========================================================================
+ *                  cnumpy: Python bindings for CNumPy (CPython extension)
+ * ===========================================================================
+ *
+ * Description:
+ *   A CPython extension module exposing the CNumPy operations from cnumpy_allinone.c and a
+ *   flat inner-product vector search, so Python code can use the library without NumPy or
+ *   FAISS:
+ *     - Element-wise arithmetic with arrays or scalars (add, subtract, multiply, divide)
+ *     - Element-wise math (sin, cos, tan, exp, log, sqrt, absolute, floor, ceil, round, power, clip)
+ *     - Reductions (sum, mean, min, max, argmin, argmax, var, std, dot, norm)
+ *     - cumsum, diff, argsort, median, percentile, topk, searchsorted, interp, polyval
+ *     - convolve and correlate (full/same/valid)
+ *     - search(vectors, query, k): the k rows of an (n, d) matrix with the largest inner product
+ *
+ * Zero-copy interop:
+ *   Inputs are borrowed, never copied: any C-contiguous float64 object that supports the buffer
+ *   protocol (numpy.ndarray, array.array('d'), memoryview, cnumpy.Array) or that describes its
+ *   memory with __array_interface__. Results are cnumpy.Array objects that own the library's
+ *   memory and export it the same two ways, so numpy.asarray(result) and memoryview(result)
+ *   share it instead of copying.
+ *
+ * Threads:
+ *   Kernels on inputs of at least GIL_RELEASE_ELEMENTS elements run with the GIL released, so
+ *   Python threads can run searches and reductions concurrently. convolve and correlate keep
+ *   the GIL: they share the FFT plan cache and the convolution cost model.
+ *
+ * Errors:
+ *   Bad arguments raise TypeError or ValueError before the library is called (the library
+ *   itself reports misuse by exiting). Running out of memory still ends the process, as it
+ *   does for every CNumPy program.
+ *
+ * Build (Linux/macOS; the module is named cnumpy):
+ *    gcc -O2 -shared -fPIC -fvisibility=hidden $(python3-config --includes) cnumpy_python.c \
+ *        -o cnumpy$(python3-config --extension-suffix) -lm
+ *
+ * License: MIT
+ * ===========================================================================
+ */
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>                     // must come before any standard header
+
+#define CNUMPY_NO_MAIN
+#include "cnumpy_allinone.c"
+
+#define GIL_RELEASE_ELEMENTS 4096       // smaller inputs finish before another thread could use the GIL
+
+// -------------------------- Result Arrays --------------------------
+//
+// cnumpy.Array owns either CNumPyArray values (float64) or a block of positions (size_t, from
+// argsort and topk) and frees it when the last reference, including every exported buffer,
+// goes away.
+
+typedef struct {
+    PyObject_HEAD
+    CNumPyArray values;                 // owned values; data is NULL for index arrays
+    size_t *indices;                    // owned positions, for index arrays
+    Py_ssize_t size;
+    Py_ssize_t stride;
+} PythonArray;
+
+#define INDEX_FORMAT (sizeof(size_t) == 8 ? "Q" : "I")  // struct-module code of an unsigned size_t
+
+PyTypeObject python_array_type;
+
+PyObject *wrap_values(CNumPyArray values)
+{
+    PythonArray *self = PyObject_New(PythonArray, &python_array_type);
+    if (self == NULL)
+    {
+        free_array(&values);
+        return NULL;
+    }
+    self->values = values;
+    self->indices = NULL;
+    self->size = (Py_ssize_t)values.size;
+    self->stride = sizeof(double);
+    return (PyObject *)self;
+}
+
+PyObject *wrap_indices(size_t *indices, size_t count)
+{
+    PythonArray *self = PyObject_New(PythonArray, &python_array_type);
+    if (self == NULL)
+    {
+        free(indices);
+        return NULL;
+    }
+    self->values.data = NULL;
+    self->values.size = 0;
+    self->indices = indices;
+    self->size = (Py_ssize_t)count;
+    self->stride = sizeof(size_t);
+    return (PyObject *)self;
+}
+
+void python_array_dealloc(PyObject *object)
+{
+    PythonArray *self = (PythonArray *)object;
+    free_array(&self->values);
+    free(self->indices);
+    Py_TYPE(object)->tp_free(object);
+}
+
+// Buffer protocol: one contiguous, writable 1-D block of doubles or positions
+int python_array_getbuffer(PyObject *object, Py_buffer *view, int flags)
+{
+    PythonArray *self = (PythonArray *)object;
+    view->obj = object;
+    Py_INCREF(object);
+    view->buf = self->indices != NULL ? (void *)self->indices : (void *)self->values.data;
+    view->len = self->size * self->stride;
+    view->readonly = 0;
+    view->itemsize = self->stride;
+    view->format = (flags & PyBUF_FORMAT) ? (self->indices != NULL ? INDEX_FORMAT : "d") : NULL;
+    view->ndim = 1;
+    view->shape = (flags & PyBUF_ND) ? &self->size : NULL;
+    view->strides = (flags & PyBUF_STRIDES) ? &self->stride : NULL;
+    view->suboffsets = NULL;
+    view->internal = NULL;
+    return 0;
+}
+
+// __array_interface__ (version 3), for consumers that do not speak the buffer protocol
+PyObject *python_array_interface(PyObject *object, void *closure)
+{
+    (void)closure;
+    PythonArray *self = (PythonArray *)object;
+    char type_string[8];
+    snprintf(type_string, sizeof(type_string), "%c%c%zd", PY_LITTLE_ENDIAN ? '<' : '>',
+             self->indices != NULL ? 'u' : 'f', self->stride);
+    void *data = self->indices != NULL ? (void *)self->indices : (void *)self->values.data;
+    return Py_BuildValue("{s:(n),s:s,s:(N,O),s:i}", "shape", self->size, "typestr", type_string,
+                         "data", PyLong_FromVoidPtr(data), Py_False, "version", 3);
+}
+
+Py_ssize_t python_array_length(PyObject *object)
+{
+    return ((PythonArray *)object)->size;
+}
+
+PyObject *python_array_item(PyObject *object, Py_ssize_t index)
+{
+    PythonArray *self = (PythonArray *)object;
+    if (index < 0 || index >= self->size)
+    {
+        PyErr_SetString(PyExc_IndexError, "cnumpy.Array index out of range");
+        return NULL;
+    }
+    if (self->indices != NULL)
+        return PyLong_FromSize_t(self->indices[index]);
+    return PyFloat_FromDouble(self->values.data[index]);
+}
+
+PyObject *python_array_repr(PyObject *object)
+{
+    PythonArray *self = (PythonArray *)object;
+    PyObject *items = PySequence_List(object);
+    if (items == NULL)
+        return NULL;
+    PyObject *text = PyUnicode_FromFormat("cnumpy.Array(%R, %s)", items, self->indices != NULL ? "index" : "float64");
+    Py_DECREF(items);
+    return text;
+}
+
+PyBufferProcs python_array_buffer = {python_array_getbuffer, NULL};
+
+PySequenceMethods python_array_sequence = {
+    .sq_length = python_array_length,
+    .sq_item = python_array_item,
+};
+
+PyGetSetDef python_array_getset[] = {
+    {"__array_interface__", python_array_interface, NULL, "NumPy array interface (version 3)", NULL},
+    {NULL, NULL, NULL, NULL, NULL},
+};
+
+PyTypeObject python_array_type = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "cnumpy.Array",
+    .tp_basicsize = sizeof(PythonArray),
+    .tp_dealloc = python_array_dealloc,
+    .tp_repr = python_array_repr,
+    .tp_as_sequence = &python_array_sequence,
+    .tp_as_buffer = &python_array_buffer,
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_doc = "1-D array owned by CNumPy; exports its memory through the buffer protocol and __array_interface__",
+    .tp_getset = python_array_getset,
+};
+
+// -------------------------- Borrowed Inputs --------------------------
+//
+// A BorrowedArray is a CNumPyArray pointing into a Python object's memory. The object stays
+// alive, and its buffer stays exported, until return_array.
+
+typedef struct {
+    Py_buffer view;
+    bool has_view;
+    PyObject *owner;                    // exporter of an __array_interface__ pointer
+    CNumPyArray array;                  // never freed: the memory belongs to the Python object
+    Py_ssize_t rows;                    // 2-D inputs: rows x columns, row-major in array
+    Py_ssize_t columns;
+} BorrowedArray;
+
+void return_array(BorrowedArray *borrowed)
+{
+    if (borrowed->has_view)
+        PyBuffer_Release(&borrowed->view);
+    borrowed->has_view = false;
+    Py_CLEAR(borrowed->owner);
+}
+
+bool is_double_format(const char *format)
+{
+    if (format == NULL)
+        return false;                   // NULL means unsigned bytes
+    char native_order = PY_LITTLE_ENDIAN ? '<' : '>';
+    if (format[0] == '@' || format[0] == '=' || format[0] == native_order)
+        format++;
+    return strcmp(format, "d") == 0;
+}
+
+int borrow_from_buffer(PyObject *object, int dimensions, const char *name, BorrowedArray *borrowed)
+{
+    if (PyObject_GetBuffer(object, &borrowed->view, PyBUF_C_CONTIGUOUS | PyBUF_FORMAT) != 0)
+        return -1;
+    borrowed->has_view = true;
+    Py_buffer *view = &borrowed->view;
+    if (!is_double_format(view->format) || view->itemsize != sizeof(double) || view->ndim != dimensions)
+    {
+        PyErr_Format(PyExc_TypeError, "%s: expected a contiguous %d-D float64 array", name, dimensions);
+        return_array(borrowed);
+        return -1;
+    }
+    borrowed->array.data = view->buf;
+    borrowed->array.size = (size_t)(view->len / (Py_ssize_t)sizeof(double));
+    borrowed->rows = dimensions == 2 ? view->shape[0] : 1;
+    borrowed->columns = dimensions == 2 ? view->shape[1] : view->shape[0];
+    return 0;
+}
+
+int borrow_from_interface(PyObject *object, int dimensions, const char *name, BorrowedArray *borrowed)
+{
+    PyObject *interface = PyObject_GetAttrString(object, "__array_interface__");
+    if (interface == NULL || !PyDict_Check(interface))
+    {
+        Py_XDECREF(interface);
+        PyErr_Clear();
+        PyErr_Format(PyExc_TypeError, "%s: expected a float64 buffer or __array_interface__ object, got %s",
+                     name, Py_TYPE(object)->tp_name);
+        return -1;
+    }
+    char native_type[] = {PY_LITTLE_ENDIAN ? '<' : '>', 'f', '8', '\0'};
+    PyObject *type_string = PyDict_GetItemString(interface, "typestr");
+    PyObject *shape = PyDict_GetItemString(interface, "shape");
+    PyObject *strides = PyDict_GetItemString(interface, "strides");
+    PyObject *data = PyDict_GetItemString(interface, "data");
+    PyObject *mask = PyDict_GetItemString(interface, "mask");
+    const char *type_text = type_string != NULL && PyUnicode_Check(type_string) ? PyUnicode_AsUTF8(type_string) : NULL;
+    bool valid = type_text != NULL && strcmp(type_text, native_type) == 0
+        && shape != NULL && PyTuple_Check(shape) && PyTuple_GET_SIZE(shape) == dimensions
+        && (strides == NULL || strides == Py_None)
+        && (mask == NULL || mask == Py_None)
+        && data != NULL && PyTuple_Check(data) && PyTuple_GET_SIZE(data) == 2;
+    Py_ssize_t extents[2] = {1, 1};
+    for (int axis = 0; valid && axis < dimensions; ++axis)
+    {
+        extents[axis] = PyLong_AsSsize_t(PyTuple_GET_ITEM(shape, axis));
+        valid = extents[axis] >= 0;
+    }
+    void *pointer = valid ? PyLong_AsVoidPtr(PyTuple_GET_ITEM(data, 0)) : NULL;
+    Py_DECREF(interface);
+    if (!valid || PyErr_Occurred())
+    {
+        PyErr_Clear();
+        PyErr_Format(PyExc_TypeError, "%s: __array_interface__ must describe a contiguous %d-D native float64 array",
+                     name, dimensions);
+        return -1;
+    }
+    borrowed->owner = object;
+    Py_INCREF(object);
+    borrowed->array.data = pointer;
+    borrowed->array.size = (size_t)(extents[0] * extents[1]);
+    borrowed->rows = dimensions == 2 ? extents[0] : 1;
+    borrowed->columns = dimensions == 2 ? extents[1] : extents[0];
+    return 0;
+}
+
+// Borrow a float64 array of the given number of dimensions; 0, or -1 with an exception set
+int borrow_array(PyObject *object, int dimensions, const char *name, BorrowedArray *borrowed)
+{
+    memset(borrowed, 0, sizeof(*borrowed));
+    if (PyObject_CheckBuffer(object))
+        return borrow_from_buffer(object, dimensions, name, borrowed);
+    return borrow_from_interface(object, dimensions, name, borrowed);
+}
+
+PyThreadState *release_gil_for(size_t elements)
+{
+    return elements >= GIL_RELEASE_ELEMENTS ? PyEval_SaveThread() : NULL;
+}
+
+void restore_gil(PyThreadState *state)
+{
+    if (state != NULL)
+        PyEval_RestoreThread(state);
+}
+
+bool is_number(PyObject *object)
+{
+    return PyFloat_Check(object) || PyLong_Check(object);
+}
+
+// -------------------------- Operation Wrappers --------------------------
+
+typedef CNumPyArray (*ArrayFunction)(const CNumPyArray *array);
+typedef CNumPyArray (*ArrayPairFunction)(const CNumPyArray *array1, const CNumPyArray *array2);
+typedef CNumPyArray (*ArrayScalarFunction)(const CNumPyArray *array, double value);
+typedef double (*ReductionFunction)(const CNumPyArray *array);
+typedef size_t (*IndexReductionFunction)(const CNumPyArray *array);
+
+PyObject *call_unary(PyObject *argument, ArrayFunction function, const char *name)
+{
+    BorrowedArray input;
+    if (borrow_array(argument, 1, name, &input) != 0)
+        return NULL;
+    PyThreadState *state = release_gil_for(input.array.size);
+    CNumPyArray result = function(&input.array);
+    restore_gil(state);
+    return_array(&input);
+    return wrap_values(result);
+}
+
+// Array with array (same size) or array with number
+PyObject *call_binary(PyObject *args, const char *name, ArrayPairFunction array_function, ArrayScalarFunction scalar_function)
+{
+    PyObject *first, *second;
+    if (!PyArg_UnpackTuple(args, name, 2, 2, &first, &second))
+        return NULL;
+    BorrowedArray left, right;
+    if (borrow_array(first, 1, name, &left) != 0)
+        return NULL;
+    CNumPyArray result;
+    if (is_number(second))
+    {
+        double value = PyFloat_AsDouble(second);
+        if (value == -1.0 && PyErr_Occurred())
+        {
+            return_array(&left);
+            return NULL;
+        }
+        PyThreadState *state = release_gil_for(left.array.size);
+        result = scalar_function(&left.array, value);
+        restore_gil(state);
+    }
+    else
+    {
+        if (borrow_array(second, 1, name, &right) != 0)
+        {
+            return_array(&left);
+            return NULL;
+        }
+        if (left.array.size != right.array.size)
+        {
+            PyErr_Format(PyExc_ValueError, "%s: sizes differ (%zu vs %zu)", name, left.array.size, right.array.size);
+            return_array(&left);
+            return_array(&right);
+            return NULL;
+        }
+        PyThreadState *state = release_gil_for(left.array.size);
+        result = array_function(&left.array, &right.array);
+        restore_gil(state);
+        return_array(&right);
+    }
+    return_array(&left);
+    return wrap_values(result);
+}
+
+PyObject *call_reduction(PyObject *argument, ReductionFunction function, const char *name, bool needs_elements)
+{
+    BorrowedArray input;
+    if (borrow_array(argument, 1, name, &input) != 0)
+        return NULL;
+    if (needs_elements && input.array.size == 0)
+    {
+        return_array(&input);
+        return PyErr_Format(PyExc_ValueError, "%s: empty array", name);
+    }
+    PyThreadState *state = release_gil_for(input.array.size);
+    double value = function(&input.array);
+    restore_gil(state);
+    return_array(&input);
+    return PyFloat_FromDouble(value);
+}
+
+PyObject *call_index_reduction(PyObject *argument, IndexReductionFunction function, const char *name)
+{
+    BorrowedArray input;
+    if (borrow_array(argument, 1, name, &input) != 0)
+        return NULL;
+    if (input.array.size == 0)
+    {
+        return_array(&input);
+        return PyErr_Format(PyExc_ValueError, "%s: empty array", name);
+    }
+    PyThreadState *state = release_gil_for(input.array.size);
+    size_t index = function(&input.array);
+    restore_gil(state);
+    return_array(&input);
+    return PyLong_FromSize_t(index);
+}
+
+double median_of(const CNumPyArray *array) { return median_array(array, NULL); }
+
+PyObject *python_add(PyObject *module, PyObject *args)      { (void)module; return call_binary(args, "add", add_array, add_scalar); }
+PyObject *python_subtract(PyObject *module, PyObject *args) { (void)module; return call_binary(args, "subtract", subtract_array, subtract_scalar); }
+PyObject *python_multiply(PyObject *module, PyObject *args) { (void)module; return call_binary(args, "multiply", multiply_array, multiply_scalar); }
+PyObject *python_divide(PyObject *module, PyObject *args)   { (void)module; return call_binary(args, "divide", divide_array, divide_scalar); }
+
+PyObject *python_sin(PyObject *module, PyObject *argument)      { (void)module; return call_unary(argument, sin_array, "sin"); }
+PyObject *python_cos(PyObject *module, PyObject *argument)      { (void)module; return call_unary(argument, cos_array, "cos"); }
+PyObject *python_tan(PyObject *module, PyObject *argument)      { (void)module; return call_unary(argument, tan_array, "tan"); }
+PyObject *python_exp(PyObject *module, PyObject *argument)      { (void)module; return call_unary(argument, exp_array, "exp"); }
+PyObject *python_log(PyObject *module, PyObject *argument)      { (void)module; return call_unary(argument, log_array, "log"); }
+PyObject *python_sqrt(PyObject *module, PyObject *argument)     { (void)module; return call_unary(argument, sqrt_array, "sqrt"); }
+PyObject *python_absolute(PyObject *module, PyObject *argument) { (void)module; return call_unary(argument, absolute_array, "absolute"); }
+PyObject *python_floor(PyObject *module, PyObject *argument)    { (void)module; return call_unary(argument, floor_array, "floor"); }
+PyObject *python_ceil(PyObject *module, PyObject *argument)     { (void)module; return call_unary(argument, ceil_array, "ceil"); }
+PyObject *python_round(PyObject *module, PyObject *argument)    { (void)module; return call_unary(argument, round_array, "round"); }
+PyObject *python_cumsum(PyObject *module, PyObject *argument)   { (void)module; return call_unary(argument, cumsum_array, "cumsum"); }
+PyObject *python_diff(PyObject *module, PyObject *argument)     { (void)module; return call_unary(argument, diff_array, "diff"); }
+
+PyObject *python_sum(PyObject *module, PyObject *argument)    { (void)module; return call_reduction(argument, sum_array, "sum", false); }
+PyObject *python_mean(PyObject *module, PyObject *argument)   { (void)module; return call_reduction(argument, mean_array, "mean", true); }
+PyObject *python_min(PyObject *module, PyObject *argument)    { (void)module; return call_reduction(argument, min_array, "min", true); }
+PyObject *python_max(PyObject *module, PyObject *argument)    { (void)module; return call_reduction(argument, max_array, "max", true); }
+PyObject *python_var(PyObject *module, PyObject *argument)    { (void)module; return call_reduction(argument, variance_array, "var", true); }
+PyObject *python_std(PyObject *module, PyObject *argument)    { (void)module; return call_reduction(argument, std_array, "std", true); }
+PyObject *python_norm(PyObject *module, PyObject *argument)   { (void)module; return call_reduction(argument, l2_norm, "norm", false); }
+PyObject *python_median(PyObject *module, PyObject *argument) { (void)module; return call_reduction(argument, median_of, "median", true); }
+PyObject *python_argmin(PyObject *module, PyObject *argument) { (void)module; return call_index_reduction(argument, argmin_array, "argmin"); }
+PyObject *python_argmax(PyObject *module, PyObject *argument) { (void)module; return call_index_reduction(argument, argmax_array, "argmax"); }
+
+PyObject *python_dot(PyObject *module, PyObject *args)
+{
+    (void)module;
+    PyObject *first, *second;
+    if (!PyArg_UnpackTuple(args, "dot", 2, 2, &first, &second))
+        return NULL;
+    BorrowedArray left, right;
+    if (borrow_array(first, 1, "dot", &left) != 0)
+        return NULL;
+    if (borrow_array(second, 1, "dot", &right) != 0)
+    {
+        return_array(&left);
+        return NULL;
+    }
+    if (left.array.size != right.array.size)
+    {
+        PyErr_Format(PyExc_ValueError, "dot: sizes differ (%zu vs %zu)", left.array.size, right.array.size);
+        return_array(&left);
+        return_array(&right);
+        return NULL;
+    }
+    PyThreadState *state = release_gil_for(left.array.size);
+    double value = dot_array(&left.array, &right.array);
+    restore_gil(state);
+    return_array(&left);
+    return_array(&right);
+    return PyFloat_FromDouble(value);
+}
+
+PyObject *python_power(PyObject *module, PyObject *args)
+{
+    (void)module;
+    PyObject *object;
+    double exponent;
+    if (!PyArg_ParseTuple(args, "Od:power", &object, &exponent))
+        return NULL;
+    BorrowedArray input;
+    if (borrow_array(object, 1, "power", &input) != 0)
+        return NULL;
+    PyThreadState *state = release_gil_for(input.array.size);
+    CNumPyArray result = pow_array(&input.array, exponent);
+    restore_gil(state);
+    return_array(&input);
+    return wrap_values(result);
+}
+
+PyObject *python_clip(PyObject *module, PyObject *args)
+{
+    (void)module;
+    PyObject *object;
+    double min_value, max_value;
+    if (!PyArg_ParseTuple(args, "Odd:clip", &object, &min_value, &max_value))
+        return NULL;
+    BorrowedArray input;
+    if (borrow_array(object, 1, "clip", &input) != 0)
+        return NULL;
+    PyThreadState *state = release_gil_for(input.array.size);
+    CNumPyArray result = clip_array(&input.array, min_value, max_value);
+    restore_gil(state);
+    return_array(&input);
+    return wrap_values(result);
+}
+
+// Stable ascending order as an index array
+PyObject *python_argsort(PyObject *module, PyObject *argument)
+{
+    (void)module;
+    BorrowedArray input;
+    if (borrow_array(argument, 1, "argsort", &input) != 0)
+        return NULL;
+    size_t *indices = malloc(input.array.size * sizeof(size_t) + 1);
+    if (indices == NULL)
+    {
+        return_array(&input);
+        return PyErr_NoMemory();
+    }
+    PyThreadState *state = release_gil_for(input.array.size);
+    argsort_array(&input.array, indices);
+    restore_gil(state);
+    size_t count = input.array.size;
+    return_array(&input);
+    return wrap_indices(indices, count);
+}
+
+// percentile(x, q): a float for a number q, an Array for an array of levels
+PyObject *python_percentile(PyObject *module, PyObject *args)
+{
+    (void)module;
+    PyObject *object, *levels_object;
+    if (!PyArg_UnpackTuple(args, "percentile", 2, 2, &object, &levels_object))
+        return NULL;
+    BorrowedArray input, levels;
+    double single_level;
+    CNumPyArray single = {&single_level, 1};
+    const CNumPyArray *percentiles = &single;
+    levels.has_view = false;
+    levels.owner = NULL;
+    if (is_number(levels_object))
+    {
+        single_level = PyFloat_AsDouble(levels_object);
+        if (single_level == -1.0 && PyErr_Occurred())
+            return NULL;
+    }
+    else
+    {
+        if (borrow_array(levels_object, 1, "percentile", &levels) != 0)
+            return NULL;
+        percentiles = &levels.array;
+    }
+    for (size_t index = 0; index < percentiles->size; ++index)
+    {
+        if (!(percentiles->data[index] >= 0.0 && percentiles->data[index] <= 100.0))
+        {
+            return_array(&levels);
+            return PyErr_Format(PyExc_ValueError, "percentile: levels must be in [0, 100]");
+        }
+    }
+    if (borrow_array(object, 1, "percentile", &input) != 0)
+    {
+        return_array(&levels);
+        return NULL;
+    }
+    PyThreadState *state = release_gil_for(input.array.size);
+    CNumPyArray result = percentile_array(&input.array, percentiles, NULL);
+    restore_gil(state);
+    return_array(&input);
+    return_array(&levels);
+    if (percentiles != &single)
+        return wrap_values(result);
+    PyObject *value = PyFloat_FromDouble(result.data[0]);
+    free_array(&result);
+    return value;
+}
+
+// topk(x, k) -> (values, indices), largest first
+PyObject *python_topk(PyObject *module, PyObject *args)
+{
+    (void)module;
+    PyObject *object;
+    Py_ssize_t k;
+    if (!PyArg_ParseTuple(args, "On:topk", &object, &k))
+        return NULL;
+    BorrowedArray input;
+    if (borrow_array(object, 1, "topk", &input) != 0)
+        return NULL;
+    if (k < 0 || (size_t)k > input.array.size)
+    {
+        return_array(&input);
+        return PyErr_Format(PyExc_ValueError, "topk: k = %zd is outside [0, %zu]", k, input.array.size);
+    }
+    size_t *indices = malloc((size_t)k * sizeof(size_t) + 1);
+    if (indices == NULL)
+    {
+        return_array(&input);
+        return PyErr_NoMemory();
+    }
+    PyThreadState *state = release_gil_for(input.array.size);
+    CNumPyArray values = topk_array(&input.array, (size_t)k, indices);
+    restore_gil(state);
+    return_array(&input);
+    return Py_BuildValue("(NN)", wrap_values(values), wrap_indices(indices, (size_t)k));
+}
+
+PyObject *python_searchsorted(PyObject *module, PyObject *args)
+{
+    (void)module;
+    PyObject *sorted_object, *queries_object;
+    const char *side_name = "left";
+    if (!PyArg_ParseTuple(args, "OO|s:searchsorted", &sorted_object, &queries_object, &side_name))
+        return NULL;
+    if (strcmp(side_name, "left") != 0 && strcmp(side_name, "right") != 0)
+        return PyErr_Format(PyExc_ValueError, "searchsorted: side must be 'left' or 'right', not '%s'", side_name);
+    SearchSide side = strcmp(side_name, "left") == 0 ? SEARCH_LEFT : SEARCH_RIGHT;
+    BorrowedArray sorted, queries;
+    if (borrow_array(sorted_object, 1, "searchsorted", &sorted) != 0)
+        return NULL;
+    if (borrow_array(queries_object, 1, "searchsorted", &queries) != 0)
+    {
+        return_array(&sorted);
+        return NULL;
+    }
+    if (!is_nondecreasing(&sorted.array))
+    {
+        return_array(&sorted);
+        return_array(&queries);
+        return PyErr_Format(PyExc_ValueError, "searchsorted: array must be sorted in ascending order without NaN");
+    }
+    size_t count = queries.array.size;
+    size_t *positions = malloc(count * sizeof(size_t) + 1);
+    if (positions == NULL)
+    {
+        return_array(&sorted);
+        return_array(&queries);
+        return PyErr_NoMemory();
+    }
+    PyThreadState *state = release_gil_for(sorted.array.size + count);
+    CNumPyArray result = searchsorted_array(&sorted.array, &queries.array, side);
+    for (size_t index = 0; index < count; ++index)
+        positions[index] = (size_t)result.data[index];  // positions are exact in a double
+    free_array(&result);
+    restore_gil(state);
+    return_array(&sorted);
+    return_array(&queries);
+    return wrap_indices(positions, count);
+}
+
+PyObject *python_interp(PyObject *module, PyObject *args)
+{
+    (void)module;
+    PyObject *objects[3];
+    if (!PyArg_UnpackTuple(args, "interp", 3, 3, &objects[0], &objects[1], &objects[2]))
+        return NULL;
+    BorrowedArray inputs[3];
+    for (int input = 0; input < 3; ++input)
+    {
+        if (borrow_array(objects[input], 1, "interp", &inputs[input]) != 0)
+        {
+            while (input-- > 0)
+                return_array(&inputs[input]);
+            return NULL;
+        }
+    }
+    const CNumPyArray *xp = &inputs[1].array, *fp = &inputs[2].array;
+    bool valid = xp->size > 0 && xp->size == fp->size;
+    for (size_t index = 1; valid && index < xp->size; ++index)
+        valid = xp->data[index - 1] < xp->data[index];
+    CNumPyArray result = {NULL, 0};
+    if (valid)
+    {
+        PyThreadState *state = release_gil_for(inputs[0].array.size);
+        result = interp_array(&inputs[0].array, xp, fp);
+        restore_gil(state);
+    }
+    for (int input = 0; input < 3; ++input)
+        return_array(&inputs[input]);
+    if (!valid)
+        return PyErr_Format(PyExc_ValueError, "interp: xp must be strictly increasing, nonempty and as long as fp");
+    return wrap_values(result);
+}
+
+PyObject *python_polyval(PyObject *module, PyObject *args)
+{
+    (void)module;
+    PyObject *coefficients_object, *object;
+    if (!PyArg_UnpackTuple(args, "polyval", 2, 2, &coefficients_object, &object))
+        return NULL;
+    BorrowedArray coefficients, input;
+    if (borrow_array(coefficients_object, 1, "polyval", &coefficients) != 0)
+        return NULL;
+    if (borrow_array(object, 1, "polyval", &input) != 0)
+    {
+        return_array(&coefficients);
+        return NULL;
+    }
+    PyThreadState *state = release_gil_for(input.array.size * (coefficients.array.size + 1));
+    CNumPyArray result = polyval_array(&coefficients.array, &input.array);
+    restore_gil(state);
+    return_array(&coefficients);
+    return_array(&input);
+    return wrap_values(result);
+}
+
+// convolve/correlate keep the GIL: the FFT plan cache and the cost model are shared state
+PyObject *call_convolution(PyObject *args, bool correlate)
+{
+    const char *name = correlate ? "correlate" : "convolve";
+    PyObject *first, *second;
+    const char *mode_name = correlate ? "valid" : "full";
+    if (!PyArg_ParseTuple(args, correlate ? "OO|s:correlate" : "OO|s:convolve", &first, &second, &mode_name))
+        return NULL;
+    ConvolveMode mode;
+    if (strcmp(mode_name, "full") == 0)
+        mode = CONVOLVE_FULL;
+    else if (strcmp(mode_name, "same") == 0)
+        mode = CONVOLVE_SAME;
+    else if (strcmp(mode_name, "valid") == 0)
+        mode = CONVOLVE_VALID;
+    else
+        return PyErr_Format(PyExc_ValueError, "%s: mode must be 'full', 'same' or 'valid', not '%s'", name, mode_name);
+    BorrowedArray left, right;
+    if (borrow_array(first, 1, name, &left) != 0)
+        return NULL;
+    if (borrow_array(second, 1, name, &right) != 0)
+    {
+        return_array(&left);
+        return NULL;
+    }
+    if (left.array.size == 0 || right.array.size == 0)
+    {
+        return_array(&left);
+        return_array(&right);
+        return PyErr_Format(PyExc_ValueError, "%s: inputs must not be empty", name);
+    }
+    CNumPyArray result = correlate ? correlate_array(&left.array, &right.array, mode)
+                                   : convolve_array(&left.array, &right.array, mode);
+    return_array(&left);
+    return_array(&right);
+    return wrap_values(result);
+}
+
+PyObject *python_convolve(PyObject *module, PyObject *args)  { (void)module; return call_convolution(args, false); }
+PyObject *python_correlate(PyObject *module, PyObject *args) { (void)module; return call_convolution(args, true); }
+
+// -------------------------- Vector Search --------------------------
+//
+// search(vectors, query, k) scores every row of an (n, d) float64 matrix by its inner product
+// with query and returns (scores, indices) of the k best rows, best first: exact maximum inner
+// product search, like faiss.IndexFlatIP. With unit-length rows and query, the scores are
+// cosine similarities. The whole search runs without the GIL.
+
+PyObject *python_search(PyObject *module, PyObject *args)
+{
+    (void)module;
+    PyObject *vectors_object, *query_object;
+    Py_ssize_t k;
+    if (!PyArg_ParseTuple(args, "OOn:search", &vectors_object, &query_object, &k))
+        return NULL;
+    BorrowedArray vectors, query;
+    if (borrow_array(vectors_object, 2, "search", &vectors) != 0)
+        return NULL;
+    if (borrow_array(query_object, 1, "search", &query) != 0)
+    {
+        return_array(&vectors);
+        return NULL;
+    }
+    if (query.columns != vectors.columns || k < 0 || k > vectors.rows)
+    {
+        PyErr_Format(PyExc_ValueError, "search: need a query of length %zd and k in [0, %zd] (got %zd, %zd)",
+                     vectors.columns, vectors.rows, query.columns, k);
+        return_array(&vectors);
+        return_array(&query);
+        return NULL;
+    }
+    size_t *indices = malloc((size_t)k * sizeof(size_t) + 1);
+    if (indices == NULL)
+    {
+        return_array(&vectors);
+        return_array(&query);
+        return PyErr_NoMemory();
+    }
+    PyThreadState *state = release_gil_for(vectors.array.size);
+    size_t rows = (size_t)vectors.rows, columns = (size_t)vectors.columns;
+    CNumPyArray scores = allocate_array(rows);
+    for (size_t row = 0; row < rows; ++row)
+    {
+        CNumPyArray vector = {vectors.array.data + row * columns, columns};
+        scores.data[row] = dot_array(&vector, &query.array);
+    }
+    CNumPyArray best = topk_array(&scores, (size_t)k, indices);
+    free_array(&scores);
+    restore_gil(state);
+    return_array(&vectors);
+    return_array(&query);
+    return Py_BuildValue("(NN)", wrap_values(best), wrap_indices(indices, (size_t)k));
+}
+
+// -------------------------- Module --------------------------
+
+PyMethodDef cnumpy_methods[] = {
+    {"add", python_add, METH_VARARGS, "add(x, y): x + y, y an array of the same size or a number"},
+    {"subtract", python_subtract, METH_VARARGS, "subtract(x, y): x - y"},
+    {"multiply", python_multiply, METH_VARARGS, "multiply(x, y): x * y"},
+    {"divide", python_divide, METH_VARARGS, "divide(x, y): x / y"},
+    {"power", python_power, METH_VARARGS, "power(x, p): x ** p"},
+    {"clip", python_clip, METH_VARARGS, "clip(x, low, high)"},
+    {"sin", python_sin, METH_O, "sin(x)"},
+    {"cos", python_cos, METH_O, "cos(x)"},
+    {"tan", python_tan, METH_O, "tan(x)"},
+    {"exp", python_exp, METH_O, "exp(x)"},
+    {"log", python_log, METH_O, "log(x)"},
+    {"sqrt", python_sqrt, METH_O, "sqrt(x)"},
+    {"absolute", python_absolute, METH_O, "absolute(x)"},
+    {"floor", python_floor, METH_O, "floor(x)"},
+    {"ceil", python_ceil, METH_O, "ceil(x)"},
+    {"round", python_round, METH_O, "round(x): halves away from zero"},
+    {"cumsum", python_cumsum, METH_O, "cumsum(x)"},
+    {"diff", python_diff, METH_O, "diff(x): x[i + 1] - x[i]"},
+    {"sum", python_sum, METH_O, "sum(x)"},
+    {"mean", python_mean, METH_O, "mean(x)"},
+    {"min", python_min, METH_O, "min(x)"},
+    {"max", python_max, METH_O, "max(x)"},
+    {"argmin", python_argmin, METH_O, "argmin(x): index of the first minimum"},
+    {"argmax", python_argmax, METH_O, "argmax(x): index of the first maximum"},
+    {"var", python_var, METH_O, "var(x): population variance"},
+    {"std", python_std, METH_O, "std(x): population standard deviation"},
+    {"norm", python_norm, METH_O, "norm(x): L2 norm"},
+    {"dot", python_dot, METH_VARARGS, "dot(x, y)"},
+    {"median", python_median, METH_O, "median(x)"},
+    {"percentile", python_percentile, METH_VARARGS, "percentile(x, q): q a number or an array of levels in [0, 100]"},
+    {"argsort", python_argsort, METH_O, "argsort(x): stable ascending order as an index Array"},
+    {"topk", python_topk, METH_VARARGS, "topk(x, k) -> (values, indices) of the k largest, largest first"},
+    {"searchsorted", python_searchsorted, METH_VARARGS, "searchsorted(sorted, queries, side='left'): insertion positions as an index Array"},
+    {"interp", python_interp, METH_VARARGS, "interp(x, xp, fp): piecewise-linear interpolation"},
+    {"polyval", python_polyval, METH_VARARGS, "polyval(coefficients, x): highest power first"},
+    {"convolve", python_convolve, METH_VARARGS, "convolve(x, v, mode='full')"},
+    {"correlate", python_correlate, METH_VARARGS, "correlate(x, v, mode='valid')"},
+    {"search", python_search, METH_VARARGS,
+     "search(vectors, query, k) -> (scores, indices): the k rows of the (n, d) matrix vectors with the largest "
+     "inner product with query, best first"},
+    {NULL, NULL, 0, NULL},
+};
+
+struct PyModuleDef cnumpy_module = {
+    PyModuleDef_HEAD_INIT,
+    .m_name = "cnumpy",
+    .m_doc = "CNumPy operations on float64 buffers without copying, and exact inner-product vector search",
+    .m_size = -1,
+    .m_methods = cnumpy_methods,
+};
+
+PyMODINIT_FUNC PyInit_cnumpy(void)
+{
+    if (PyType_Ready(&python_array_type) < 0)
+        return NULL;
+    PyObject *module = PyModule_Create(&cnumpy_module);
+    if (module == NULL)
+        return NULL;
+    Py_INCREF(&python_array_type);
+    if (PyModule_AddObject(module, "Array", (PyObject *)&python_array_type) < 0)
+    {
+        Py_DECREF(&python_array_type);
+        Py_DECREF(module);
+        return NULL;
+    }
+    return module;
+}
@@ -1,14 +1,13 @@
 """
 This script is an offline intelligent semantic search tool for medical question and answer databases, focused on topics such as antibiotics and antiviral drugs. The core principle is to use a deep learning natural language model—specifically, a multilingual SentenceTransformer model—to convert both users' natural language queries and the database's question entries into high-dimensional semantic vectors that capture meaning and context across many languages.
 
-After all database question entries have been converted into sentence embeddings, the script uses the FAISS library to build a vector index. When the user enters a query, the program encodes the query into a sentence vector as well, then uses cosine similarity to search the index efficiently. Cosine similarity measures the angle between the semantic vectors of the query and each database entry, so it reflects their semantic closeness rather than matching exact words or word order. This way, the tool can find the most relevant answers even if the user's question is phrased differently or in a different language.
+After all database question entries have been converted into sentence embeddings, the script keeps them as one matrix of unit-length vectors. When the user enters a query, the program encodes the query into a sentence vector as well, then uses cosine similarity to search the matrix with the cnumpy extension module (cnumpy_python.c), an exact inner-product search over the embeddings in place, without copying them. Cosine similarity measures the angle between the semantic vectors of the query and each database entry, so it reflects their semantic closeness rather than matching exact words or word order. This way, the tool can find the most relevant answers even if the user's question is phrased differently or in a different language.
 
-The model for encoding text is downloaded once and then stored locally, allowing fully offline use after the initial download. The combination of SentenceTransformer for semantic understanding and FAISS for fast similarity search gives this program high speed and accuracy, supporting both short and long queries, and allowing the answer text to be rich in format and content.
+The model for encoding text is downloaded once and then stored locally, allowing fully offline use after the initial download. The combination of SentenceTransformer for semantic understanding and CNumPy for exact similarity search gives this program high speed and accuracy, supporting both short and long queries, and allowing the answer text to be rich in format and content.
 """
 
 from sentence_transformers import SentenceTransformer
-import numpy as np
-import faiss
+import cnumpy  # build: see the header of cnumpy_python.c
 import os
 
 MODEL_DIR = 'models/paraphrase-multilingual-MiniLM-L12-v2'
@@ -75,14 +74,10 @@ Treatment depends on the virus, health condition, and available medications.
 """
 }
 
-# Prepare the keys and encode them as sentence embeddings
+# Prepare the keys and encode them as unit-length sentence embeddings (float64 for cnumpy),
+# so that the inner product of two embeddings is their cosine similarity
 key_list = list(data.keys())
-key_embeddings = model.encode(key_list, convert_to_numpy=True).astype('float32')
-key_embeddings /= np.linalg.norm(key_embeddings, axis=1, keepdims=True)
-
-# Build a FAISS index for efficient similarity search using cosine similarity
-faiss_index = faiss.IndexFlatIP(key_embeddings.shape[1])
-faiss_index.add(key_embeddings)
+key_embeddings = model.encode(key_list, convert_to_numpy=True, normalize_embeddings=True).astype('float64')
 
 print("Enter your antibiotic or antiviral drug question. Type q or quit to exit.")
 
@@ -91,12 +86,11 @@ while True:
     if user_query.lower() in ['q', 'quit', 'exit']:
         print("Exiting search.")
         break
-    query_embedding = model.encode([user_query], convert_to_numpy=True).astype('float32')
-    query_embedding /= np.linalg.norm(query_embedding, axis=1, keepdims=True)
-    topN = 3
-    D, I = faiss_index.search(query_embedding, topN)
+    query_embedding = model.encode(user_query, convert_to_numpy=True, normalize_embeddings=True).astype('float64')
+    topN = min(3, len(key_list))
+    scores, indices = cnumpy.search(key_embeddings, query_embedding, topN)
     print("Most relevant answers:")
-    for idx, score in zip(I[0], D[0]):
+    for idx, score in zip(indices, scores):
         if score < 0.3:
             continue
         question = key_list[idx]